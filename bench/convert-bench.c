@@ -0,0 +1,166 @@
+/*
+ * Throughput of the pixel format conversions per instruction set
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pixel-convert.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+struct buffers {
+  uint8_t *rgb;
+  uint32_t *argb, *out;
+  uint16_t *rgb565;
+  uint8_t *y, *u, *v, *uv;
+};
+
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void run(int op, struct buffers *b)
+{
+  size_t n = (size_t) WIDTH * HEIGHT;
+
+  switch (op) {
+  case 0:
+    pixel_convert_rgb_to_rgba(b->out, b->rgb, n);
+    break;
+  case 1:
+    pixel_convert_rgb_to_argb(b->out, b->rgb, n);
+    break;
+  case 2:
+    pixel_convert_swap_rb(b->out, b->argb, n);
+    break;
+  case 3:
+    pixel_convert_premultiply(b->out, b->argb, n);
+    break;
+  case 4:
+    pixel_convert_unpremultiply(b->out, b->argb, n);
+    break;
+  case 5:
+    pixel_convert_argb_to_rgb565(b->rgb565, b->argb, n);
+    break;
+  case 6:
+    pixel_convert_rgb565_to_argb(b->out, b->rgb565, n);
+    break;
+  case 7:
+    pixel_convert_yuv420_to_argb(b->out, WIDTH * 4, b->y, WIDTH, b->u, b->v, WIDTH / 2,
+                                 WIDTH, HEIGHT, YUV_BT601);
+    break;
+  case 8:
+    pixel_convert_nv12_to_argb(b->out, WIDTH * 4, b->y, WIDTH, b->uv, WIDTH,
+                               WIDTH, HEIGHT, YUV_BT709);
+    break;
+  }
+}
+
+static void usage(int error_code)
+{
+  fprintf(stderr, "Usage: convert-bench [OPTIONS]\n\n"
+          "  --iterations N\tConversions per measurement (default 50)\n"
+          "  -h\t\tThis help text\n\n");
+
+  exit(error_code);
+}
+
+int main(int argc, char **argv)
+{
+  static const char *ops[] = {
+    "rgb->rgba", "rgb->argb", "swap_rb", "premultiply", "unpremultiply",
+    "argb->565", "565->argb", "i420->argb", "nv12->argb",
+  };
+  static const enum pixel_isa isas[] = { PIXEL_ISA_SCALAR, PIXEL_ISA_SSE2, PIXEL_ISA_AVX2 };
+  size_t n = (size_t) WIDTH * HEIGHT, i;
+  struct buffers b;
+  int iterations = 50, op, k;
+
+  for (k = 1; k < argc; k++) {
+    if (strcmp("--iterations", argv[k]) == 0 && k + 1 < argc)
+      iterations = atoi(argv[++k]);
+    else if (strcmp("-h", argv[k]) == 0)
+      usage(EXIT_SUCCESS);
+    else
+      usage(EXIT_FAILURE);
+  }
+  if (iterations < 1)
+    usage(EXIT_FAILURE);
+
+  b.rgb = malloc(n * 3);
+  b.argb = malloc(n * 4);
+  b.out = malloc(n * 4);
+  b.rgb565 = malloc(n * 2);
+  b.y = malloc(n);
+  b.u = malloc(n / 4);
+  b.v = malloc(n / 4);
+  b.uv = malloc(n / 2);
+  if (!b.rgb || !b.argb || !b.out || !b.rgb565 || !b.y || !b.u || !b.v || !b.uv) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  srand(1);
+  for (i = 0; i < n * 3; i++)
+    b.rgb[i] = rand();
+  for (i = 0; i < n; i++) {
+    b.argb[i] = (uint32_t) rand() << 16 ^ rand();
+    b.rgb565[i] = rand();
+    b.y[i] = rand();
+  }
+  for (i = 0; i < n / 4; i++) {
+    b.u[i] = rand();
+    b.v[i] = rand();
+  }
+  for (i = 0; i < n / 2; i++)
+    b.uv[i] = rand();
+
+  printf("%dx%d, %d conversions per measurement, MPix/s\n\n", WIDTH, HEIGHT, iterations);
+  printf("%-14s", "");
+  for (k = 0; k < (int) (sizeof isas / sizeof isas[0]); k++)
+    printf(" %10s", pixel_isa_name(isas[k]));
+  printf("\n");
+
+  for (op = 0; op < (int) (sizeof ops / sizeof ops[0]); op++) {
+    printf("%-14s", ops[op]);
+    for (k = 0; k < (int) (sizeof isas / sizeof isas[0]); k++) {
+      double start, ms;
+      int j;
+
+      if (pixel_convert_set_isa(isas[k]) != isas[k]) {
+        printf(" %10s", "-");
+        continue;
+      }
+
+      /* One untimed run to fault everything in. */
+      run(op, &b);
+
+      start = now_ms();
+      for (j = 0; j < iterations; j++)
+        run(op, &b);
+      ms = (now_ms() - start) / iterations;
+
+      printf(" %10.0f", n / (ms * 1e3));
+    }
+    printf("\n");
+  }
+
+  free(b.rgb);
+  free(b.argb);
+  free(b.out);
+  free(b.rgb565);
+  free(b.y);
+  free(b.u);
+  free(b.v);
+  free(b.uv);
+
+  return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Video frame ingest through the frame importer versus read() and glTexImage2D()
+ *
+ * A producer cycles through three memfd frame buffers, the way a decoder
+ * reuses its output buffers; each frame is imported, drawn and finished
+ * in an EGL pbuffer, like sprite-bench.  Latency is from the import call to
+ * the texture being usable, with glFinish() so the upload is included.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <EGL/egl.h>
+
+#include "frame-import.h"
+
+#define SIZE 256
+#define BUFFERS 3
+#define FRAMES 120
+
+struct frame_buffer {
+  int fd;
+  uint8_t *map;
+};
+
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int init_egl(EGLDisplay *display_out)
+{
+  static const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_NONE
+  };
+  static const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH, SIZE,
+    EGL_HEIGHT, SIZE,
+    EGL_NONE
+  };
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  EGLConfig config;
+  EGLSurface surface;
+  EGLContext context;
+  EGLint n;
+
+  if (!eglInitialize(display, NULL, NULL) ||
+      !eglChooseConfig(display, config_attribs, &config, 1, &n) || n < 1 ||
+      !eglBindAPI(EGL_OPENGL_API))
+    return -1;
+  surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, surface, surface, context))
+    return -1;
+  *display_out = display;
+  return 0;
+}
+
+static size_t frame_size(const struct frame_desc *desc)
+{
+  int chroma = desc->format == FRAME_FORMAT_NV12 ? desc->height / 2 : 0;
+
+  return (size_t) desc->stride * (desc->height + chroma);
+}
+
+static int create_buffers(struct frame_buffer *buffers, const struct frame_desc *desc)
+{
+  size_t size = frame_size(desc);
+  int i;
+
+  for (i = 0; i < BUFFERS; i++) {
+    buffers[i].fd = memfd_create("frame", MFD_CLOEXEC);
+    if (buffers[i].fd < 0 || ftruncate(buffers[i].fd, size) < 0)
+      return -1;
+    buffers[i].map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buffers[i].fd, 0);
+    if (buffers[i].map == MAP_FAILED)
+      return -1;
+  }
+  return 0;
+}
+
+static void destroy_buffers(struct frame_buffer *buffers, const struct frame_desc *desc)
+{
+  int i;
+
+  for (i = 0; i < BUFFERS; i++) {
+    munmap(buffers[i].map, frame_size(desc));
+    close(buffers[i].fd);
+  }
+}
+
+/* What the decoder would do; not timed. */
+static void produce(struct frame_buffer *buffer, const struct frame_desc *desc, int frame)
+{
+  memset(buffer->map, frame * 37, frame_size(desc));
+}
+
+static void draw(GLuint texture)
+{
+  static const GLfloat vertex[4][2] = { { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 } };
+  static const GLfloat texcoord[4][2] = { { 0, 1 }, { 1, 1 }, { 0, 0 }, { 1, 0 } };
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, vertex);
+  glTexCoordPointer(2, GL_FLOAT, 0, texcoord);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+/* The path without the importer: read() into a heap copy, respecify the texture. */
+static GLuint ingest_copy(GLuint texture, int fd, const struct frame_desc *desc, void *copy)
+{
+  if (pread(fd, copy, (size_t) desc->stride * desc->height, 0) < 0)
+    return 0;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, desc->stride / 4, desc->height, 0,
+               GL_BGRA, GL_UNSIGNED_BYTE, copy);
+  return texture;
+}
+
+/* Frames per second; |latency| gets the mean and worst ingest ms. */
+static double run(struct frame_importer *importer, const struct frame_desc *desc,
+                  double latency[2])
+{
+  struct frame_buffer buffers[BUFFERS];
+  GLuint texture = 0, copy_texture = 0;
+  double start, busy = 0, t;
+  void *copy = NULL;
+  int frame;
+
+  if (create_buffers(buffers, desc) < 0)
+    return 0;
+  if (!importer) {
+    copy = malloc(frame_size(desc));
+    glGenTextures(1, &copy_texture);
+    glBindTexture(GL_TEXTURE_2D, copy_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  }
+
+  latency[0] = latency[1] = 0;
+  for (frame = -BUFFERS; frame < FRAMES; frame++) {
+    struct frame_buffer *buffer = &buffers[(frame + BUFFERS) % BUFFERS];
+
+    produce(buffer, desc, frame);
+    start = now_ms();
+    if (importer)
+      texture = frame_importer_import(importer, buffer->fd, desc);
+    else
+      texture = ingest_copy(copy_texture, buffer->fd, desc, copy);
+    glFinish();
+    t = now_ms() - start;
+    draw(texture);
+    glFinish();
+
+    /* The first pass over the buffers maps them; count the steady state. */
+    if (frame < 0)
+      continue;
+    latency[0] += t;
+    if (t > latency[1])
+      latency[1] = t;
+    busy += now_ms() - start;
+  }
+  latency[0] /= FRAMES;
+
+  if (copy_texture)
+    glDeleteTextures(1, &copy_texture);
+  free(copy);
+  destroy_buffers(buffers, desc);
+  return busy > 0 ? FRAMES * 1e3 / busy : 0;
+}
+
+int main(void)
+{
+  static const struct {
+    const char *name;
+    struct frame_desc desc;
+    int copy;                /* the read() path handles packed 32 bit only */
+  } cases[] = {
+    { "ARGB8888 1080p", { FRAME_FORMAT_ARGB8888, 1920, 1080, 1920 * 4, 0 }, 1 },
+    { "XRGB8888 1080p, padded", { FRAME_FORMAT_XRGB8888, 1920, 1080, 2048 * 4, 0 }, 1 },
+    { "NV12 1080p", { FRAME_FORMAT_NV12, 1920, 1080, 1920, 0 }, 0 },
+    { "NV12 720p", { FRAME_FORMAT_NV12, 1280, 720, 1280, 0 }, 0 },
+  };
+  struct frame_importer *importer;
+  EGLDisplay display;
+  size_t i;
+
+  if (init_egl(&display) < 0) {
+    fprintf(stderr, "no EGL pbuffer with desktop GL\n");
+    return 1;
+  }
+  printf("%s\n", (const char *) glGetString(GL_RENDERER));
+  importer = frame_importer_create(display);
+  if (!importer)
+    return 1;
+  glViewport(0, 0, SIZE, SIZE);
+  glEnable(GL_TEXTURE_2D);
+
+  printf("%-24s %-8s %8s %10s %10s\n", "frame", "path", "fps", "mean ms", "worst ms");
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    double latency[2], fps;
+
+    if (cases[i].copy) {
+      fps = run(NULL, &cases[i].desc, latency);
+      printf("%-24s %-8s %8.1f %10.2f %10.2f\n", cases[i].name, "copy", fps,
+             latency[0], latency[1]);
+    }
+    fps = run(importer, &cases[i].desc, latency);
+    printf("%-24s %-8s %8.1f %10.2f %10.2f\n", cases[i].name, "import", fps,
+           latency[0], latency[1]);
+  }
+
+  frame_importer_destroy(importer);
+  return 0;
+}
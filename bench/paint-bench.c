@@ -0,0 +1,134 @@
+/*
+ * Paint throughput of the SHM checkerboard versus thread count
+ *
+ * Paints into memfd backed shared memory, the same way the SHM samples do,
+ * without needing a compositor.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm-alloc.h"
+#include "pixel-fill.h"
+#include "thread-pool.h"
+
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double paint_ms(struct thread_pool *pool, void *data, int width, int height,
+                       int tile, int iterations)
+{
+  struct checker_job job = {
+    .data = data,
+    .checker = {
+      .format = PIXEL_FORMAT_ARGB8888,
+      .tile = tile,
+      .width = width,
+      .height = height,
+      .stride = width * 4,
+    },
+    .width = width,
+    .height = height,
+  };
+  double start;
+  int i;
+
+  /* One untimed frame to fault everything in. */
+  thread_pool_run(pool, pixel_fill_checker_band, &job, thread_pool_size(pool));
+
+  start = now_ms();
+  for (i = 0; i < iterations; i++) {
+    job.checker.offset = i;
+    thread_pool_run(pool, pixel_fill_checker_band, &job, thread_pool_size(pool));
+  }
+
+  return (now_ms() - start) / iterations;
+}
+
+static void usage(int error_code)
+{
+  fprintf(stderr, "Usage: paint-bench [OPTIONS]\n\n"
+          "  --threads N\tLargest thread count to try (default: online CPUs)\n"
+          "  --iterations N\tFrames per measurement (default 200)\n"
+          "  --tile N\tCheckerboard tile size (default 20)\n"
+          "  -h\t\tThis help text\n\n");
+
+  exit(error_code);
+}
+
+int main(int argc, char **argv)
+{
+  static const int sizes[][2] = { { 320, 320 }, { 1920, 1080 }, { 3840, 2160 } };
+  int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int iterations = 200, tile = 20;
+  unsigned s;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc)
+      max_threads = atoi(argv[++i]);
+    else if (strcmp("--iterations", argv[i]) == 0 && i + 1 < argc)
+      iterations = atoi(argv[++i]);
+    else if (strcmp("--tile", argv[i]) == 0 && i + 1 < argc)
+      tile = atoi(argv[++i]);
+    else if (strcmp("-h", argv[i]) == 0)
+      usage(EXIT_SUCCESS);
+    else
+      usage(EXIT_FAILURE);
+  }
+  if (max_threads < 1 || iterations < 1 || tile < 1)
+    usage(EXIT_FAILURE);
+
+  printf("isa: %s, tile: %d, %d frames per measurement\n\n",
+         pixel_isa_name(pixel_fill_set_isa(PIXEL_ISA_AUTO)), tile, iterations);
+  printf("%-10s %8s %10s %10s %8s\n", "size", "threads", "ms/frame", "GB/s", "speedup");
+
+  for (s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    size_t bytes = (size_t) width * height * 4;
+    struct shm_region region;
+    double base = 0;
+    int threads;
+
+    if (shm_region_create(&region, bytes, shm_alloc_flags_from_env()) < 0) {
+      fprintf(stderr, "Can't allocate shared memory: %m\n");
+      return 1;
+    }
+
+    for (threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2) {
+      struct thread_pool *pool = thread_pool_create(threads);
+      char size[32];
+      double ms;
+
+      if (!pool) {
+        fprintf(stderr, "Can't create %d threads\n", threads);
+        return 1;
+      }
+
+      ms = paint_ms(pool, region.data, width, height, tile, iterations);
+      if (threads == 1)
+        base = ms;
+
+      snprintf(size, sizeof size, "%dx%d", width, height);
+      printf("%-10s %8d %10.3f %10.2f %7.2fx\n", size, threads, ms,
+             bytes / (ms * 1e6), base / ms);
+
+      thread_pool_destroy(pool);
+      if (threads == max_threads)
+        break;
+    }
+
+    shm_region_destroy(&region);
+    printf("\n");
+  }
+
+  return 0;
+}
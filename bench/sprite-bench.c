@@ -0,0 +1,185 @@
+/*
+ * Quad throughput of the sprite batcher versus one client array draw per quad
+ *
+ * Renders offscreen into an EGL pbuffer, so it needs a GL driver but no
+ * compositor; with Mesa, EGL_PLATFORM=surfaceless runs it without any
+ * display.  Each quad picks one of a few textures at random, the worst
+ * case for batching by texture.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <EGL/egl.h>
+
+#include "sprite-batch.h"
+
+#define SIZE 512
+#define TEXTURES 8
+#define FRAMES 10
+
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int init_egl(void)
+{
+  static const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8,
+    EGL_GREEN_SIZE, 8,
+    EGL_BLUE_SIZE, 8,
+    EGL_NONE
+  };
+  static const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH, SIZE,
+    EGL_HEIGHT, SIZE,
+    EGL_NONE
+  };
+  EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  EGLConfig config;
+  EGLSurface surface;
+  EGLContext context;
+  EGLint n;
+
+  if (!eglInitialize(display, NULL, NULL) ||
+      !eglChooseConfig(display, config_attribs, &config, 1, &n) || n < 1 ||
+      !eglBindAPI(EGL_OPENGL_API))
+    return -1;
+  surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, surface, surface, context))
+    return -1;
+  return 0;
+}
+
+static void create_textures(GLuint *textures)
+{
+  uint32_t pixels[16 * 16];
+  int i, j;
+
+  glGenTextures(TEXTURES, textures);
+  for (i = 0; i < TEXTURES; i++) {
+    for (j = 0; j < 16 * 16; j++)
+      pixels[j] = 0xff000000 | (uint32_t) (i * 0x1f3b57 + j * 0x010101);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 16, 16, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
+}
+
+static void make_sprites(struct sprite *sprites, int n, const GLuint *textures)
+{
+  int i;
+
+  srand(1);
+  for (i = 0; i < n; i++) {
+    float x = rand() / (float) RAND_MAX * 1.9f - 1.0f;
+    float y = rand() / (float) RAND_MAX * 1.9f - 1.0f;
+
+    sprites[i] = (struct sprite) {
+      .texture = textures[rand() % TEXTURES],
+      .x0 = x, .y0 = y, .x1 = x + 0.05f, .y1 = y + 0.05f,
+      .u0 = 0, .v0 = 0, .u1 = 1, .v1 = 1,
+      .color = 0xffffffff,
+    };
+  }
+}
+
+/* The way the samples used to draw: client arrays, one draw per quad. */
+static void draw_immediate(const struct sprite *sprites, int n)
+{
+  int i;
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  for (i = 0; i < n; i++) {
+    const struct sprite *s = &sprites[i];
+    const GLfloat vertex[4][2] = {
+      { s->x0, s->y0 }, { s->x1, s->y0 }, { s->x0, s->y1 }, { s->x1, s->y1 },
+    };
+    const GLfloat texcoord[4][2] = {
+      { s->u0, s->v0 }, { s->u1, s->v0 }, { s->u0, s->v1 }, { s->u1, s->v1 },
+    };
+
+    glBindTexture(GL_TEXTURE_2D, s->texture);
+    glVertexPointer(2, GL_FLOAT, 0, vertex);
+    glTexCoordPointer(2, GL_FLOAT, 0, texcoord);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  }
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+}
+
+static double frame_ms(struct sprite_batch *batch, const struct sprite *sprites, int n,
+                       struct sprite_batch_stats *stats)
+{
+  double start;
+  int frame, i;
+
+  start = now_ms();
+  for (frame = 0; frame < FRAMES; frame++) {
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (batch) {
+      for (i = 0; i < n; i++)
+        sprite_batch_add(batch, &sprites[i]);
+      sprite_batch_flush(batch, stats);
+    } else {
+      draw_immediate(sprites, n);
+    }
+    glFinish();
+  }
+  return (now_ms() - start) / FRAMES;
+}
+
+int main(void)
+{
+  static const int counts[] = { 10000, 25000, 50000, 100000 };
+  GLuint textures[TEXTURES];
+  struct sprite_batch *batch;
+  struct sprite *sprites;
+  size_t i;
+
+  if (init_egl() < 0) {
+    fprintf(stderr, "no EGL pbuffer with desktop GL\n");
+    return 1;
+  }
+  printf("%s\n", (const char *) glGetString(GL_RENDERER));
+
+  batch = sprite_batch_create();
+  sprites = malloc(sizeof(*sprites) * counts[sizeof(counts) / sizeof(counts[0]) - 1]);
+  if (!batch || !sprites)
+    return 1;
+  create_textures(textures);
+  glViewport(0, 0, SIZE, SIZE);
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+  printf("%8s %14s %14s %8s\n", "quads", "per-quad ms", "batched ms", "draws");
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    struct sprite_batch_stats stats;
+    double immediate, batched;
+
+    make_sprites(sprites, counts[i], textures);
+    /* Warm up both paths before timing. */
+    frame_ms(NULL, sprites, counts[i], NULL);
+    frame_ms(batch, sprites, counts[i], &stats);
+
+    immediate = frame_ms(NULL, sprites, counts[i], NULL);
+    batched = frame_ms(batch, sprites, counts[i], &stats);
+    printf("%8d %14.2f %14.2f %8d\n", counts[i], immediate, batched, stats.draws);
+  }
+
+  free(sprites);
+  sprite_batch_destroy(batch);
+  return 0;
+}
@@ -21,6 +21,8 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +30,9 @@
 #include <math.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <linux/input.h>
 
@@ -36,6 +41,7 @@
 #include <wayland-cursor.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
@@ -44,6 +50,14 @@
 #include <unistd.h>
 #include "protocol/ivi-application-client-protocol.h"
 #define IVI_SURFACE_ID 9000
+#include "protocol/presentation-time-client-protocol.h"
+
+#include "shm-swapchain.h"
+#include "thread-pool.h"
+#include "raster.h"
+#include "program-cache.h"
+#include "frame-stats.h"
+#include "frame-pacer.h"
 
 #ifndef EGL_EXT_swap_buffers_with_damage
 #define EGL_EXT_swap_buffers_with_damage 1
@@ -78,6 +92,8 @@ struct display {
 	} egl;
 	struct window *window;
 	struct ivi_application *ivi_application;
+	struct wp_presentation *presentation;
+	clockid_t presentation_clock;
 
 	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 };
@@ -93,9 +109,26 @@ struct window {
 		GLuint rotation_uniform;
 		GLuint pos;
 		GLuint col;
+
+		/* --client-arrays: respecify the triangle from client memory
+		 * every frame instead of drawing it from a static buffer */
+		int client_arrays;
+		GLuint vbo, vao;
 	} gl;
 
-	uint32_t benchmark_time, frames;
+	struct frame_stats *stats;
+	const char *stats_path; /* --stats: where to write them on exit */
+
+	/* wp_presentation feedback for every commit, oldest last */
+	struct wl_list feedback_list;
+	struct timespec render_start; /* of this frame, in the presentation clock */
+	uint32_t commits, discarded;
+	int presentation_log; /* --presentation: print each presented frame */
+
+	/* --pace: start each frame as late as still makes the next vblank */
+	struct frame_pacer *pacer;
+	uint64_t pace_start, pace_target;
+	int pace_planned;
 	struct wl_egl_window *native;
 	struct wl_surface *surface;
 	struct xdg_surface *xdg_surface;
@@ -103,6 +136,28 @@ struct window {
 	EGLSurface egl_surface;
 	struct wl_callback *callback;
 	int fullscreen, opaque, buffer_size, frame_sync;
+
+	/* --software: the triangle is rasterized on the CPU into SHM buffers */
+	int software;
+	struct {
+		struct shm_pool *pool;
+		struct shm_swapchain *swapchain;
+		struct thread_pool *threads;
+		uint32_t format;
+		int full_damage;
+	} sw;
+};
+
+static const GLfloat triangle_verts[3][2] = {
+	{ -0.5, -0.5 },
+	{  0.5, -0.5 },
+	{  0,    0.5 }
+};
+
+static const GLfloat triangle_colors[3][3] = {
+	{ 1, 0, 0 },
+	{ 0, 1, 0 },
+	{ 0, 0, 1 }
 };
 
 static const char *vert_shader_text =
@@ -211,67 +266,112 @@ fini_egl(struct display *display)
 	eglReleaseThread();
 }
 
-static GLuint
-create_shader(struct window *window, const char *source, GLenum shader_type)
+static void
+init_software(struct display *display, struct window *window, int threads)
 {
-	GLuint shader;
-	GLint status;
+	if (!display->shm) {
+		fprintf(stderr, "compositor has no wl_shm\n");
+		exit(EXIT_FAILURE);
+	}
 
-	shader = glCreateShader(shader_type);
-	assert(shader != 0);
+	/* The rasterizer writes 32 bpp pixels only. */
+	if (window->buffer_size == 16)
+		fprintf(stderr, "16 bpp is not supported in software mode, "
+			"using XRGB8888\n");
+	window->sw.format = window->opaque || window->buffer_size == 16 ?
+		WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+
+	window->sw.threads = thread_pool_create(threads);
+	window->sw.pool = shm_pool_create(display->shm,
+					  (size_t) window->geometry.width *
+					  window->geometry.height * 4 *
+					  SHM_SWAPCHAIN_MIN_BUFFERS,
+					  SHM_POOL_MAX_SIZE,
+					  shm_alloc_flags_from_env());
+	if (!window->sw.threads || !window->sw.pool) {
+		fprintf(stderr, "failed to set up software rendering\n");
+		exit(EXIT_FAILURE);
+	}
+	printf("software rendering with %d threads\n",
+	       thread_pool_size(window->sw.threads));
+}
 
-	glShaderSource(shader, 1, (const char **) &source, NULL);
-	glCompileShader(shader);
+static void
+fini_software(struct display *display, struct window *window)
+{
+	shm_pool_destroy(window->sw.pool);
+	thread_pool_destroy(window->sw.threads);
+}
 
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetShaderInfoLog(shader, 1000, &len, log);
-		fprintf(stderr, "Error: compiling %s: %*s\n",
-			shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment",
-			len, log);
-		exit(1);
+/*
+ * Upload the triangle once, interleaved, and record its attribute setup
+ * in a vertex array object where OES_vertex_array_object is supported.
+ * Nothing else draws, so the state is simply left bound and redraw() only
+ * has to update the rotation and draw.
+ */
+static void
+init_geometry(struct window *window)
+{
+	PFNGLGENVERTEXARRAYSOESPROC gen_vertex_arrays = NULL;
+	PFNGLBINDVERTEXARRAYOESPROC bind_vertex_array = NULL;
+	const char *extensions;
+	GLfloat vertices[3][5];
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		memcpy(&vertices[i][0], triangle_verts[i], sizeof(triangle_verts[i]));
+		memcpy(&vertices[i][2], triangle_colors[i], sizeof(triangle_colors[i]));
+	}
+
+	extensions = (const char *) glGetString(GL_EXTENSIONS);
+	if (extensions && strstr(extensions, "GL_OES_vertex_array_object")) {
+		gen_vertex_arrays = (PFNGLGENVERTEXARRAYSOESPROC)
+			eglGetProcAddress("glGenVertexArraysOES");
+		bind_vertex_array = (PFNGLBINDVERTEXARRAYOESPROC)
+			eglGetProcAddress("glBindVertexArrayOES");
+	}
+	if (gen_vertex_arrays && bind_vertex_array) {
+		gen_vertex_arrays(1, &window->gl.vao);
+		bind_vertex_array(window->gl.vao);
 	}
 
-	return shader;
+	glGenBuffers(1, &window->gl.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, window->gl.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE,
+			      sizeof(vertices[0]), (void *) 0);
+	glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE,
+			      sizeof(vertices[0]), (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(window->gl.pos);
+	glEnableVertexAttribArray(window->gl.col);
+
+	printf("drawing from a static vertex buffer%s\n",
+	       window->gl.vao ? " through a vertex array object" : "");
 }
 
 static void
 init_gl(struct window *window)
 {
-	GLuint frag, vert;
+	struct program_attrib attribs[] = {
+		{ "pos", 0 },
+		{ "color", 1 },
+	};
 	GLuint program;
-	GLint status;
-
-	frag = create_shader(window, frag_shader_text, GL_FRAGMENT_SHADER);
-	vert = create_shader(window, vert_shader_text, GL_VERTEX_SHADER);
-
-	program = glCreateProgram();
-	glAttachShader(program, frag);
-	glAttachShader(program, vert);
-	glLinkProgram(program);
-
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetProgramInfoLog(program, 1000, &len, log);
-		fprintf(stderr, "Error: linking:\n%*s\n", len, log);
-		exit(1);
-	}
-
-	glUseProgram(program);
 
 	window->gl.pos = 0;
 	window->gl.col = 1;
 
-	glBindAttribLocation(program, window->gl.pos, "pos");
-	glBindAttribLocation(program, window->gl.col, "color");
-	glLinkProgram(program);
+	program = program_cache_link(vert_shader_text, frag_shader_text,
+				      attribs, 2);
+	if (!program)
+		exit(1);
+	glUseProgram(program);
 
 	window->gl.rotation_uniform =
 		glGetUniformLocation(program, "rotation");
+
+	if (!window->gl.client_arrays)
+		init_geometry(window);
 }
 
 static void
@@ -328,7 +428,8 @@ handle_ivi_surface_configure(void *data, struct ivi_surface *ivi_surface,
 {
 	struct window *window = data;
 
-	wl_egl_window_resize(window->native, width, height, 0, 0);
+	if (window->native)
+		wl_egl_window_resize(window->native, width, height, 0, 0);
 
 	window->geometry.width = width;
 	window->geometry.height = height;
@@ -378,14 +479,16 @@ create_surface(struct window *window)
 
 	window->surface = wl_compositor_create_surface(display->compositor);
 
-	window->native =
-		wl_egl_window_create(window->surface,
-				     window->geometry.width,
-				     window->geometry.height);
-	window->egl_surface =
-        eglCreateWindowSurface(display->egl.dpy, 
-                           display->egl.conf,
-                           window->native, NULL);
+	if (!window->software) {
+		window->native =
+			wl_egl_window_create(window->surface,
+					     window->geometry.width,
+					     window->geometry.height);
+		window->egl_surface =
+	        eglCreateWindowSurface(display->egl.dpy, 
+	                           display->egl.conf,
+	                           window->native, NULL);
+	}
 
 	if (display->shell) {
 		create_xdg_surface(window, display);
@@ -395,12 +498,15 @@ create_surface(struct window *window)
 		assert(0);
 	}
 
-	ret = eglMakeCurrent(window->display->egl.dpy, window->egl_surface,
-			     window->egl_surface, window->display->egl.ctx);
-	assert(ret == EGL_TRUE);
+	if (!window->software) {
+		ret = eglMakeCurrent(window->display->egl.dpy, window->egl_surface,
+				     window->egl_surface, window->display->egl.ctx);
+		assert(ret == EGL_TRUE);
 
-	if (!window->frame_sync)
-		eglSwapInterval(display->egl.dpy, 0);
+		/* --pace throttles with its own frame callbacks. */
+		if (!window->frame_sync || window->pacer)
+			eglSwapInterval(display->egl.dpy, 0);
+	}
 
 	if (!display->shell)
 		return;
@@ -409,16 +515,139 @@ create_surface(struct window *window)
 		xdg_surface_set_fullscreen(window->xdg_surface, NULL);
 }
 
+struct presentation_feedback {
+	struct window *window;
+	struct wp_presentation_feedback *feedback;
+	struct wl_list link;
+	uint32_t commit;
+	struct timespec render_start;
+	uint64_t target; /* the vblank --pace meant it for */
+};
+
+static void
+feedback_done(struct presentation_feedback *pf)
+{
+	wp_presentation_feedback_destroy(pf->feedback);
+	wl_list_remove(&pf->link);
+	free(pf);
+}
+
+static void
+feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+		     struct wl_output *output)
+{
+}
+
+/*
+ * Render-to-present latency goes into the frame statistics; with
+ * --presentation every frame is printed, with how it reached the screen.
+ */
+static void
+feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct presentation_feedback *pf = data;
+	struct window *window = pf->window;
+	uint64_t present, start, latency = 0;
+
+	present = (((uint64_t) tv_sec_hi << 32) + tv_sec_lo) * 1000000000ull +
+		  tv_nsec;
+	start = pf->render_start.tv_sec * 1000000000ull +
+		pf->render_start.tv_nsec;
+	if (present > start)
+		latency = present - start;
+	frame_stats_record(window->stats, FRAME_STAT_PRESENT, latency);
+	if (window->pacer)
+		frame_pacer_presented(window->pacer, pf->target, present,
+				      refresh);
+
+	if (window->presentation_log)
+		printf("commit %u: presented %.3f ms after render start, "
+		       "refresh %.3f ms, msc %llu, flags%s%s%s%s\n",
+		       pf->commit, latency / 1e6, refresh / 1e6,
+		       (unsigned long long) seq_hi << 32 | seq_lo,
+		       flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC ?
+		       " vsync" : "",
+		       flags & WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK ?
+		       " hw_clock" : "",
+		       flags & WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION ?
+		       " hw_completion" : "",
+		       flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY ?
+		       " zero_copy" : "");
+
+	feedback_done(pf);
+}
+
+static void
+feedback_discarded(void *data, struct wp_presentation_feedback *feedback)
+{
+	struct presentation_feedback *pf = data;
+
+	pf->window->discarded++;
+	if (pf->window->presentation_log)
+		printf("commit %u: discarded\n", pf->commit);
+	feedback_done(pf);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+/*
+ * Call before each commit; the feedback belongs to the commit that follows.
+ */
+static void
+request_presentation_feedback(struct window *window)
+{
+	struct display *display = window->display;
+	struct presentation_feedback *pf;
+
+	window->commits++;
+	if (!display->presentation)
+		return;
+
+	pf = calloc(1, sizeof *pf);
+	if (!pf)
+		return;
+	pf->window = window;
+	pf->commit = window->commits;
+	pf->render_start = window->render_start;
+	pf->target = window->pace_target;
+	pf->feedback = wp_presentation_feedback(display->presentation,
+						window->surface);
+	wp_presentation_feedback_add_listener(pf->feedback,
+					      &feedback_listener, pf);
+	wl_list_insert(&window->feedback_list, &pf->link);
+}
+
+static void
+destroy_presentation_feedback(struct window *window)
+{
+	struct presentation_feedback *pf, *next;
+
+	wl_list_for_each_safe(pf, next, &window->feedback_list, link)
+		feedback_done(pf);
+}
+
 static void
 destroy_surface(struct window *window)
 {
-	/* Required, otherwise segfault in egl_dri2.c: dri2_make_current()
-	 * on eglReleaseThread(). */
-	eglMakeCurrent(window->display->egl.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
-		       EGL_NO_CONTEXT);
+	if (window->software) {
+		if (window->sw.swapchain)
+			shm_swapchain_destroy(window->sw.swapchain);
+	} else {
+		/* Required, otherwise segfault in egl_dri2.c: dri2_make_current()
+		 * on eglReleaseThread(). */
+		eglMakeCurrent(window->display->egl.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			       EGL_NO_CONTEXT);
 
-	eglDestroySurface(window->display->egl.dpy, window->egl_surface);
-	wl_egl_window_destroy(window->native);
+		eglDestroySurface(window->display->egl.dpy, window->egl_surface);
+		wl_egl_window_destroy(window->native);
+	}
 
 	if (window->xdg_surface)
 		xdg_surface_destroy(window->xdg_surface);
@@ -428,6 +657,64 @@ destroy_surface(struct window *window)
 
 	if (window->callback)
 		wl_callback_destroy(window->callback);
+
+	destroy_presentation_feedback(window);
+}
+
+/*
+ * The rotation angle of the triangle for this frame.
+ */
+static GLfloat
+frame_angle(struct window *window)
+{
+	static const uint64_t speed_div = 5;
+	struct timespec ts;
+	uint64_t time;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	time = ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+
+	return (time / speed_div) % 360 * M_PI / 180.0;
+}
+
+static void
+update_opaque_region(struct window *window)
+{
+	struct wl_region *region;
+
+	if (window->opaque || window->fullscreen) {
+		region = wl_compositor_create_region(window->display->compositor);
+		wl_region_add(region, 0, 0,
+			      window->geometry.width,
+			      window->geometry.height);
+		wl_surface_set_opaque_region(window->surface, region);
+		wl_region_destroy(region);
+	} else {
+		wl_surface_set_opaque_region(window->surface, NULL);
+	}
+}
+
+static void
+pace_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+
+	assert(window->callback == callback);
+	window->callback = NULL;
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener pace_frame_listener = {
+	pace_frame_done
+};
+
+static uint64_t
+clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
 static void
@@ -435,16 +722,6 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct window *window = data;
 	struct display *display = window->display;
-	static const GLfloat verts[3][2] = {
-		{ -0.5, -0.5 },
-		{  0.5, -0.5 },
-		{  0,    0.5 }
-	};
-	static const GLfloat colors[3][3] = {
-		{ 1, 0, 0 },
-		{ 0, 1, 0 },
-		{ 0, 0, 1 }
-	};
 	GLfloat angle;
 	GLfloat rotation[4][4] = {
 		{ 1, 0, 0, 0 },
@@ -452,11 +729,8 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 		{ 0, 0, 1, 0 },
 		{ 0, 0, 0, 1 }
 	};
-	static const uint32_t speed_div = 5, benchmark_interval = 5;
-	struct wl_region *region;
 	EGLint rect[4];
 	EGLint buffer_age = 0;
-	struct timeval tv;
 
 	assert(window->callback == callback);
 	window->callback = NULL;
@@ -464,20 +738,9 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	if (callback)
 		wl_callback_destroy(callback);
 
-	gettimeofday(&tv, NULL);
-	time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-	if (window->frames == 0)
-		window->benchmark_time = time;
-	if (time - window->benchmark_time > (benchmark_interval * 1000)) {
-		printf("%d frames in %d seconds: %f fps\n",
-		       window->frames,
-		       benchmark_interval,
-		       (float) window->frames / benchmark_interval);
-		window->benchmark_time = time;
-		window->frames = 0;
-	}
-
-	angle = (time / speed_div) % 360 * M_PI / 180.0;
+	frame_stats_begin(window->stats);
+	clock_gettime(display->presentation_clock, &window->render_start);
+	angle = frame_angle(window);
 	rotation[0][0] =  cos(angle);
 	rotation[0][2] =  sin(angle);
 	rotation[2][0] = -sin(angle);
@@ -495,25 +758,29 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	glClearColor(0.0, 0.0, 0.0, 0.5);
 	glClear(GL_COLOR_BUFFER_BIT);
 
-	glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-	glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE, 0, colors);
-	glEnableVertexAttribArray(window->gl.pos);
-	glEnableVertexAttribArray(window->gl.col);
-
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	if (window->gl.client_arrays) {
+		glVertexAttribPointer(window->gl.pos, 2, GL_FLOAT, GL_FALSE, 0, triangle_verts);
+		glVertexAttribPointer(window->gl.col, 3, GL_FLOAT, GL_FALSE, 0, triangle_colors);
+		glEnableVertexAttribArray(window->gl.pos);
+		glEnableVertexAttribArray(window->gl.col);
 
-	glDisableVertexAttribArray(window->gl.pos);
-	glDisableVertexAttribArray(window->gl.col);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
 
-	if (window->opaque || window->fullscreen) {
-		region = wl_compositor_create_region(window->display->compositor);
-		wl_region_add(region, 0, 0,
-			      window->geometry.width,
-			      window->geometry.height);
-		wl_surface_set_opaque_region(window->surface, region);
-		wl_region_destroy(region);
+		glDisableVertexAttribArray(window->gl.pos);
+		glDisableVertexAttribArray(window->gl.col);
 	} else {
-		wl_surface_set_opaque_region(window->surface, NULL);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	update_opaque_region(window);
+
+	frame_stats_swap(window->stats);
+	/* eglSwapBuffers() commits. */
+	request_presentation_feedback(window);
+	if (window->pacer) {
+		window->callback = wl_surface_frame(window->surface);
+		wl_callback_add_listener(window->callback,
+					 &pace_frame_listener, window);
 	}
 
 	if (display->swap_buffers_with_damage && buffer_age > 0) {
@@ -527,7 +794,192 @@ redraw(void *data, struct wl_callback *callback, uint32_t time)
 	} else {
 		eglSwapBuffers(display->egl.dpy, window->egl_surface);
 	}
-	window->frames++;
+	frame_stats_end(window->stats);
+
+	if (window->pacer)
+		frame_pacer_rendered(window->pacer,
+				     window->render_start.tv_sec * 1000000000ull +
+				     window->render_start.tv_nsec,
+				     clock_ns(display->presentation_clock));
+}
+
+/*
+ * Dispatch events until |deadline| in |clock|, or until some arrive when
+ * |deadline| is 0.  Returns -1 if the connection failed.
+ */
+static int
+dispatch_until(struct wl_display *display, clockid_t clock, uint64_t deadline)
+{
+	struct pollfd pfd = { wl_display_get_fd(display), POLLIN, 0 };
+	struct timespec timeout, *ptimeout = NULL;
+	uint64_t now;
+	int ret;
+
+	while (wl_display_prepare_read(display) != 0)
+		if (wl_display_dispatch_pending(display) < 0)
+			return -1;
+	if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+		wl_display_cancel_read(display);
+		return -1;
+	}
+
+	if (deadline) {
+		now = clock_ns(clock);
+		deadline = deadline > now ? deadline - now : 0;
+		timeout.tv_sec = deadline / 1000000000;
+		timeout.tv_nsec = deadline % 1000000000;
+		ptimeout = &timeout;
+	}
+	/* ppoll() for a timeout finer than poll()'s milliseconds. */
+	ret = ppoll(&pfd, 1, ptimeout, NULL);
+	if (ret <= 0) {
+		wl_display_cancel_read(display);
+		return ret < 0 && errno != EINTR ? -1 : 0;
+	}
+	if (wl_display_read_events(display) < 0)
+		return -1;
+	return wl_display_dispatch_pending(display) < 0 ? -1 : 0;
+}
+
+/*
+ * One turn of the --pace main loop.  Once the compositor has taken the
+ * last frame, the next one is planned, and drawn when its start time
+ * comes; until then events are dispatched.
+ */
+static int
+pace_frame(struct window *window)
+{
+	struct display *display = window->display;
+	clockid_t clock = display->presentation_clock;
+	uint64_t now = clock_ns(clock);
+
+	if (!window->callback && !window->pace_planned) {
+		window->pace_start =
+			frame_pacer_next_start(window->pacer, now,
+					       &window->pace_target);
+		window->pace_planned = 1;
+	}
+	if (window->pace_planned && now >= window->pace_start) {
+		window->pace_planned = 0;
+		redraw(window, NULL, 0);
+		return 0;
+	}
+
+	return dispatch_until(display->display, clock,
+			      window->pace_planned ? window->pace_start : 0);
+}
+
+static void
+redraw_software(void *data, struct wl_callback *callback, uint32_t time);
+
+static const struct wl_callback_listener software_frame_listener = {
+	redraw_software
+};
+
+/*
+ * (Re)create the SHM buffers when the window size changed.
+ */
+static void
+resize_software(struct window *window)
+{
+	struct shm_swapchain *chain = window->sw.swapchain;
+
+	if (chain && chain->width == window->geometry.width &&
+	    chain->height == window->geometry.height)
+		return;
+
+	if (chain)
+		shm_swapchain_destroy(chain);
+
+	window->sw.swapchain =
+		shm_swapchain_create(window->sw.pool,
+				     window->geometry.width,
+				     window->geometry.height,
+				     window->sw.format,
+				     SHM_SWAPCHAIN_MIN_BUFFERS);
+	if (!window->sw.swapchain) {
+		fprintf(stderr, "failed to create SHM buffers\n");
+		exit(EXIT_FAILURE);
+	}
+	window->sw.full_damage = 1;
+}
+
+/*
+ * The software equivalent of redraw(): the same triangle, rotated the same
+ * way, rasterized in bands by the thread pool into a SHM buffer.
+ */
+static void
+redraw_software(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+	struct display *display = window->display;
+	struct shm_buffer *buffer;
+	struct raster_job job;
+	float angle, c;
+	int i, width, height;
+
+	assert(window->callback == callback);
+	window->callback = NULL;
+
+	if (callback)
+		wl_callback_destroy(callback);
+
+	frame_stats_begin(window->stats);
+	clock_gettime(display->presentation_clock, &window->render_start);
+	angle = frame_angle(window);
+	c = cos(angle);
+
+	resize_software(window);
+	width = window->geometry.width;
+	height = window->geometry.height;
+
+	buffer = shm_swapchain_acquire(window->sw.swapchain, display->display,
+				       SHM_ACQUIRE_GROW);
+	if (!buffer) {
+		running = 0;
+		return;
+	}
+
+	job.data = buffer->data;
+	job.width = width;
+	job.height = height;
+	job.stride = window->sw.swapchain->stride;
+	job.format = window->sw.format == WL_SHM_FORMAT_XRGB8888 ?
+		PIXEL_FORMAT_XRGB8888 : PIXEL_FORMAT_ARGB8888;
+	job.clear = 0x80000000; /* glClearColor(0.0, 0.0, 0.0, 0.5) */
+	for (i = 0; i < 3; i++) {
+		/* rotation * pos, then the viewport transform */
+		job.v[i].x = (c * triangle_verts[i][0] + 1) * width / 2;
+		job.v[i].y = (1 - triangle_verts[i][1]) * height / 2;
+		job.v[i].r = triangle_colors[i][0];
+		job.v[i].g = triangle_colors[i][1];
+		job.v[i].b = triangle_colors[i][2];
+		job.v[i].a = 1;
+	}
+	thread_pool_run(window->sw.threads, raster_triangle_band, &job,
+			thread_pool_size(window->sw.threads));
+
+	update_opaque_region(window);
+
+	frame_stats_swap(window->stats);
+	shm_swapchain_attach(window->sw.swapchain, buffer, window->surface);
+	/* Every buffer is fully redrawn, but only the middle changes. */
+	if (window->sw.full_damage)
+		wl_surface_damage(window->surface, 0, 0, width, height);
+	else
+		wl_surface_damage(window->surface, width / 4 - 1, height / 4 - 1,
+				  width / 2 + 2, height / 2 + 2);
+	window->sw.full_damage = 0;
+
+	if (window->frame_sync) {
+		window->callback = wl_surface_frame(window->surface);
+		wl_callback_add_listener(window->callback,
+					 &software_frame_listener, window);
+	}
+	request_presentation_feedback(window);
+	wl_surface_commit(window->surface);
+	wl_display_flush(display->display);
+	frame_stats_end(window->stats);
 }
 
 static void
@@ -748,6 +1200,19 @@ static_assert(XDG_VERSION == XDG_SHELL_VERSION_CURRENT,
 	      "Interface version doesn't match implementation version");
 #endif
 
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *d = data;
+
+	d->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
 		       uint32_t name, const char *interface, uint32_t version)
@@ -785,6 +1250,12 @@ registry_handle_global(void *data, struct wl_registry *registry,
 		d->ivi_application =
 			wl_registry_bind(registry, name,
 					 &ivi_application_interface, 1);
+	} else if (strcmp(interface, "wp_presentation") == 0) {
+		d->presentation =
+			wl_registry_bind(registry, name,
+					 &wp_presentation_interface, 1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
 	}
 }
 
@@ -813,6 +1284,13 @@ usage(int error_code)
 		"  -o\tCreate an opaque surface\n"
 		"  -s\tUse a 16 bpp EGL config\n"
 		"  -b\tDon't sync to compositor redraw (eglSwapInterval 0)\n"
+		"  --software\tRasterize on the CPU into SHM buffers instead of GLES2\n"
+		"  --client-arrays\tRespecify the vertices from client memory every frame\n"
+		"  --threads N\tRasterize with N threads (0: one per CPU, the default)\n"
+		"  --stats FILE\tWrite frame time percentiles as JSON, or CSV for *.csv\n"
+		"  --presentation\tPrint when each frame reached the screen (wp_presentation)\n"
+		"  --pace\tStart each frame just in time for the predicted vblank\n"
+		"\t\t(not with --software)\n"
 		"  -h\tThis help text\n\n");
 
 	exit(error_code);
@@ -824,7 +1302,7 @@ main(int argc, char **argv)
 	struct sigaction sigint;
 	struct display display = { 0 };
 	struct window  window  = { 0 };
-	int i, ret = 0;
+	int i, ret = 0, threads = 0;
 
 	window.display = &display;
 	display.window = &window;
@@ -833,6 +1311,9 @@ main(int argc, char **argv)
 	window.window_size = window.geometry;
 	window.buffer_size = 32;
 	window.frame_sync = 1;
+	wl_list_init(&window.feedback_list);
+	/* Until the compositor says otherwise. */
+	display.presentation_clock = CLOCK_MONOTONIC;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
@@ -843,12 +1324,30 @@ main(int argc, char **argv)
 			window.buffer_size = 16;
 		else if (strcmp("-b", argv[i]) == 0)
 			window.frame_sync = 0;
+		else if (strcmp("--software", argv[i]) == 0)
+			window.software = 1;
+		else if (strcmp("--client-arrays", argv[i]) == 0)
+			window.gl.client_arrays = 1;
+		else if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (strcmp("--stats", argv[i]) == 0 && i + 1 < argc)
+			window.stats_path = argv[++i];
+		else if (strcmp("--presentation", argv[i]) == 0)
+			window.presentation_log = 1;
+		else if (strcmp("--pace", argv[i]) == 0)
+			window.pacer = frame_pacer_create();
 		else if (strcmp("-h", argv[i]) == 0)
 			usage(EXIT_SUCCESS);
 		else
 			usage(EXIT_FAILURE);
 	}
 
+	if (window.software && window.pacer) {
+		fprintf(stderr, "--pace only paces GLES2 rendering, "
+			"not --software\n");
+		usage(EXIT_FAILURE);
+	}
+
 	display.display = wl_display_connect(NULL);
 	assert(display.display);
 
@@ -857,12 +1356,20 @@ main(int argc, char **argv)
 				 &registry_listener, &display);
 
 	wl_display_dispatch(display.display);
-        printf("start init egl \n");
-	init_egl(&display, &window);
-        
-        printf("start init egl 2 \n");
-	create_surface(&window);
-	init_gl(&window);
+	if (window.software) {
+		init_software(&display, &window, threads);
+		create_surface(&window);
+	} else {
+	        printf("start init egl \n");
+		init_egl(&display, &window);
+	        
+	        printf("start init egl 2 \n");
+		create_surface(&window);
+		init_gl(&window);
+	}
+	/* After init_gl(), so GPU timer queries can be set up. */
+	window.stats = frame_stats_create(!window.software);
+	assert(window.stats);
 
 	display.cursor_surface =
 		wl_compositor_create_surface(display.compositor);
@@ -877,14 +1384,50 @@ main(int argc, char **argv)
 	 * wl_display_dispatch_pending() to handle any events that got
 	 * queued up as a side effect. */
 	while (running && ret != -1) {
+		if (window.software) {
+			/* Paced by frame callbacks unless -b was given. */
+			if (window.frame_sync) {
+				if (!window.callback)
+					redraw_software(&window, NULL, 0);
+				ret = wl_display_dispatch(display.display);
+			} else {
+				wl_display_dispatch_pending(display.display);
+				redraw_software(&window, NULL, 0);
+			}
+			continue;
+		}
+		if (window.pacer) {
+			ret = pace_frame(&window);
+			continue;
+		}
 		wl_display_dispatch_pending(display.display);
 		redraw(&window, NULL, 0);
 	}
 
 	fprintf(stderr, "simple-egl exiting\n");
 
+	frame_stats_print(window.stats, stdout);
+	if (display.presentation)
+		printf("%u of %u commits discarded\n",
+		       window.discarded, window.commits);
+	else
+		printf("no wp_presentation, display latency not measured\n");
+	if (window.pacer) {
+		printf("paced: %u frames missed their vblank, budget %.2f ms\n",
+		       frame_pacer_misses(window.pacer),
+		       frame_pacer_budget(window.pacer) / 1e6);
+		frame_pacer_destroy(window.pacer);
+	}
+	if (window.stats_path &&
+	    frame_stats_write(window.stats, window.stats_path) < 0)
+		fprintf(stderr, "failed to write %s\n", window.stats_path);
+	frame_stats_destroy(window.stats);
+
 	destroy_surface(&window);
-	fini_egl(&display);
+	if (window.software)
+		fini_software(&display, &window);
+	else
+		fini_egl(&display);
 
 	wl_surface_destroy(display.cursor_surface);
 	if (display.cursor_theme)
@@ -896,6 +1439,9 @@ main(int argc, char **argv)
 	if (display.ivi_application)
 		ivi_application_destroy(display.ivi_application);
 
+	if (display.presentation)
+		wp_presentation_destroy(display.presentation);
+
 	if (display.compositor)
 		wl_compositor_destroy(display.compositor);
 
@@ -7,11 +7,19 @@
 #include <GL/gl.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "display-wait.h"
+#include "frame-import.h"
+#include "sprite-batch.h"
 
 #define WIDTH 256
 #define HEIGHT 256
 GLubyte image[64][64][4];
 static int running = 1;
+/* Frames are only drawn when this is set, or always with --continuous. */
+static int needs_redraw = 1;
 
 struct display {
   struct wl_display *display;
@@ -69,6 +77,7 @@ static void shell_surface_configure (void *data, struct wl_shell_surface *shell_
   struct window *window = (struct window *)data;
   printf("%d\n", __LINE__);
   wl_egl_window_resize (window->egl_window, WIDTH, HEIGHT, 0, 0);
+  needs_redraw = 1;
   printf("%d\n", __LINE__);
 }
 
@@ -93,12 +102,18 @@ public:
   void CreateTexture();
   void CreateSurface();
   void ReDraw();
-  void Render(unsigned int fd);
+  void Render(int fd, const struct frame_desc &desc);
+  int Dispatch(bool block);
   void HandleSignal();
 private:
+  void Draw(GLuint texture, bool top_down);
+
   struct sigaction sigint;
   struct display *display = NULL;
   struct window *window = NULL;
+  struct sprite_batch *batch = NULL;
+  struct frame_importer *importer = NULL;
+  GLuint texture = 0;
 };
 
 CrVideoTunnelAction::CrVideoTunnelAction() {
@@ -116,6 +131,8 @@ void CrVideoTunnelAction::HandleSignal() {
 }
 
 void CrVideoTunnelAction::Final() {
+  frame_importer_destroy(importer);
+  sprite_batch_destroy(batch);
   eglDestroySurface (display->egl_display, window->egl_surface);
   wl_egl_window_destroy (window->egl_window);
   wl_shell_surface_destroy (window->shell_surface);
@@ -188,7 +205,6 @@ void CrVideoTunnelAction::CreateSurface() {
 }
 
 void CrVideoTunnelAction::CreateTexture() {
-  GLuint texture;
   int i, j;
 
   glEnable(GL_TEXTURE_2D);
@@ -210,42 +226,88 @@ void CrVideoTunnelAction::CreateTexture() {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+  batch = sprite_batch_create();
+  assert(batch);
+  importer = frame_importer_create(display->egl_display);
+  assert(importer);
 }
 
-void CrVideoTunnelAction::ReDraw() {
+/* Video frames store their top row first, so they are drawn flipped. */
+void CrVideoTunnelAction::Draw(GLuint texture, bool top_down) {
   glViewport(0, 0, WIDTH, HEIGHT);
 
   glClearColor (0.5, 0.5, 0.5, 0.5);
   glClear (GL_COLOR_BUFFER_BIT);
 
-  static const GLfloat texcoord[4][2] = {
-    { 0, 0 },
-    { 1, 0 },
-    { 0, 1 },
-    { 1, 1 }
-  };
-  static const GLfloat vertex[4][2] = {
-    { -0.5, -0.5 },
-    {  0.5, -0.5 },
-    { -0.5,  0.5 },
-    {  0.5,  0.5 }
+  struct sprite quad = {
+    texture,
+    -0.5f, -0.5f, 0.5f, 0.5f,
+    0, top_down ? 1.0f : 0.0f, 1, top_down ? 0.0f : 1.0f,
+    0xffffffff,
   };
 
-  glVertexPointer(2, GL_FLOAT, 0, vertex);
-  glTexCoordPointer(2, GL_FLOAT, 0, texcoord);
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  sprite_batch_add(batch, &quad);
+  sprite_batch_flush(batch, NULL);
+
+  eglSwapBuffers (display->egl_display, window->egl_surface);
+}
+
+void CrVideoTunnelAction::ReDraw() {
+  Draw(texture, false);
+}
 
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+/* Present the frame in |fd|; the fd stays the caller's. */
+void CrVideoTunnelAction::Render(int fd, const struct frame_desc &desc) {
+  GLuint frame = frame_importer_import(importer, fd, &desc);
 
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  if (frame)
+    Draw(frame, true);
+}
 
-  eglSwapBuffers (display->egl_display, window->egl_surface);
+/* Dispatch queued events, first waiting for some if |block|; -1 once the connection is gone. */
+int CrVideoTunnelAction::Dispatch(bool block) {
+  if (block)
+    return display_wait(display->display, -1);
+  return wl_display_dispatch_pending(display->display) < 0 ? -1 : 0;
 }
 
-int main() {
+/* egl-test [--continuous] [FILE FOURCC WIDTHxHEIGHT [STRIDE]] shows a raw frame, e.g. NV12 or AR24. */
+static int parse_frame(int argc, char **argv, struct frame_desc *desc) {
+  const char *f = argv[2];
+
+  if (argc < 4 || strlen(f) != 4 ||
+      sscanf(argv[3], "%dx%d", &desc->width, &desc->height) != 2)
+    return -1;
+  desc->format = FRAME_FOURCC(f[0], f[1], f[2], f[3]);
+  desc->offset = 0;
+  desc->stride = argc > 4 ? atoi(argv[4]) :
+                 desc->width * (desc->format == FRAME_FORMAT_RGB565 ? 2 :
+                                desc->format == FRAME_FORMAT_NV12 ||
+                                desc->format == FRAME_FORMAT_YUV420 ? 1 : 4);
+  return 0;
+}
+
+int main(int argc, char **argv) {
   CrVideoTunnelAction *tunnel_action = new CrVideoTunnelAction();
+  const char *prog = argv[0];
+  struct frame_desc desc;
+  bool continuous = false;
+  int fd = -1;
+
+  /* Redraw every frame, for benchmarks, instead of only on change. */
+  if (argc > 1 && strcmp(argv[1], "--continuous") == 0) {
+    continuous = true;
+    argc--;
+    argv++;
+  }
+  if (argc > 1) {
+    fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || parse_frame(argc, argv, &desc) < 0) {
+      fprintf(stderr, "usage: %s [--continuous] [FILE FOURCC WIDTHxHEIGHT [STRIDE]]\n", prog);
+      return 1;
+    }
+  }
 
   tunnel_action->Init();
   tunnel_action->CreateSurface();
@@ -253,10 +315,21 @@ int main() {
   tunnel_action->HandleSignal();
 
   while(running) {
-    tunnel_action->ReDraw();
+    if (tunnel_action->Dispatch(!continuous && !needs_redraw) < 0)
+      break;
+    if (!continuous && !needs_redraw)
+      continue;
+    needs_redraw = 0;
+
+    if (fd >= 0)
+      tunnel_action->Render(fd, desc);
+    else
+      tunnel_action->ReDraw();
   }
 
   tunnel_action->Final();
   delete tunnel_action;
+  if (fd >= 0)
+    close(fd);
 
 }
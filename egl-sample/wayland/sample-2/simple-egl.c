@@ -6,6 +6,9 @@
 #include <string.h>
 #include <signal.h>
 
+#include "display-wait.h"
+#include "sprite-batch.h"
+
 #define WIDTH 256
 #define HEIGHT 256
 GLubyte image[64][64][4];
@@ -14,7 +17,11 @@ static struct wl_display *display;
 static struct wl_compositor *compositor = NULL;
 static struct wl_shell *shell = NULL;
 static EGLDisplay egl_display;
+static struct sprite_batch *batch;
+static GLuint texture;
 static char running = 1;
+/* The scene is static, so a frame is only drawn when this is set. */
+static int needs_redraw = 1;
 
 struct window {
   EGLContext egl_context;
@@ -54,6 +61,7 @@ static void shell_surface_configure (void *data, struct wl_shell_surface *shell_
                                    uint32_t edges, int32_t width, int32_t height) {
   struct window *window = data;
   wl_egl_window_resize (window->egl_window, width, height, 0, 0);
+  needs_redraw = 1;
 }
 
 static void shell_surface_popup_done (void *data, struct wl_shell_surface *shell_surface) {
@@ -98,7 +106,6 @@ static void delete_window (struct window *window) {
 }
 
 static void create_texture() {
-  GLuint texture;
   int i, j;
 
   glEnable(GL_TEXTURE_2D);
@@ -128,28 +135,15 @@ static void draw_window (struct window *window) {
   glClearColor (0.5, 0.5, 0.5, 0.5);
   glClear (GL_COLOR_BUFFER_BIT);
 
-  static const GLfloat texcoord[4][2] = {
-    { 0, 0 },
-    { 1, 0 },
-    { 0, 1 },
-    { 1, 1 }
-  };
-  static const GLfloat vertex[4][2] = {
-    { -0.5, -0.5 },
-    {  0.5, -0.5 },
-    { -0.5,  0.5 },
-    {  0.5,  0.5 }
+  struct sprite quad = {
+    .texture = texture,
+    .x0 = -0.5, .y0 = -0.5, .x1 = 0.5, .y1 = 0.5,
+    .u0 = 0, .v0 = 0, .u1 = 1, .v1 = 1,
+    .color = 0xffffffff,
   };
 
-  glVertexPointer(2, GL_FLOAT, 0, vertex);
-  glTexCoordPointer(2, GL_FLOAT, 0, texcoord);
-  glEnableClientState(GL_VERTEX_ARRAY);
-  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-  glDisableClientState(GL_VERTEX_ARRAY);
-  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  sprite_batch_add(batch, &quad);
+  sprite_batch_flush(batch, NULL);
 
   eglSwapBuffers (egl_display, window->egl_surface);
 }
@@ -159,9 +153,18 @@ static void signal_int(int signum)
   running = 0;
 }
 
-int main () {
+int main (int argc, char **argv) {
   struct sigaction sigint;
   EGLint major, minor;
+  int continuous = 0;
+
+  if (argc > 1 && strcmp(argv[1], "--continuous") == 0)
+    continuous = 1;
+  else if (argc > 1) {
+    fprintf(stderr, "usage: %s [--continuous]\n"
+            "  --continuous\tRedraw every frame, for benchmarks, instead of on change\n", argv[0]);
+    return 1;
+  }
 
   display = wl_display_connect (NULL);
   struct wl_registry *registry = wl_display_get_registry (display);
@@ -179,12 +182,23 @@ int main () {
   sigint.sa_flags = SA_RESETHAND;
   sigaction(SIGINT, &sigint, NULL);
   create_texture();
+  batch = sprite_batch_create();
+  if (!batch)
+    return 1;
 
   while (running) {
-    wl_display_dispatch_pending (display);
-    draw_window (&window);
+    if (continuous) {
+      wl_display_dispatch_pending (display);
+      needs_redraw = 1;
+    } else if (!needs_redraw && display_wait (display, -1) < 0)
+      break;
+    if (needs_redraw) {
+      draw_window (&window);
+      needs_redraw = 0;
+    }
   }
 
+  sprite_batch_destroy(batch);
   delete_window (&window);
   eglTerminate (egl_display);
   wl_display_disconnect (display);
@@ -21,6 +21,8 @@
 #include <GLES/glext.h>
 #include <EGL/egl.h>
 
+#include "mipmap.h"
+
 
 static int TexWidth = 256, TexHeight = 256;
 
@@ -256,6 +258,32 @@ draw(EGLDisplay egl_dpy, EGLSurface egl_surf, EGLSurface egl_pbuf,
 
 
 
+/*
+ * Upload a tightly packed RGBA image with its full mip chain, filtered in
+ * linear light.  Falls back to the base level alone if out of memory.
+ */
+static GLenum
+tex_image_mipmapped(int width, int height, const void *pixels)
+{
+   struct mip_chain chain;
+   int level;
+
+   if (mip_chain_build(&chain, pixels, width, height,
+                       MIP_FILTER_BOX, MIP_SRGB, NULL) < 0) {
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+      return GL_LINEAR;
+   }
+
+   for (level = 0; level < chain.levels; level++)
+      glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA,
+                   chain.level[level].width, chain.level[level].height, 0,
+                   GL_RGBA, GL_UNSIGNED_BYTE, chain.level[level].data);
+   mip_chain_release(&chain);
+   return GL_LINEAR_MIPMAP_LINEAR;
+}
+
+
 static void
 make_dot_texture(void)
 {
@@ -285,9 +313,8 @@ make_dot_texture(void)
 
    glGenTextures(1, &DotTexture);
    glBindTexture(GL_TEXTURE_2D, DotTexture);
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SZ, SZ, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, image);
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Filter);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                   tex_image_mipmapped(SZ, SZ, image));
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Filter);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -322,15 +349,14 @@ make_render_texture(void)
 
    makeCheckImage();
 
-   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, checkImageWidth, checkImageHeight, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, checkImage);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                   tex_image_mipmapped(checkImageWidth, checkImageHeight, checkImage));
 
 /*
    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TexWidth, TexHeight, 0,
                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 */
 
-   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Filter);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Filter);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -0,0 +1,351 @@
+/*
+ * Texture atlas builder
+ */
+
+#define _GNU_SOURCE
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SOIL/SOIL.h>
+
+#include "atlas.h"
+
+struct image {
+  const char *path;
+  unsigned char *pixels; /* RGBA, NULL if it failed to decode */
+  int width, height;
+  int page, x, y;        /* placement of the unpadded image, page -1 if none */
+};
+
+/*
+ * The top edge of the filled part of a page, as runs of equal height.
+ * Nodes are at least 1 pixel wide, so width + 1 of them always suffice.
+ */
+struct skyline_node {
+  int x, y, width;
+};
+
+struct skyline {
+  int width, height;
+  int n;
+  struct skyline_node *nodes;
+  int used_height;
+};
+
+struct build {
+  struct image *images;
+  int page_size, padding;
+  uint8_t **page_pixels;
+};
+
+/* Lowest y an image of |w| x |h| can sit at with its left edge at node |i|. */
+static int skyline_fit(const struct skyline *sk, int i, int w, int h)
+{
+  int y = 0, left = w;
+
+  if (sk->nodes[i].x + w > sk->width)
+    return -1;
+
+  for (; left > 0; i++) {
+    if (sk->nodes[i].y > y)
+      y = sk->nodes[i].y;
+    left -= sk->nodes[i].width;
+  }
+
+  return y + h <= sk->height ? y : -1;
+}
+
+static void skyline_remove(struct skyline *sk, int i)
+{
+  memmove(&sk->nodes[i], &sk->nodes[i + 1], (sk->n - i - 1) * sizeof sk->nodes[0]);
+  sk->n--;
+}
+
+/* Place |w| x |h| where its top ends lowest, ties to the narrowest node. */
+static int skyline_insert(struct skyline *sk, int w, int h, int *x, int *y)
+{
+  int best = -1, best_bottom = INT_MAX, best_width = INT_MAX, i;
+
+  for (i = 0; i < sk->n; i++) {
+    int fy = skyline_fit(sk, i, w, h);
+
+    if (fy >= 0 && (fy + h < best_bottom ||
+                    (fy + h == best_bottom && sk->nodes[i].width < best_width))) {
+      best = i;
+      best_bottom = fy + h;
+      best_width = sk->nodes[i].width;
+    }
+  }
+  if (best < 0)
+    return -1;
+
+  *x = sk->nodes[best].x;
+  *y = best_bottom - h;
+
+  memmove(&sk->nodes[best + 1], &sk->nodes[best], (sk->n - best) * sizeof sk->nodes[0]);
+  sk->n++;
+  sk->nodes[best] = (struct skyline_node) { *x, best_bottom, w };
+
+  /* Cut the nodes the new one now covers. */
+  for (i = best + 1; i < sk->n;) {
+    int end = *x + w, covered = end - sk->nodes[i].x;
+
+    if (covered <= 0)
+      break;
+    if (sk->nodes[i].width > covered) {
+      sk->nodes[i].x += covered;
+      sk->nodes[i].width -= covered;
+      break;
+    }
+    skyline_remove(sk, i);
+  }
+
+  for (i = 0; i + 1 < sk->n;) {
+    if (sk->nodes[i].y == sk->nodes[i + 1].y) {
+      sk->nodes[i].width += sk->nodes[i + 1].width;
+      skyline_remove(sk, i + 1);
+    } else {
+      i++;
+    }
+  }
+
+  if (best_bottom > sk->used_height)
+    sk->used_height = best_bottom;
+  return 0;
+}
+
+static int skyline_init(struct skyline *sk, int size)
+{
+  sk->width = sk->height = size;
+  sk->nodes = malloc((size + 1) * sizeof sk->nodes[0]);
+  if (!sk->nodes)
+    return -1;
+  sk->nodes[0] = (struct skyline_node) { 0, 0, size };
+  sk->n = 1;
+  sk->used_height = 0;
+  return 0;
+}
+
+/*
+ * Runs on several workers at once.  SOIL and its stb_image keep no state
+ * across a decode other than the last error, a static string pointer each
+ * call overwrites with a pointer to a string literal.  Those races are
+ * benign as long as nobody reads the pointer, which is why failures are
+ * reported without SOIL_last_result().
+ */
+static void decode_job(void *data, int index, int count)
+{
+  struct image *image = &((struct build *) data)->images[index];
+
+  (void) count;
+  image->pixels = SOIL_load_image(image->path, &image->width, &image->height, 0,
+                                  SOIL_LOAD_RGBA);
+}
+
+/* Copy an image into its page, replicating its edges into the padding. */
+static void blit_job(void *data, int index, int count)
+{
+  struct build *b = data;
+  struct image *image = &b->images[index];
+  size_t stride = (size_t) b->page_size * 4, row = (size_t) image->width * 4;
+  int p = b->padding, x, y;
+
+  (void) count;
+  if (image->page < 0)
+    return;
+
+  for (y = -p; y < image->height + p; y++) {
+    int sy = y < 0 ? 0 : y >= image->height ? image->height - 1 : y;
+    const uint8_t *src = image->pixels + sy * row;
+    uint8_t *dst = b->page_pixels[image->page] + (image->y + y) * stride + image->x * 4;
+
+    memcpy(dst, src, row);
+    for (x = 1; x <= p; x++) {
+      memcpy(dst - x * 4, src, 4);
+      memcpy(dst + row + (x - 1) * 4, src + row - 4, 4);
+    }
+  }
+}
+
+static int by_height(const void *a, const void *b)
+{
+  const struct image *ia = *(struct image *const *) a, *ib = *(struct image *const *) b;
+
+  if (ia->height != ib->height)
+    return ib->height - ia->height;
+  return ib->width - ia->width;
+}
+
+static int by_name(const void *a, const void *b)
+{
+  return strcmp(((const struct atlas_entry *) a)->name, ((const struct atlas_entry *) b)->name);
+}
+
+struct atlas *atlas_build(struct thread_pool *pool, const char *const *paths, int count,
+                          int page_size, int padding)
+{
+  struct build b = { .page_size = page_size, .padding = padding };
+  struct image **order = NULL;
+  struct skyline *pages = NULL;
+  struct atlas *atlas = NULL;
+  int n_pages = 0, n_order = 0, i;
+
+  b.images = calloc(count, sizeof *b.images);
+  order = calloc(count, sizeof *order);
+  if (!b.images || !order)
+    goto out;
+
+  for (i = 0; i < count; i++) {
+    b.images[i].path = paths[i];
+    b.images[i].page = -1;
+  }
+  thread_pool_run(pool, decode_job, &b, count);
+
+  for (i = 0; i < count; i++) {
+    if (!b.images[i].pixels)
+      fprintf(stderr, "Can't load %s\n", paths[i]);
+    else if (b.images[i].width + 2 * padding > page_size ||
+             b.images[i].height + 2 * padding > page_size)
+      fprintf(stderr, "%s doesn't fit a %dx%d atlas page\n", paths[i], page_size, page_size);
+    else
+      order[n_order++] = &b.images[i];
+  }
+  if (n_order == 0)
+    goto out;
+
+  /* Tallest first keeps the skyline flat. */
+  qsort(order, n_order, sizeof *order, by_height);
+
+  for (i = 0; i < n_order; i++) {
+    struct image *image = order[i];
+    int w = image->width + 2 * padding, h = image->height + 2 * padding, page, x, y;
+
+    for (page = 0; page < n_pages; page++)
+      if (skyline_insert(&pages[page], w, h, &x, &y) == 0)
+        break;
+
+    if (page == n_pages) {
+      struct skyline *grown = realloc(pages, (n_pages + 1) * sizeof *pages);
+
+      if (!grown)
+        goto out;
+      pages = grown;
+      if (skyline_init(&pages[n_pages], page_size) < 0)
+        goto out;
+      n_pages++;
+      skyline_insert(&pages[page], w, h, &x, &y);
+    }
+
+    image->page = page;
+    image->x = x + padding;
+    image->y = y + padding;
+  }
+
+  atlas = calloc(1, sizeof *atlas);
+  b.page_pixels = calloc(n_pages, sizeof *b.page_pixels);
+  if (!atlas || !b.page_pixels)
+    goto fail;
+
+  atlas->n_pages = n_pages;
+  atlas->pages = calloc(n_pages, sizeof *atlas->pages);
+  atlas->page_heights = calloc(n_pages, sizeof *atlas->page_heights);
+  atlas->entries = calloc(n_order, sizeof *atlas->entries);
+  if (!atlas->pages || !atlas->page_heights || !atlas->entries)
+    goto fail;
+
+  for (i = 0; i < n_pages; i++) {
+    atlas->page_heights[i] = pages[i].used_height;
+    b.page_pixels[i] = calloc((size_t) page_size * pages[i].used_height, 4);
+    if (!b.page_pixels[i])
+      goto fail;
+  }
+  thread_pool_run(pool, blit_job, &b, count);
+
+  glGenTextures(n_pages, atlas->pages);
+  for (i = 0; i < n_pages; i++) {
+    glBindTexture(GL_TEXTURE_2D, atlas->pages[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, page_size, atlas->page_heights[i], 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, b.page_pixels[i]);
+  }
+
+  for (i = 0; i < n_order; i++) {
+    const struct image *image = order[i];
+    struct atlas_entry *entry = &atlas->entries[atlas->n_entries++];
+    float page_height = atlas->page_heights[image->page];
+
+    entry->name = strdup(image->path);
+    if (!entry->name) {
+      atlas_destroy(atlas);
+      atlas = NULL;
+      goto out;
+    }
+    entry->rect = (struct atlas_rect) {
+      .page = image->page,
+      .texture = atlas->pages[image->page],
+      .x = image->x,
+      .y = image->y,
+      .width = image->width,
+      .height = image->height,
+      .u0 = (float) image->x / page_size,
+      .v0 = image->y / page_height,
+      .u1 = (float) (image->x + image->width) / page_size,
+      .v1 = (image->y + image->height) / page_height,
+    };
+  }
+  qsort(atlas->entries, atlas->n_entries, sizeof *atlas->entries, by_name);
+  goto out;
+
+fail:
+  if (atlas) {
+    free(atlas->pages);
+    free(atlas->page_heights);
+    free(atlas->entries);
+    free(atlas);
+    atlas = NULL;
+  }
+
+out:
+  if (b.page_pixels)
+    for (i = 0; i < n_pages; i++)
+      free(b.page_pixels[i]);
+  free(b.page_pixels);
+  for (i = 0; i < n_pages; i++)
+    free(pages[i].nodes);
+  free(pages);
+  free(order);
+  if (b.images)
+    for (i = 0; i < count; i++)
+      if (b.images[i].pixels)
+        SOIL_free_image_data(b.images[i].pixels);
+  free(b.images);
+
+  return atlas;
+}
+
+void atlas_destroy(struct atlas *atlas)
+{
+  int i;
+
+  for (i = 0; i < atlas->n_entries; i++)
+    free((char *) atlas->entries[i].name);
+  glDeleteTextures(atlas->n_pages, atlas->pages);
+  free(atlas->pages);
+  free(atlas->page_heights);
+  free(atlas->entries);
+  free(atlas);
+}
+
+const struct atlas_rect *atlas_lookup(const struct atlas *atlas, const char *name)
+{
+  struct atlas_entry key = { .name = name }, *entry;
+
+  entry = bsearch(&key, atlas->entries, atlas->n_entries, sizeof key, by_name);
+  return entry ? &entry->rect : NULL;
+}
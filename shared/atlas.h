@@ -0,0 +1,54 @@
+/*
+ * Texture atlases: many small images packed into a few GL textures.
+ *
+ * Images are decoded in parallel on a thread_pool, packed with a skyline
+ * packer (bottom-left, tallest first) into pages of at most page_size
+ * pixels square, and uploaded once per page.  Each image is surrounded by
+ * |padding| pixels of its own replicated edge, so linear filtering at its
+ * border never samples a neighbour.  Drawing any number of images from one
+ * page then takes one bind and can share one draw call.
+ *
+ * Build and destroy with the GL context current.
+ */
+
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <GLES2/gl2.h>
+
+#include "thread-pool.h"
+
+struct atlas_rect {
+  int page;
+  GLuint texture;            /* the page's texture */
+  int x, y, width, height;   /* in page pixels, padding excluded */
+  float u0, v0, u1, v1;      /* the same rectangle in texture coordinates */
+};
+
+struct atlas_entry {
+  const char *name;
+  struct atlas_rect rect;
+};
+
+struct atlas {
+  int n_pages;
+  GLuint *pages;
+  int *page_heights;         /* pages are page_size wide, trimmed to their content */
+
+  int n_entries;
+  struct atlas_entry *entries; /* sorted by name */
+};
+
+/*
+ * Decode |paths| and pack them.  Entries are named by their path.  Images
+ * that fail to decode or can't fit a page are reported on stderr and left
+ * out.  Returns NULL if nothing could be packed.
+ */
+struct atlas *atlas_build(struct thread_pool *pool, const char *const *paths, int count,
+                          int page_size, int padding);
+
+void atlas_destroy(struct atlas *atlas);
+
+const struct atlas_rect *atlas_lookup(const struct atlas *atlas, const char *name);
+
+#endif
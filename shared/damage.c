@@ -0,0 +1,127 @@
+/*
+ * Damage rectangle set with union and coalescing
+ */
+
+#include "damage.h"
+
+static inline int64_t area(const struct damage_rect *r)
+{
+  return (int64_t) r->width * r->height;
+}
+
+static struct damage_rect bounding_box(const struct damage_rect *a, const struct damage_rect *b)
+{
+  int32_t x1 = a->x < b->x ? a->x : b->x;
+  int32_t y1 = a->y < b->y ? a->y : b->y;
+  int32_t x2 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+  int32_t y2 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+  struct damage_rect box = { x1, y1, x2 - x1, y2 - y1 };
+
+  return box;
+}
+
+static int64_t overlap(const struct damage_rect *a, const struct damage_rect *b)
+{
+  int32_t x1 = a->x > b->x ? a->x : b->x;
+  int32_t y1 = a->y > b->y ? a->y : b->y;
+  int32_t x2 = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+  int32_t y2 = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+
+  if (x2 <= x1 || y2 <= y1)
+    return 0;
+  return (int64_t) (x2 - x1) * (y2 - y1);
+}
+
+static int contains(const struct damage_rect *outer, const struct damage_rect *inner)
+{
+  return inner->x >= outer->x && inner->y >= outer->y &&
+         inner->x + inner->width <= outer->x + outer->width &&
+         inner->y + inner->height <= outer->y + outer->height;
+}
+
+/* Area the bounding box of |a| and |b| covers that neither of them does. */
+static int64_t waste(const struct damage_rect *a, const struct damage_rect *b)
+{
+  struct damage_rect box = bounding_box(a, b);
+
+  return area(&box) - (area(a) + area(b) - overlap(a, b));
+}
+
+static void remove_rect(struct damage *damage, int i)
+{
+  damage->rects[i] = damage->rects[--damage->n_rects];
+}
+
+static void add_rect(struct damage *damage, struct damage_rect r)
+{
+  int i;
+
+restart:
+  for (i = 0; i < damage->n_rects; i++) {
+    struct damage_rect *e = &damage->rects[i];
+
+    if (contains(e, &r))
+      return;
+
+    /*
+     * Merge when the rectangles cover each other or when the bounding box
+     * is at most a quarter larger than the area they actually cover.
+     */
+    if (contains(&r, e) || waste(e, &r) * 4 <= area(e) + area(&r) - overlap(e, &r)) {
+      r = bounding_box(e, &r);
+      remove_rect(damage, i);
+      goto restart;
+    }
+  }
+
+  if (damage->n_rects == DAMAGE_MAX_RECTS) {
+    int best = 0;
+
+    /* Out of slots: fold into the rectangle that grows the least. */
+    for (i = 1; i < damage->n_rects; i++) {
+      if (waste(&damage->rects[i], &r) < waste(&damage->rects[best], &r))
+        best = i;
+    }
+    r = bounding_box(&damage->rects[best], &r);
+    remove_rect(damage, best);
+    goto restart;
+  }
+
+  damage->rects[damage->n_rects++] = r;
+}
+
+void damage_add(struct damage *damage, int32_t x, int32_t y,
+                int32_t width, int32_t height,
+                int32_t clip_width, int32_t clip_height)
+{
+  struct damage_rect r;
+
+  if (x < 0) {
+    width += x;
+    x = 0;
+  }
+  if (y < 0) {
+    height += y;
+    y = 0;
+  }
+  if (x + width > clip_width)
+    width = clip_width - x;
+  if (y + height > clip_height)
+    height = clip_height - y;
+  if (width <= 0 || height <= 0)
+    return;
+
+  r.x = x;
+  r.y = y;
+  r.width = width;
+  r.height = height;
+  add_rect(damage, r);
+}
+
+void damage_union(struct damage *damage, const struct damage *other)
+{
+  int i;
+
+  for (i = 0; i < other->n_rects; i++)
+    add_rect(damage, other->rects[i]);
+}
@@ -0,0 +1,43 @@
+/*
+ * Damage tracking: a small set of rectangles describing what changed.
+ *
+ * Rectangles are coalesced as they are added, merging neighbours whose
+ * bounding box wastes little area, so the set stays short enough to send
+ * rectangle by rectangle with wl_surface_damage_buffer.
+ */
+
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+
+#define DAMAGE_MAX_RECTS 8
+
+struct damage_rect {
+  int32_t x, y, width, height;
+};
+
+struct damage {
+  int n_rects;
+  struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+static inline void damage_clear(struct damage *damage)
+{
+  damage->n_rects = 0;
+}
+
+static inline int damage_is_empty(const struct damage *damage)
+{
+  return damage->n_rects == 0;
+}
+
+/* Add a rectangle, clipped to [0, clip_width) x [0, clip_height). */
+void damage_add(struct damage *damage, int32_t x, int32_t y,
+                int32_t width, int32_t height,
+                int32_t clip_width, int32_t clip_height);
+
+/* Add every rectangle of |other| to |damage|. */
+void damage_union(struct damage *damage, const struct damage *other);
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Poll based wait for Wayland events
+ */
+
+#include <errno.h>
+#include <poll.h>
+
+#include "display-wait.h"
+
+int display_wait(struct wl_display *display, int timeout_ms)
+{
+  struct pollfd pfd = { wl_display_get_fd(display), POLLIN, 0 };
+  int ret;
+
+  /* Events that were already queued, e.g. read by EGL, may have made
+   * the caller dirty, so they end the wait. */
+  if (wl_display_prepare_read(display) != 0)
+    return wl_display_dispatch_pending(display) < 0 ? -1 : 0;
+  if (wl_display_flush(display) < 0 && errno != EAGAIN) {
+    wl_display_cancel_read(display);
+    return -1;
+  }
+
+  ret = poll(&pfd, 1, timeout_ms);
+  if (ret <= 0) {
+    wl_display_cancel_read(display);
+    return ret < 0 && errno != EINTR ? -1 : 0;
+  }
+  if (wl_display_read_events(display) < 0)
+    return -1;
+  return wl_display_dispatch_pending(display) < 0 ? -1 : 0;
+}
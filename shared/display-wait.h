@@ -0,0 +1,33 @@
+/*
+ * Blocking main loop step for clients that draw only when something
+ * changed.
+ *
+ * Instead of dispatching whatever is queued and redrawing regardless,
+ * the loop draws when its state is dirty and otherwise calls
+ * display_wait(), which flushes requests, sleeps in poll() until the
+ * compositor sends events or |timeout_ms| passes, and dispatches them.
+ * Listeners mark the state dirty; a timeout covers timers and content
+ * that changes on its own.  An idle client then costs no CPU or GPU time.
+ */
+
+#ifndef DISPLAY_WAIT_H
+#define DISPLAY_WAIT_H
+
+#include <wayland-client.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wait up to |timeout_ms|, or forever if negative, and dispatch what
+ * arrived.  Returns 0, also on a timeout or signal, or -1 once the
+ * connection has failed.
+ */
+int display_wait(struct wl_display *display, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,419 @@
+/*
+ * Zero copy frame import from dma-buf, memfd and file descriptors
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+
+#include "frame-import.h"
+#include "pixel-convert.h"
+
+#ifndef GL_UNPACK_ROW_LENGTH
+#define GL_UNPACK_ROW_LENGTH 0x0CF2
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_A
+#define GL_TEXTURE_SWIZZLE_A 0x8E45
+#endif
+
+#define IMPORT_CACHE_SIZE 4
+
+/* glEGLImageTargetTexture2DOES(), from GL_OES_EGL_image. */
+typedef void (*image_target_texture_func)(GLenum target, void *image);
+
+struct import_entry {
+  unsigned int used;         /* importer clock at the last use, 0 if free */
+  dev_t dev;
+  ino_t ino;
+  struct frame_desc desc;
+
+  /* a mapping, or an EGLImage bound to its own texture */
+  void *map;
+  size_t map_size;
+  EGLImageKHR image;
+  GLuint texture;
+};
+
+/* A texture mapped frames are uploaded to. */
+struct upload_texture {
+  GLuint texture;
+  GLenum internal_format;
+  int alpha_one;             /* alpha swizzled to one */
+  int width, height;
+};
+
+struct frame_importer {
+  EGLDisplay display;
+  PFNEGLCREATEIMAGEKHRPROC create_image;
+  PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+  image_target_texture_func image_target_texture;
+  int swizzle;               /* GL_TEXTURE_SWIZZLE_A is available */
+
+  struct import_entry entries[IMPORT_CACHE_SIZE];
+  unsigned int clock;
+
+  /* Uploads alternate between two, so a frame never overwrites the
+   * texture the previous one may still be drawing from. */
+  struct upload_texture uploads[2];
+  int next_upload;
+
+  uint32_t *scratch;         /* YCbCr converted to ARGB8888 */
+  size_t scratch_size;
+};
+
+struct format_info {
+  uint32_t format;
+  int bpp;                   /* of the first plane */
+  GLenum gl_format, gl_type;
+  int padded;                /* the alpha byte is undefined */
+};
+
+/* YCbCr formats upload as their ARGB8888 conversion, which is opaque. */
+static const struct format_info formats[] = {
+  { FRAME_FORMAT_ARGB8888, 4, GL_BGRA, GL_UNSIGNED_BYTE, 0 },
+  { FRAME_FORMAT_XRGB8888, 4, GL_BGRA, GL_UNSIGNED_BYTE, 1 },
+  { FRAME_FORMAT_ABGR8888, 4, GL_RGBA, GL_UNSIGNED_BYTE, 0 },
+  { FRAME_FORMAT_XBGR8888, 4, GL_RGBA, GL_UNSIGNED_BYTE, 1 },
+  { FRAME_FORMAT_RGB565, 2, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 0 },
+  { FRAME_FORMAT_NV12, 1, GL_BGRA, GL_UNSIGNED_BYTE, 0 },
+  { FRAME_FORMAT_YUV420, 1, GL_BGRA, GL_UNSIGNED_BYTE, 0 },
+};
+
+static const struct format_info *format_info(uint32_t format)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    if (formats[i].format == format)
+      return &formats[i];
+  return NULL;
+}
+
+static int is_yuv(uint32_t format)
+{
+  return format == FRAME_FORMAT_NV12 || format == FRAME_FORMAT_YUV420;
+}
+
+/*
+ * Row pitch of the chroma planes, which follow the luma plane: NV12
+ * shares the luma stride, YUV420 halves it.  Odd widths round the chroma
+ * up, so a stride of exactly the width still fits a whole chroma row.
+ */
+static int chroma_stride(const struct frame_desc *desc)
+{
+  int row = (desc->width + 1) / 2;
+
+  if (desc->format == FRAME_FORMAT_NV12)
+    return desc->stride > row * 2 ? desc->stride : row * 2;
+  return desc->stride / 2 > row ? desc->stride / 2 : row;
+}
+
+/* Bytes from the start of the fd up to the end of the last plane. */
+static size_t frame_end(const struct frame_desc *desc, const struct format_info *info)
+{
+  size_t luma = (size_t) desc->stride * (desc->height - 1) + (size_t) desc->width * info->bpp;
+  size_t chroma_rows = (desc->height + 1) / 2;
+
+  if (desc->format == FRAME_FORMAT_NV12)
+    luma = (size_t) desc->stride * desc->height + (size_t) chroma_stride(desc) * chroma_rows;
+  else if (desc->format == FRAME_FORMAT_YUV420)
+    luma = (size_t) desc->stride * desc->height + (size_t) chroma_stride(desc) * chroma_rows * 2;
+  return (size_t) desc->offset + luma;
+}
+
+static int has_extension(const char *extensions, const char *name)
+{
+  return extensions && strstr(extensions, name) != NULL;
+}
+
+struct frame_importer *frame_importer_create(EGLDisplay display)
+{
+  const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+  struct frame_importer *importer;
+
+  importer = calloc(1, sizeof *importer);
+  if (!importer)
+    return NULL;
+  importer->display = display;
+  importer->swizzle = has_extension(gl_extensions, "GL_ARB_texture_swizzle") ||
+                      has_extension(gl_extensions, "GL_EXT_texture_swizzle");
+
+  if (has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_EXT_image_dma_buf_import") &&
+      has_extension(gl_extensions, "GL_OES_EGL_image")) {
+    importer->create_image = (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress("eglCreateImageKHR");
+    importer->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress("eglDestroyImageKHR");
+    importer->image_target_texture =
+      (image_target_texture_func) eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    if (!importer->destroy_image || !importer->image_target_texture)
+      importer->create_image = NULL;
+  }
+
+  return importer;
+}
+
+static void release_entry(struct frame_importer *importer, struct import_entry *entry)
+{
+  if (entry->texture)
+    glDeleteTextures(1, &entry->texture);
+  if (entry->image != EGL_NO_IMAGE_KHR)
+    importer->destroy_image(importer->display, entry->image);
+  if (entry->map)
+    munmap(entry->map, entry->map_size);
+  memset(entry, 0, sizeof *entry);
+  entry->image = EGL_NO_IMAGE_KHR;
+}
+
+void frame_importer_destroy(struct frame_importer *importer)
+{
+  int i;
+
+  for (i = 0; i < IMPORT_CACHE_SIZE; i++)
+    if (importer->entries[i].used)
+      release_entry(importer, &importer->entries[i]);
+  for (i = 0; i < 2; i++)
+    if (importer->uploads[i].texture)
+      glDeleteTextures(1, &importer->uploads[i].texture);
+  free(importer->scratch);
+  free(importer);
+}
+
+static int same_desc(const struct frame_desc *a, const struct frame_desc *b)
+{
+  return a->format == b->format && a->width == b->width && a->height == b->height &&
+         a->stride == b->stride && a->offset == b->offset;
+}
+
+/* The cached import of this buffer, or the least recently used entry emptied. */
+static struct import_entry *lookup(struct frame_importer *importer, const struct stat *st,
+                                   const struct frame_desc *desc, int *hit)
+{
+  struct import_entry *entry, *victim = &importer->entries[0];
+  int i;
+
+  for (i = 0; i < IMPORT_CACHE_SIZE; i++) {
+    entry = &importer->entries[i];
+    if (entry->used && entry->dev == st->st_dev && entry->ino == st->st_ino) {
+      if (same_desc(&entry->desc, desc)) {
+        *hit = 1;
+        return entry;
+      }
+      /* Same buffer, new layout: import it again. */
+      victim = entry;
+      break;
+    }
+    if (entry->used < victim->used)
+      victim = entry;
+  }
+
+  if (victim->used)
+    release_entry(importer, victim);
+  victim->dev = st->st_dev;
+  victim->ino = st->st_ino;
+  victim->desc = *desc;
+  victim->image = EGL_NO_IMAGE_KHR;
+  *hit = 0;
+  return victim;
+}
+
+static int import_dmabuf(struct frame_importer *importer, struct import_entry *entry, int fd)
+{
+  const struct frame_desc *desc = &entry->desc;
+  EGLint attribs[] = {
+    EGL_WIDTH, desc->width,
+    EGL_HEIGHT, desc->height,
+    EGL_LINUX_DRM_FOURCC_EXT, (EGLint) desc->format,
+    EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+    EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint) desc->offset,
+    EGL_DMA_BUF_PLANE0_PITCH_EXT, desc->stride,
+    EGL_NONE
+  };
+
+  /* The image keeps its own reference to the buffer. */
+  entry->image = importer->create_image(importer->display, EGL_NO_CONTEXT,
+                                        EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+  if (entry->image == EGL_NO_IMAGE_KHR)
+    return -1;
+
+  glGenTextures(1, &entry->texture);
+  glBindTexture(GL_TEXTURE_2D, entry->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  importer->image_target_texture(GL_TEXTURE_2D, entry->image);
+  if (glGetError() != GL_NO_ERROR) {
+    glDeleteTextures(1, &entry->texture);
+    entry->texture = 0;
+    importer->destroy_image(importer->display, entry->image);
+    entry->image = EGL_NO_IMAGE_KHR;
+    return -1;
+  }
+  return 0;
+}
+
+static int map_buffer(struct import_entry *entry, int fd, size_t size)
+{
+  /* The mapping keeps its own reference to the buffer, too. */
+  entry->map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (entry->map == MAP_FAILED) {
+    entry->map = NULL;
+    return -1;
+  }
+  entry->map_size = size;
+  return 0;
+}
+
+/* The frame as pixels GL can take: the mapping itself, or its conversion. */
+static const void *frame_pixels(struct frame_importer *importer, const struct import_entry *entry,
+                                int *stride)
+{
+  const struct frame_desc *desc = &entry->desc;
+  const uint8_t *y = (const uint8_t *) entry->map + desc->offset;
+  const uint8_t *u = y + (size_t) desc->stride * desc->height;
+  size_t size = (size_t) desc->width * desc->height * 4;
+  enum yuv_matrix matrix = desc->height >= 720 ? YUV_BT709 : YUV_BT601;
+
+  *stride = desc->stride;
+  if (!is_yuv(desc->format))
+    return y;
+
+  if (importer->scratch_size < size) {
+    free(importer->scratch);
+    importer->scratch = malloc(size);
+    importer->scratch_size = importer->scratch ? size : 0;
+    if (!importer->scratch)
+      return NULL;
+  }
+  *stride = desc->width * 4;
+  if (desc->format == FRAME_FORMAT_NV12)
+    pixel_convert_nv12_to_argb(importer->scratch, *stride, y, desc->stride, u,
+                               chroma_stride(desc), desc->width, desc->height, matrix);
+  else
+    pixel_convert_yuv420_to_argb(importer->scratch, *stride, y, desc->stride, u,
+                                 u + (size_t) chroma_stride(desc) * ((desc->height + 1) / 2),
+                                 chroma_stride(desc), desc->width, desc->height, matrix);
+  return importer->scratch;
+}
+
+static GLuint upload(struct frame_importer *importer, const struct import_entry *entry,
+                     const struct format_info *info)
+{
+  struct upload_texture *up = &importer->uploads[importer->next_upload];
+  const struct frame_desc *desc = &entry->desc;
+  int bpp = is_yuv(desc->format) ? 4 : info->bpp;
+  GLenum internal_format = GL_RGBA;
+  int alpha_one = 0;
+  const uint8_t *pixels;
+  int stride, y;
+
+  /* Drivers may convert RGBA data to RGB storage on every upload, so
+   * padded formats keep RGBA storage and ignore alpha when sampled. */
+  if (info->gl_format == GL_RGB || (info->padded && !importer->swizzle))
+    internal_format = GL_RGB;
+  else if (info->padded)
+    alpha_one = 1;
+
+  pixels = frame_pixels(importer, entry, &stride);
+  if (!pixels)
+    return 0;
+  importer->next_upload ^= 1;
+
+  if (!up->texture) {
+    glGenTextures(1, &up->texture);
+    glBindTexture(GL_TEXTURE_2D, up->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, up->texture);
+  }
+  /* Storage is only reallocated when the size or format changes. */
+  if (up->internal_format != internal_format ||
+      up->width != desc->width || up->height != desc->height) {
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, desc->width, desc->height, 0,
+                 info->gl_format, info->gl_type, NULL);
+    up->internal_format = internal_format;
+    up->width = desc->width;
+    up->height = desc->height;
+  }
+  if (up->alpha_one != alpha_one) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, alpha_one ? GL_ONE : GL_ALPHA);
+    up->alpha_one = alpha_one;
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (stride % bpp == 0) {
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bpp);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, desc->width, desc->height,
+                    info->gl_format, info->gl_type, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  } else {
+    /* Rows that don't start on a pixel boundary go one at a time. */
+    for (y = 0; y < desc->height; y++)
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, desc->width, 1,
+                      info->gl_format, info->gl_type, pixels + (size_t) y * stride);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  return up->texture;
+}
+
+GLuint frame_importer_import(struct frame_importer *importer, int fd,
+                             const struct frame_desc *desc)
+{
+  const struct format_info *info = format_info(desc->format);
+  struct import_entry *entry;
+  struct stat st;
+  off_t size;
+  size_t end;
+  int hit;
+
+  if (!info) {
+    fprintf(stderr, "frame import: unknown format %.4s\n", (const char *) &desc->format);
+    return 0;
+  }
+  if (desc->width <= 0 || desc->height <= 0 || desc->offset < 0 ||
+      desc->stride < desc->width * info->bpp) {
+    fprintf(stderr, "frame import: bad %dx%d frame, stride %d\n",
+            desc->width, desc->height, desc->stride);
+    return 0;
+  }
+  if (fstat(fd, &st) < 0) {
+    perror("frame import: fstat");
+    return 0;
+  }
+  /* dma-bufs report their size through lseek() rather than fstat(). */
+  size = S_ISREG(st.st_mode) ? st.st_size : lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    perror("frame import: buffer size");
+    return 0;
+  }
+  end = frame_end(desc, info);
+  /* A buffer shorter than the frame would fault on the read. */
+  if ((off_t) end > size) {
+    fprintf(stderr, "frame import: frame ends at %zu, past the %lld byte buffer\n",
+            end, (long long) size);
+    return 0;
+  }
+
+  entry = lookup(importer, &st, desc, &hit);
+  entry->used = ++importer->clock;
+  if (!hit) {
+    /* dma-bufs aren't regular files; sample those in place if the driver can. */
+    if (!S_ISREG(st.st_mode) && importer->create_image && !is_yuv(desc->format) &&
+        import_dmabuf(importer, entry, fd) == 0)
+      return entry->texture;
+    if (map_buffer(entry, fd, end) < 0) {
+      perror("frame import: mmap");
+      release_entry(importer, entry);
+      return 0;
+    }
+  } else if (entry->texture) {
+    return entry->texture;
+  }
+
+  return upload(importer, entry, info);
+}
@@ -0,0 +1,81 @@
+/*
+ * Video frames from file descriptors, as textures for the fixed function
+ * GL samples.
+ *
+ * A frame is described by a DRM fourcc, its size, the stride of its first
+ * plane and where that plane starts in the fd.  Frames are never copied
+ * on the CPU when the format allows it:
+ *
+ *  - dma-buf fds of packed RGB formats are imported as EGLImages with
+ *    EGL_EXT_image_dma_buf_import and sampled in place;
+ *  - memfds, files and dma-bufs that can't be imported are mapped read
+ *    only and uploaded straight from the mapping, with GL_UNPACK_ROW_LENGTH
+ *    covering the stride, so the driver's upload is the only copy;
+ *  - NV12 and I420 are converted to ARGB8888 first, one pass over the
+ *    frame, as fixed function GL can't sample YCbCr.  Frames of 720 lines
+ *    and up use BT.709, smaller ones BT.601.
+ *
+ * Imports are cached per buffer, by inode, so a producer cycling through a
+ * few buffers pays for mmap() or EGLImage creation once per buffer.  The
+ * cache holds a reference to each buffer until it is evicted.  Synchronizing
+ * writes to an imported dma-buf with its reads is up to the producer.
+ *
+ * All calls need the GL context to be current.
+ */
+
+#ifndef FRAME_IMPORT_H
+#define FRAME_IMPORT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <EGL/egl.h>
+#include <GL/gl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_FOURCC(a, b, c, d) \
+  ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+/* The drm_fourcc.h codes, so dma-buf formats pass through unchanged. */
+#define FRAME_FORMAT_ARGB8888 FRAME_FOURCC('A', 'R', '2', '4')
+#define FRAME_FORMAT_XRGB8888 FRAME_FOURCC('X', 'R', '2', '4')
+#define FRAME_FORMAT_ABGR8888 FRAME_FOURCC('A', 'B', '2', '4')
+#define FRAME_FORMAT_XBGR8888 FRAME_FOURCC('X', 'B', '2', '4')
+#define FRAME_FORMAT_RGB565   FRAME_FOURCC('R', 'G', '1', '6')
+#define FRAME_FORMAT_NV12     FRAME_FOURCC('N', 'V', '1', '2')
+#define FRAME_FORMAT_YUV420   FRAME_FOURCC('Y', 'U', '1', '2')
+
+/*
+ * NV12 chroma rows are |stride| bytes and I420 ones |stride| / 2, but never
+ * less than a whole row of (width + 1) / 2 samples.
+ */
+struct frame_desc {
+  uint32_t format;           /* FRAME_FORMAT_* */
+  int width, height;
+  int stride;                /* bytes per row of the first plane */
+  off_t offset;              /* of the first plane; chroma planes follow it */
+};
+
+struct frame_importer;
+
+/* |display| is the one the current context was created on. */
+struct frame_importer *frame_importer_create(EGLDisplay display);
+
+/* Drops every cached buffer and texture. */
+void frame_importer_destroy(struct frame_importer *importer);
+
+/*
+ * A texture holding the frame in |fd|, which stays owned by the caller.
+ * Returns 0, printing why, if the format is unknown or the fd is too small
+ * for |desc|.  The texture is valid until the next call.
+ */
+GLuint frame_importer_import(struct frame_importer *importer, int fd,
+                             const struct frame_desc *desc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
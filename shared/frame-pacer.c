@@ -0,0 +1,125 @@
+/*
+ * Vblank prediction and late frame starts from presentation feedback
+ */
+
+#include <stdlib.h>
+
+#include "frame-pacer.h"
+
+/* Render costs the estimate looks back over; it takes their maximum. */
+#define COST_HISTORY 16
+
+/* The margin narrows by a step after a run of frames on time; the run
+ * needed doubles with every miss, so probing for the edge slows down. */
+#define MIN_HITS_TO_NARROW 10
+#define MAX_HITS_TO_NARROW 640
+#define NARROW_STEP 250000ull      /* 0.25 ms */
+#define MIN_MARGIN 500000ull       /* 0.5 ms */
+
+struct frame_pacer {
+  uint64_t costs[COST_HISTORY];
+  int next_cost;
+
+  uint64_t vblank;           /* the latest presentation, 0 before the first */
+  uint64_t refresh;          /* 0 while unknown */
+  uint64_t last_target;
+  uint64_t margin;
+
+  uint32_t hits, hits_to_narrow, misses;
+};
+
+struct frame_pacer *frame_pacer_create(void)
+{
+  struct frame_pacer *pacer;
+
+  pacer = calloc(1, sizeof *pacer);
+  if (pacer)
+    pacer->hits_to_narrow = MIN_HITS_TO_NARROW;
+  return pacer;
+}
+
+void frame_pacer_destroy(struct frame_pacer *pacer)
+{
+  free(pacer);
+}
+
+uint64_t frame_pacer_budget(const struct frame_pacer *pacer)
+{
+  uint64_t cost = 0;
+  int i;
+
+  for (i = 0; i < COST_HISTORY; i++)
+    if (pacer->costs[i] > cost)
+      cost = pacer->costs[i];
+  return cost + pacer->margin;
+}
+
+uint64_t frame_pacer_next_start(struct frame_pacer *pacer, uint64_t now, uint64_t *target)
+{
+  uint64_t budget, vblank;
+
+  if (!pacer->vblank || !pacer->refresh) {
+    *target = 0;
+    return now;
+  }
+
+  /* The first vblank the frame can make if started now... */
+  budget = frame_pacer_budget(pacer);
+  vblank = pacer->vblank;
+  if (now + budget > vblank)
+    vblank += (now + budget - vblank + pacer->refresh - 1) / pacer->refresh * pacer->refresh;
+  /* ...but never one an earlier frame is already meant for. */
+  if (vblank <= pacer->last_target)
+    vblank = pacer->last_target + pacer->refresh;
+
+  pacer->last_target = vblank;
+  *target = vblank;
+  return vblank - budget > now ? vblank - budget : now;
+}
+
+void frame_pacer_rendered(struct frame_pacer *pacer, uint64_t start, uint64_t submit)
+{
+  pacer->costs[pacer->next_cost] = submit > start ? submit - start : 0;
+  pacer->next_cost = (pacer->next_cost + 1) % COST_HISTORY;
+}
+
+void frame_pacer_presented(struct frame_pacer *pacer, uint64_t target, uint64_t present,
+                           uint64_t refresh)
+{
+  /* Without a reported period, the shortest gap between presentations. */
+  if (!refresh && pacer->vblank && present > pacer->vblank &&
+      (!pacer->refresh || present - pacer->vblank < pacer->refresh))
+    refresh = present - pacer->vblank;
+  else if (!refresh)
+    refresh = pacer->refresh;
+
+  if (refresh && !pacer->refresh)
+    pacer->margin = refresh / 2;
+  pacer->refresh = refresh;
+  if (present > pacer->vblank)
+    pacer->vblank = present;
+
+  if (!target || !refresh)
+    return;
+
+  if (present > target + refresh / 2) {
+    pacer->misses++;
+    pacer->hits = 0;
+    pacer->margin += refresh / 8;
+    if (pacer->margin > refresh)
+      pacer->margin = refresh;
+    if (pacer->hits_to_narrow < MAX_HITS_TO_NARROW)
+      pacer->hits_to_narrow *= 2;
+  } else if (++pacer->hits >= pacer->hits_to_narrow) {
+    pacer->hits = 0;
+    if (pacer->margin > MIN_MARGIN + NARROW_STEP)
+      pacer->margin -= NARROW_STEP;
+    else
+      pacer->margin = MIN_MARGIN;
+  }
+}
+
+uint32_t frame_pacer_misses(const struct frame_pacer *pacer)
+{
+  return pacer->misses;
+}
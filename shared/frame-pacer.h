@@ -0,0 +1,54 @@
+/*
+ * Frame start scheduling for the lowest latency that still makes vblank.
+ *
+ * A client that draws as soon as it can has its frame wait in the
+ * compositor for up to a refresh period before it is shown.  The pacer
+ * instead predicts the next vblank from presentation timestamps and
+ * starts each frame as late as its budget allows: the recent worst render
+ * cost plus a margin for the compositor to pick the frame up.
+ *
+ * The margin adapts.  A frame presented after its target vblank widens
+ * it by an eighth of a refresh; runs of frames on time narrow it again in
+ * small steps, so it settles just above what the compositor needs.  Each
+ * miss doubles the run needed, so misses get rarer the longer it runs.
+ *
+ * All times are nanoseconds in one clock, the compositor's presentation
+ * clock.  Without presentation timestamps there is nothing to predict
+ * from and frames start immediately.
+ */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <stdint.h>
+
+struct frame_pacer;
+
+struct frame_pacer *frame_pacer_create(void);
+
+void frame_pacer_destroy(struct frame_pacer *pacer);
+
+/*
+ * Plan the next frame: when to start it, never before |now|.  |target|
+ * gets the vblank it is meant for, or 0 while there is no prediction.
+ * Call once per frame; each call plans a frame for a later vblank.
+ */
+uint64_t frame_pacer_next_start(struct frame_pacer *pacer, uint64_t now, uint64_t *target);
+
+/* The frame started at |start| was committed at |submit|. */
+void frame_pacer_rendered(struct frame_pacer *pacer, uint64_t start, uint64_t submit);
+
+/*
+ * The frame meant for |target| was presented at |present|; |refresh| is
+ * the output's refresh period, or 0 if the compositor doesn't know it.
+ */
+void frame_pacer_presented(struct frame_pacer *pacer, uint64_t target, uint64_t present,
+                           uint64_t refresh);
+
+/* Frames presented after their target vblank. */
+uint32_t frame_pacer_misses(const struct frame_pacer *pacer);
+
+/* The current render cost estimate plus margin. */
+uint64_t frame_pacer_budget(const struct frame_pacer *pacer);
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Frame time histograms with CPU clocks and GPU timer queries
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include "frame-stats.h"
+
+/* Each power of two range is split in 128 buckets, so values are
+ * recorded within 1/128 of themselves; values of 2^41 ns (36 minutes)
+ * and up share the last bucket. */
+#define SUB_BITS 7
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_SHIFT 33
+#define BUCKETS ((MAX_SHIFT + 2) * SUB_COUNT)
+#define MAX_VALUE ((1ull << (SUB_BITS + 1 + MAX_SHIFT)) - 1)
+
+/* Frames the GPU may run behind before timings are skipped. */
+#define GPU_QUERIES 8
+
+struct histogram {
+  uint64_t count, max;
+  uint32_t buckets[BUCKETS];
+};
+
+struct gpu_timer {
+  PFNGLGENQUERIESEXTPROC gen_queries;
+  PFNGLDELETEQUERIESEXTPROC delete_queries;
+  PFNGLBEGINQUERYEXTPROC begin_query;
+  PFNGLENDQUERYEXTPROC end_query;
+  PFNGLGETQUERYOBJECTUIVEXTPROC get_query_uiv;
+  PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_ui64v;
+
+  GLuint queries[GPU_QUERIES];
+  uint64_t begin_ns[GPU_QUERIES];
+  int head, pending;         /* next to begin, and ended but not collected */
+  int active;
+};
+
+struct frame_stats {
+  struct histogram stats[FRAME_STAT_COUNT];
+  struct gpu_timer *gpu;
+  uint64_t begin_ns, swap_ns;
+};
+
+static const char *const stat_names[FRAME_STAT_COUNT] = {
+  "cpu", "gpu", "swap", "interval", "present"
+};
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t value)
+{
+  int shift;
+
+  if (value > MAX_VALUE)
+    value = MAX_VALUE;
+  if (value < 2 * SUB_COUNT)
+    return value;
+  shift = 63 - __builtin_clzll(value) - SUB_BITS;
+  return shift * SUB_COUNT + (value >> shift);
+}
+
+/* The largest value recorded in bucket |index|. */
+static uint64_t bucket_value(int index)
+{
+  int shift;
+
+  if (index < 2 * SUB_COUNT)
+    return index;
+  shift = index / SUB_COUNT - 1;
+  return ((uint64_t) (index - shift * SUB_COUNT) << shift) + (1ull << shift) - 1;
+}
+
+static void record(struct histogram *h, uint64_t value)
+{
+  h->buckets[bucket_index(value)]++;
+  h->count++;
+  if (value > h->max)
+    h->max = value;
+}
+
+static uint64_t percentile(const struct histogram *h, double p)
+{
+  uint64_t target, seen = 0;
+  int i;
+
+  if (!h->count)
+    return 0;
+  if (p >= 100)
+    return h->max;
+  target = (uint64_t) (p / 100 * h->count + 0.5);
+  if (target < 1)
+    target = 1;
+  for (i = 0; i < BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= target)
+      return bucket_value(i) < h->max ? bucket_value(i) : h->max;
+  }
+  return h->max;
+}
+
+static struct gpu_timer *gpu_timer_create(void)
+{
+  const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+  struct gpu_timer *gpu;
+  GLint disjoint;
+
+  if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query"))
+    return NULL;
+  gpu = calloc(1, sizeof *gpu);
+  if (!gpu)
+    return NULL;
+
+  gpu->gen_queries = (PFNGLGENQUERIESEXTPROC) eglGetProcAddress("glGenQueriesEXT");
+  gpu->delete_queries = (PFNGLDELETEQUERIESEXTPROC) eglGetProcAddress("glDeleteQueriesEXT");
+  gpu->begin_query = (PFNGLBEGINQUERYEXTPROC) eglGetProcAddress("glBeginQueryEXT");
+  gpu->end_query = (PFNGLENDQUERYEXTPROC) eglGetProcAddress("glEndQueryEXT");
+  gpu->get_query_uiv =
+    (PFNGLGETQUERYOBJECTUIVEXTPROC) eglGetProcAddress("glGetQueryObjectuivEXT");
+  gpu->get_query_ui64v =
+    (PFNGLGETQUERYOBJECTUI64VEXTPROC) eglGetProcAddress("glGetQueryObjectui64vEXT");
+  if (!gpu->gen_queries || !gpu->delete_queries || !gpu->begin_query || !gpu->end_query ||
+      !gpu->get_query_uiv || !gpu->get_query_ui64v) {
+    free(gpu);
+    return NULL;
+  }
+
+  gpu->gen_queries(GPU_QUERIES, gpu->queries);
+  /* Reading the flag clears it, so only later events count. */
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  return gpu;
+}
+
+/* Record the queries that have finished, oldest first, without waiting. */
+static void gpu_timer_collect(struct gpu_timer *gpu, struct histogram *h)
+{
+  uint64_t results[GPU_QUERIES], now = now_ns();
+  GLint disjoint = 0;
+  int i, n = 0;
+
+  while (gpu->pending) {
+    int index = (gpu->head - gpu->pending + GPU_QUERIES) % GPU_QUERIES;
+    GLuint query = gpu->queries[index];
+    GLuint available = 0;
+    GLuint64 elapsed;
+
+    gpu->get_query_uiv(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+    if (!available)
+      break;
+    gpu->get_query_ui64v(query, GL_QUERY_RESULT_EXT, &elapsed);
+    /* Some drivers time a context's first query from boot; no frame
+     * took longer than has passed since it began. */
+    if (elapsed <= now - gpu->begin_ns[index])
+      results[n++] = elapsed;
+    gpu->pending--;
+  }
+  if (!n)
+    return;
+
+  /* A frequency change or context switch makes these meaningless. */
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  if (disjoint)
+    return;
+  for (i = 0; i < n; i++)
+    record(h, results[i]);
+}
+
+struct frame_stats *frame_stats_create(int gpu)
+{
+  struct frame_stats *stats;
+
+  stats = calloc(1, sizeof *stats);
+  if (!stats)
+    return NULL;
+  if (gpu)
+    stats->gpu = gpu_timer_create();
+  return stats;
+}
+
+void frame_stats_destroy(struct frame_stats *stats)
+{
+  struct gpu_timer *gpu = stats->gpu;
+
+  if (gpu) {
+    if (gpu->active)
+      gpu->end_query(GL_TIME_ELAPSED_EXT);
+    gpu->delete_queries(GPU_QUERIES, gpu->queries);
+    free(gpu);
+  }
+  free(stats);
+}
+
+void frame_stats_begin(struct frame_stats *stats)
+{
+  struct gpu_timer *gpu = stats->gpu;
+  uint64_t now = now_ns();
+
+  if (stats->begin_ns)
+    record(&stats->stats[FRAME_STAT_INTERVAL], now - stats->begin_ns);
+  stats->begin_ns = now;
+
+  if (gpu) {
+    gpu_timer_collect(gpu, &stats->stats[FRAME_STAT_GPU]);
+    /* With every query still in flight this frame goes untimed. */
+    if (gpu->pending < GPU_QUERIES) {
+      gpu->begin_query(GL_TIME_ELAPSED_EXT, gpu->queries[gpu->head]);
+      gpu->begin_ns[gpu->head] = now;
+      gpu->active = 1;
+    }
+  }
+}
+
+void frame_stats_swap(struct frame_stats *stats)
+{
+  struct gpu_timer *gpu = stats->gpu;
+
+  stats->swap_ns = now_ns();
+  record(&stats->stats[FRAME_STAT_CPU], stats->swap_ns - stats->begin_ns);
+
+  if (gpu && gpu->active) {
+    gpu->end_query(GL_TIME_ELAPSED_EXT);
+    gpu->head = (gpu->head + 1) % GPU_QUERIES;
+    gpu->pending++;
+    gpu->active = 0;
+  }
+}
+
+void frame_stats_end(struct frame_stats *stats)
+{
+  record(&stats->stats[FRAME_STAT_SWAP], now_ns() - stats->swap_ns);
+}
+
+void frame_stats_record(struct frame_stats *stats, enum frame_stat stat, uint64_t ns)
+{
+  record(&stats->stats[stat], ns);
+}
+
+uint64_t frame_stats_count(const struct frame_stats *stats, enum frame_stat stat)
+{
+  return stats->stats[stat].count;
+}
+
+uint64_t frame_stats_percentile(const struct frame_stats *stats, enum frame_stat stat,
+                                double p)
+{
+  return percentile(&stats->stats[stat], p);
+}
+
+void frame_stats_print(const struct frame_stats *stats, FILE *f)
+{
+  int i;
+
+  fprintf(f, "%-10s %10s %10s %10s %10s %10s\n",
+          "us", "frames", "p50", "p90", "p99", "max");
+  for (i = 0; i < FRAME_STAT_COUNT; i++) {
+    const struct histogram *h = &stats->stats[i];
+
+    if (!h->count)
+      continue;
+    fprintf(f, "%-10s %10llu %10.1f %10.1f %10.1f %10.1f\n", stat_names[i],
+            (unsigned long long) h->count, percentile(h, 50) / 1e3,
+            percentile(h, 90) / 1e3, percentile(h, 99) / 1e3, h->max / 1e3);
+  }
+}
+
+int frame_stats_write(const struct frame_stats *stats, const char *path)
+{
+  size_t len = strlen(path);
+  int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+  FILE *f;
+  int i;
+
+  f = fopen(path, "w");
+  if (!f)
+    return -1;
+
+  if (csv)
+    fprintf(f, "stat,frames,p50_us,p90_us,p99_us,max_us\n");
+  else
+    fprintf(f, "{\n");
+  for (i = 0; i < FRAME_STAT_COUNT; i++) {
+    const struct histogram *h = &stats->stats[i];
+    unsigned long long count = h->count;
+
+    /* Stats that were never measured, like gpu without timer queries, are left empty. */
+    if (csv && !count)
+      fprintf(f, "%s,0,,,,\n", stat_names[i]);
+    else if (csv)
+      fprintf(f, "%s,%llu,%.3f,%.3f,%.3f,%.3f\n", stat_names[i], count,
+              percentile(h, 50) / 1e3, percentile(h, 90) / 1e3, percentile(h, 99) / 1e3,
+              h->max / 1e3);
+    else if (!count)
+      fprintf(f, "  \"%s\": { \"frames\": 0 }%s\n", stat_names[i],
+              i + 1 < FRAME_STAT_COUNT ? "," : "");
+    else
+      fprintf(f, "  \"%s\": { \"frames\": %llu, \"p50_us\": %.3f, \"p90_us\": %.3f, "
+              "\"p99_us\": %.3f, \"max_us\": %.3f }%s\n", stat_names[i], count,
+              percentile(h, 50) / 1e3, percentile(h, 90) / 1e3, percentile(h, 99) / 1e3,
+              h->max / 1e3, i + 1 < FRAME_STAT_COUNT ? "," : "");
+  }
+  if (!csv)
+    fprintf(f, "}\n");
+
+  return fclose(f) == 0 ? 0 : -1;
+}
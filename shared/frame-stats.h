@@ -0,0 +1,66 @@
+/*
+ * Frame time distributions for the GLES2 and SHM samples.
+ *
+ * Every frame records, at nanosecond resolution:
+ *
+ *  - cpu: from frame_stats_begin() to frame_stats_swap(), the time spent
+ *    preparing and issuing the frame;
+ *  - gpu: the GPU time of the commands issued in that span, measured with
+ *    EXT_disjoint_timer_query where the context has it.  Results are
+ *    collected a few frames later without stalling, and dropped when the
+ *    driver reports a disjoint event;
+ *  - swap: from frame_stats_swap() to frame_stats_end(), time blocked in
+ *    eglSwapBuffers() or the commit;
+ *  - interval: between consecutive frame_stats_begin() calls, what the
+ *    user sees as frame pacing;
+ *  - present: from frame_stats_begin() to the frame reaching the screen,
+ *    which only the compositor knows; the caller records it.
+ *
+ * Each goes into a log-linear histogram, exact below 256 ns and within
+ * 1/128 of the value above, so percentiles cost no per-frame allocation
+ * and no sorting however long the run.  Averages hide the occasional long
+ * frame; p99 and max don't.
+ */
+
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum frame_stat {
+  FRAME_STAT_CPU,
+  FRAME_STAT_GPU,
+  FRAME_STAT_SWAP,
+  FRAME_STAT_INTERVAL,
+  FRAME_STAT_PRESENT,
+  FRAME_STAT_COUNT
+};
+
+struct frame_stats;
+
+/* With |gpu| set, the GLES2 context must be current; 0 for SHM rendering. */
+struct frame_stats *frame_stats_create(int gpu);
+
+/* Timings still in flight are dropped; the context must be current if |gpu| was set. */
+void frame_stats_destroy(struct frame_stats *stats);
+
+void frame_stats_begin(struct frame_stats *stats);
+void frame_stats_swap(struct frame_stats *stats);
+void frame_stats_end(struct frame_stats *stats);
+
+/* A time measured elsewhere, like FRAME_STAT_PRESENT, in nanoseconds. */
+void frame_stats_record(struct frame_stats *stats, enum frame_stat stat, uint64_t ns);
+
+/* Frames recorded for |stat|, and its |percentile| (0-100) in nanoseconds. */
+uint64_t frame_stats_count(const struct frame_stats *stats, enum frame_stat stat);
+uint64_t frame_stats_percentile(const struct frame_stats *stats, enum frame_stat stat,
+                                double percentile);
+
+/* p50, p90, p99 and max of each stat, as a table for people. */
+void frame_stats_print(const struct frame_stats *stats, FILE *f);
+
+/* The same as JSON, or CSV if |path| ends in ".csv".  Returns -1 on error. */
+int frame_stats_write(const struct frame_stats *stats, const char *path);
+
+#endif
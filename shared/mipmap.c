@@ -0,0 +1,546 @@
+/*
+ * CPU mip chain generation
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mipmap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Levels smaller than this are not worth waking the pool for. */
+#define MIP_BAND_MIN_PIXELS (128 * 1024)
+
+#define KAISER_TAPS 8
+#define KAISER_ALPHA 4.0
+#define KAISER_RADIUS 2.0 /* in destination pixels */
+
+/* Linear -> sRGB goes through a table this fine to keep dark steps exact. */
+#define ENCODE_SIZE 16384
+
+/*
+ * A separable kernel: destination pixel x is the weighted sum of source
+ * pixels 2x + offset ... 2x + offset + taps - 1, clamped to the edges.
+ */
+struct kernel {
+  int offset, taps;
+  float w[KAISER_TAPS];
+};
+
+static struct kernel box_kernel = { 0, 2, { 0.5f, 0.5f } };
+static struct kernel kaiser_kernel = { -(KAISER_TAPS / 2 - 1), KAISER_TAPS, { 0 } };
+
+static float decode_srgb[256], decode_linear[256];
+static uint8_t encode_srgb[ENCODE_SIZE];
+
+struct mip_ops {
+  void (*box_row)(uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width);
+  void (*hpass)(float *dst, const float *src, int src_width, int width, const struct kernel *k);
+  void (*vpass)(float *dst, const float *const *rows, int n, const struct kernel *k);
+};
+
+/*
+ * Scalar loops.  They define the results: the vector loops do the same
+ * operations in the same order, so all of them agree bit for bit.
+ */
+
+/* |width| destination pixels of a 2x2 box from two rows of an even width. */
+static void box_row_scalar(uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width)
+{
+  int x, c;
+
+  for (x = 0; x < width; x++)
+    for (c = 0; c < 4; c++)
+      dst[4 * x + c] = (r0[8 * x + c] + r0[8 * x + 4 + c] +
+                        r1[8 * x + c] + r1[8 * x + 4 + c] + 2) >> 2;
+}
+
+static inline int clamp_index(int i, int n)
+{
+  return i < 0 ? 0 : i >= n ? n - 1 : i;
+}
+
+static void hpass_scalar(float *dst, const float *src, int src_width, int width,
+                         const struct kernel *k)
+{
+  int x, t, c;
+
+  for (x = 0; x < width; x++) {
+    float acc[4] = { 0, 0, 0, 0 };
+
+    for (t = 0; t < k->taps; t++) {
+      const float *p = src + 4 * clamp_index(2 * x + k->offset + t, src_width);
+
+      for (c = 0; c < 4; c++)
+        acc[c] += k->w[t] * p[c];
+    }
+    memcpy(dst + 4 * x, acc, sizeof acc);
+  }
+}
+
+/* |n| floats of a vertical filter over k->taps rows. */
+static void vpass_scalar(float *dst, const float *const *rows, int n, const struct kernel *k)
+{
+  int i, t;
+
+  for (i = 0; i < n; i++) {
+    float acc = 0;
+
+    for (t = 0; t < k->taps; t++)
+      acc += k->w[t] * rows[t][i];
+    dst[i] = acc;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* 4 destination pixels from 8 source pixels of each row. */
+static inline __m128i box4_sse2(const uint8_t *r0, const uint8_t *r1)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) r0));
+  __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) (r0 + 16)));
+  __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) r1));
+  __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *) (r1 + 16)));
+  __m128i e0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i o0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i e1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i o1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(e0, zero), _mm_unpacklo_epi8(o0, zero)),
+                             _mm_add_epi16(_mm_unpacklo_epi8(e1, zero), _mm_unpacklo_epi8(o1, zero)));
+  __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(e0, zero), _mm_unpackhi_epi8(o0, zero)),
+                             _mm_add_epi16(_mm_unpackhi_epi8(e1, zero), _mm_unpackhi_epi8(o1, zero)));
+
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_set1_epi16(2)), 2);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_set1_epi16(2)), 2);
+  return _mm_packus_epi16(lo, hi);
+}
+
+static void box_row_sse2(uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width)
+{
+  int x = 0;
+
+  for (; x + 4 <= width; x += 4)
+    _mm_storeu_si128((__m128i *) (dst + 4 * x), box4_sse2(r0 + 8 * x, r1 + 8 * x));
+  box_row_scalar(dst + 4 * x, r0 + 8 * x, r1 + 8 * x, width - x);
+}
+
+/* One pixel, all four channels, per vector. */
+static void hpass_sse2(float *dst, const float *src, int src_width, int width,
+                       const struct kernel *k)
+{
+  int x, t;
+
+  for (x = 0; x < width; x++) {
+    __m128 acc = _mm_setzero_ps();
+
+    for (t = 0; t < k->taps; t++) {
+      __m128 p = _mm_loadu_ps(src + 4 * clamp_index(2 * x + k->offset + t, src_width));
+
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(k->w[t]), p));
+    }
+    _mm_storeu_ps(dst + 4 * x, acc);
+  }
+}
+
+static void vpass_sse2(float *dst, const float *const *rows, int n, const struct kernel *k)
+{
+  int i = 0, t;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128 acc = _mm_setzero_ps();
+
+    for (t = 0; t < k->taps; t++)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(k->w[t]), _mm_loadu_ps(rows[t] + i)));
+    _mm_storeu_ps(dst + i, acc);
+  }
+
+  for (; i < n; i++) {
+    float acc = 0;
+
+    for (t = 0; t < k->taps; t++)
+      acc += k->w[t] * rows[t][i];
+    dst[i] = acc;
+  }
+}
+
+/* 8 destination pixels; the in-lane shuffles leave the quarters as 0 2 1 3. */
+__attribute__((target("avx2")))
+static void box_row_avx2(uint8_t *dst, const uint8_t *r0, const uint8_t *r1, int width)
+{
+  const __m256i zero = _mm256_setzero_si256(), two = _mm256_set1_epi16(2);
+  int x = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    const uint8_t *p0 = r0 + 8 * x, *p1 = r1 + 8 * x;
+    __m256 a0 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) p0));
+    __m256 b0 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) (p0 + 32)));
+    __m256 a1 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) p1));
+    __m256 b1 = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *) (p1 + 32)));
+    __m256i e0 = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m256i o0 = _mm256_castps_si256(_mm256_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m256i e1 = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m256i o1 = _mm256_castps_si256(_mm256_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(e0, zero),
+                                                   _mm256_unpacklo_epi8(o0, zero)),
+                                  _mm256_add_epi16(_mm256_unpacklo_epi8(e1, zero),
+                                                   _mm256_unpacklo_epi8(o1, zero)));
+    __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(e0, zero),
+                                                   _mm256_unpackhi_epi8(o0, zero)),
+                                  _mm256_add_epi16(_mm256_unpackhi_epi8(e1, zero),
+                                                   _mm256_unpackhi_epi8(o1, zero)));
+    __m256i p;
+
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+    p = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+    _mm256_storeu_si256((__m256i *) (dst + 4 * x), p);
+  }
+  box_row_sse2(dst + 4 * x, r0 + 8 * x, r1 + 8 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void vpass_avx2(float *dst, const float *const *rows, int n, const struct kernel *k)
+{
+  int i = 0, t;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256 acc = _mm256_setzero_ps();
+
+    for (t = 0; t < k->taps; t++)
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(k->w[t]),
+                                             _mm256_loadu_ps(rows[t] + i)));
+    _mm256_storeu_ps(dst + i, acc);
+  }
+
+  if (i < n) {
+    const float *tail[KAISER_TAPS];
+
+    for (t = 0; t < k->taps; t++)
+      tail[t] = rows[t] + i;
+    vpass_sse2(dst + i, tail, n - i, k);
+  }
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const struct mip_ops scalar_ops = { box_row_scalar, hpass_scalar, vpass_scalar };
+#ifdef HAVE_X86_SIMD
+static const struct mip_ops sse2_ops = { box_row_sse2, hpass_sse2, vpass_sse2 };
+/* A pixel is one SSE vector, so the horizontal pass gains nothing wider. */
+static const struct mip_ops avx2_ops = { box_row_avx2, hpass_sse2, vpass_avx2 };
+#endif
+
+static const struct mip_ops *ops = &scalar_ops;
+
+static void decode_row(float *dst, const uint8_t *src, int width, int flags)
+{
+  const float *color = flags & MIP_SRGB ? decode_srgb : decode_linear;
+  int x;
+
+  for (x = 0; x < width; x++) {
+    dst[4 * x] = color[src[4 * x]];
+    dst[4 * x + 1] = color[src[4 * x + 1]];
+    dst[4 * x + 2] = color[src[4 * x + 2]];
+    dst[4 * x + 3] = decode_linear[src[4 * x + 3]];
+  }
+}
+
+static inline float clampf(float v)
+{
+  return v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+}
+
+static void encode_row(uint8_t *dst, const float *src, int width, int flags)
+{
+  int i;
+
+  for (i = 0; i < 4 * width; i++) {
+    float v = clampf(src[i]);
+
+    if ((flags & MIP_SRGB) && (i & 3) != 3)
+      dst[i] = encode_srgb[(int) (v * (ENCODE_SIZE - 1) + 0.5f)];
+    else
+      dst[i] = lrintf(v * 255.0f);
+  }
+}
+
+struct mip_job {
+  struct mip_level *dst;
+  const struct mip_level *src;
+  const struct kernel *kernel;
+  int flags, bands;
+  float *scratch;     /* per band: row cache, then one decoded source row */
+  size_t scratch_size; /* floats per band */
+};
+
+/* Horizontally filtered source rows live in a small ring, keyed by row. */
+static int cache_slots(const struct kernel *k)
+{
+  return k->taps + 2;
+}
+
+static void box_rows(struct mip_job *job, int y0, int y1)
+{
+  const struct mip_level *src = job->src;
+  struct mip_level *dst = job->dst;
+  int y;
+
+  for (y = y0; y < y1; y++) {
+    const uint8_t *r0 = src->data + (size_t) clamp_index(2 * y, src->height) * src->stride;
+    const uint8_t *r1 = src->data + (size_t) clamp_index(2 * y + 1, src->height) * src->stride;
+    uint8_t *out = dst->data + (size_t) y * dst->stride;
+
+    if (src->width > 1) {
+      ops->box_row(out, r0, r1, dst->width);
+    } else {
+      /* A one pixel wide source: pair the column with itself. */
+      uint8_t p0[8], p1[8];
+
+      memcpy(p0, r0, 4);
+      memcpy(p0 + 4, r0, 4);
+      memcpy(p1, r1, 4);
+      memcpy(p1 + 4, r1, 4);
+      box_row_scalar(out, p0, p1, 1);
+    }
+  }
+}
+
+static void filter_rows(struct mip_job *job, int band, int y0, int y1)
+{
+  const struct mip_level *src = job->src;
+  struct mip_level *dst = job->dst;
+  const struct kernel *k = job->kernel;
+  int slots = cache_slots(k), n = 4 * dst->width, y, t;
+  float *cache = job->scratch + band * job->scratch_size;
+  float *decoded = cache + (size_t) (slots + 1) * n;
+  float *out = cache + (size_t) slots * n;
+  int tag[KAISER_TAPS + 2];
+
+  for (t = 0; t < slots; t++)
+    tag[t] = -1;
+
+  for (y = y0; y < y1; y++) {
+    const float *rows[KAISER_TAPS];
+
+    for (t = 0; t < k->taps; t++) {
+      int row = clamp_index(2 * y + k->offset + t, src->height), slot = row % slots;
+      float *h = cache + (size_t) slot * n;
+
+      if (tag[slot] != row) {
+        decode_row(decoded, src->data + (size_t) row * src->stride, src->width, job->flags);
+        ops->hpass(h, decoded, src->width, dst->width, k);
+        tag[slot] = row;
+      }
+      rows[t] = h;
+    }
+
+    ops->vpass(out, rows, n, k);
+    encode_row(dst->data + (size_t) y * dst->stride, out, dst->width, job->flags);
+  }
+}
+
+static void mip_band(void *data, int index, int count)
+{
+  struct mip_job *job = data;
+  int y0, y1;
+
+  pixel_band(index, count, 0, job->dst->height, job->dst->stride, &y0, &y1);
+  if (job->kernel)
+    filter_rows(job, index, y0, y1);
+  else
+    box_rows(job, y0, y1);
+}
+
+static int downsample(struct mip_level *dst, const struct mip_level *src,
+                      enum mip_filter filter, int flags, struct thread_pool *pool)
+{
+  struct mip_job job = { .dst = dst, .src = src, .flags = flags, .bands = 1 };
+
+  if (pool && (size_t) dst->width * dst->height >= MIP_BAND_MIN_PIXELS)
+    job.bands = thread_pool_size(pool);
+
+  /* Only a linear box filter can stay in integers. */
+  if (filter == MIP_FILTER_KAISER)
+    job.kernel = &kaiser_kernel;
+  else if (flags & MIP_SRGB)
+    job.kernel = &box_kernel;
+
+  if (job.kernel) {
+    /* cache rows, the vertical result, the decoded source row */
+    job.scratch_size = (size_t) (cache_slots(job.kernel) + 1) * 4 * dst->width +
+                       (size_t) 4 * src->width;
+    job.scratch = malloc(job.scratch_size * job.bands * sizeof(float));
+    if (!job.scratch)
+      return -1;
+  }
+
+  if (job.bands > 1)
+    thread_pool_run(pool, mip_band, &job, job.bands);
+  else
+    mip_band(&job, 0, 1);
+
+  free(job.scratch);
+  return 0;
+}
+
+void mip_downsample(struct mip_level *dst, const struct mip_level *src,
+                    enum mip_filter filter, int flags, struct thread_pool *pool)
+{
+  if (downsample(dst, src, filter, flags, pool) < 0) {
+    /* Out of memory for the float path: fall back to the integer box. */
+    downsample(dst, src, MIP_FILTER_BOX, flags & ~MIP_SRGB, pool);
+  }
+}
+
+int mip_chain_build(struct mip_chain *chain, const void *rgba, int width, int height,
+                    enum mip_filter filter, int flags, struct thread_pool *pool)
+{
+  size_t size = 0;
+  int i;
+
+  memset(chain, 0, sizeof *chain);
+  chain->levels = mip_level_count(width, height);
+  if (chain->levels > MIP_MAX_LEVELS)
+    return -1;
+
+  for (i = 0; i < chain->levels; i++) {
+    struct mip_level *level = &chain->level[i];
+
+    level->width = width >> i > 0 ? width >> i : 1;
+    level->height = height >> i > 0 ? height >> i : 1;
+    level->stride = (size_t) level->width * 4;
+    if (i > 0)
+      size += level->stride * level->height;
+  }
+
+  chain->level[0].data = (uint8_t *) rgba;
+  if (chain->levels == 1)
+    return 0;
+
+  chain->storage = malloc(size);
+  if (!chain->storage)
+    return -1;
+
+  size = 0;
+  for (i = 1; i < chain->levels; i++) {
+    chain->level[i].data = chain->storage + size;
+    size += chain->level[i].stride * chain->level[i].height;
+
+    if (downsample(&chain->level[i], &chain->level[i - 1], filter, flags, pool) < 0) {
+      mip_chain_release(chain);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void mip_chain_release(struct mip_chain *chain)
+{
+  free(chain->storage);
+  chain->storage = NULL;
+}
+
+enum pixel_isa mipmap_set_isa(enum pixel_isa isa)
+{
+  enum pixel_isa best = PIXEL_ISA_SCALAR;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    best = PIXEL_ISA_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    best = PIXEL_ISA_SSE2;
+#endif
+
+  if (isa == PIXEL_ISA_AUTO || isa > best)
+    isa = best;
+
+  switch (isa) {
+#ifdef HAVE_X86_SIMD
+  case PIXEL_ISA_AVX2:
+    ops = &avx2_ops;
+    break;
+  case PIXEL_ISA_SSE2:
+    ops = &sse2_ops;
+    break;
+#endif
+  default:
+    ops = &scalar_ops;
+    break;
+  }
+
+  return isa;
+}
+
+/* Zeroth order modified Bessel function of the first kind, by its series. */
+static double bessel_i0(double x)
+{
+  double sum = 1, term = 1;
+  int k;
+
+  for (k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+static void init_kaiser(struct kernel *k)
+{
+  double sum = 0, w[KAISER_TAPS];
+  int t;
+
+  for (t = 0; t < k->taps; t++) {
+    /* Distance from the destination pixel center, in destination pixels. */
+    double d = (k->offset + t - 0.5) / 2, r = d / KAISER_RADIUS;
+    double sinc = d == 0 ? 1 : sin(M_PI * d) / (M_PI * d);
+
+    w[t] = r * r < 1 ? sinc * bessel_i0(KAISER_ALPHA * sqrt(1 - r * r)) / bessel_i0(KAISER_ALPHA) : 0;
+    sum += w[t];
+  }
+
+  for (t = 0; t < k->taps; t++)
+    k->w[t] = w[t] / sum;
+}
+
+__attribute__((constructor))
+static void mipmap_init(void)
+{
+  const char *env = getenv("MIPMAP_ISA");
+  enum pixel_isa isa = PIXEL_ISA_AUTO;
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    double c = i / 255.0;
+
+    decode_linear[i] = c;
+    decode_srgb[i] = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+  }
+
+  for (i = 0; i < ENCODE_SIZE; i++) {
+    double l = (double) i / (ENCODE_SIZE - 1);
+    double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+
+    encode_srgb[i] = lrint(c * 255);
+  }
+
+  init_kaiser(&kaiser_kernel);
+
+  if (env && strcmp(env, "scalar") == 0)
+    isa = PIXEL_ISA_SCALAR;
+  else if (env && strcmp(env, "sse2") == 0)
+    isa = PIXEL_ISA_SSE2;
+  else if (env && strcmp(env, "avx2") == 0)
+    isa = PIXEL_ISA_AVX2;
+
+  mipmap_set_isa(isa);
+}
@@ -0,0 +1,72 @@
+/*
+ * CPU mip chain generation for RGBA8888 images.
+ *
+ * Each level halves the previous one (sizes round down, never below 1).
+ * Two filters are available: a 2x2 box, and an 8 tap Kaiser windowed sinc
+ * that keeps distant levels sharper without aliasing.  With MIP_SRGB the
+ * color channels are averaged in linear light, so mips of high contrast
+ * detail don't darken; alpha is always linear.  The plain box filter works
+ * on integers, everything else in float, with SSE2 and AVX2 loops and, for
+ * large levels, split in bands over a thread_pool.
+ *
+ * Used at load time by the texture cache and at preprocessing time by
+ * tools/rawtex-convert.
+ */
+
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pixel-fill.h"
+#include "thread-pool.h"
+
+#define MIP_MAX_LEVELS 16
+
+/* Color channels are sRGB encoded: filter them in linear light. */
+#define MIP_SRGB (1 << 0)
+
+enum mip_filter {
+  MIP_FILTER_BOX,
+  MIP_FILTER_KAISER,
+};
+
+struct mip_level {
+  uint8_t *data;
+  int width, height;
+  size_t stride;
+};
+
+struct mip_chain {
+  int levels;
+  struct mip_level level[MIP_MAX_LEVELS];
+  uint8_t *storage; /* levels 1 and up; level 0 is the caller's image */
+};
+
+static inline int mip_level_count(int width, int height)
+{
+  int levels = 1;
+
+  while ((width >> levels) > 0 || (height >> levels) > 0)
+    levels++;
+  return levels;
+}
+
+/* Filter |src| into |dst|, which must be half its size, rounded down. */
+void mip_downsample(struct mip_level *dst, const struct mip_level *src,
+                    enum mip_filter filter, int flags, struct thread_pool *pool);
+
+/*
+ * The full chain down to 1x1 for a tightly packed image.  |pool| may be
+ * NULL.  Returns -1 if out of memory.
+ */
+int mip_chain_build(struct mip_chain *chain, const void *rgba, int width, int height,
+                    enum mip_filter filter, int flags, struct thread_pool *pool);
+
+void mip_chain_release(struct mip_chain *chain);
+
+/* Force the loops used, like pixel_fill_set_isa(); also MIPMAP_ISA. */
+enum pixel_isa mipmap_set_isa(enum pixel_isa isa);
+
+#endif
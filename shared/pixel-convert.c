@@ -0,0 +1,762 @@
+/*
+ * Pixel format conversion loops
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pixel-convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/*
+ * YCbCr -> RGB in 6 bit fixed point, small enough for the products to fit
+ * 16 bit vector lanes.  Luma needs more precision than that: it is scaled
+ * as (y * 0x0101 * YUV_YG) >> 16, a multiply-high, with YUV_YB folding in
+ * the black level and rounding.
+ */
+#define YUV_YG 18997
+#define YUV_YB -1160
+
+struct yuv_coeffs {
+  int16_t rv, gu, gv, bu;
+};
+
+static const struct yuv_coeffs yuv_coeffs[] = {
+  [YUV_BT601] = { 102, 25, 52, 129 },
+  [YUV_BT709] = { 115, 14, 34, 135 },
+};
+
+struct convert_ops {
+  void (*rgb_to_rgba)(uint8_t *dst, const uint8_t *src, size_t n);
+  void (*rgb_to_argb)(uint32_t *dst, const uint8_t *src, size_t n);
+  void (*swap_rb)(uint32_t *dst, const uint32_t *src, size_t n);
+  void (*premultiply)(uint32_t *dst, const uint32_t *src, size_t n);
+  void (*unpremultiply)(uint32_t *dst, const uint32_t *src, size_t n);
+  void (*argb_to_rgb565)(uint16_t *dst, const uint32_t *src, size_t n);
+  void (*rgb565_to_argb)(uint32_t *dst, const uint16_t *src, size_t n);
+  void (*yuv_row)(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                  int width, const struct yuv_coeffs *k);
+  void (*nv12_row)(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+                   int width, const struct yuv_coeffs *k);
+};
+
+/*
+ * Scalar loops.  These define the results, including the rounding and the
+ * 16 bit saturation of the YCbCr math, which the vector loops reproduce.
+ */
+
+static void rgb_to_rgba_scalar(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    dst[4 * i] = src[3 * i];
+    dst[4 * i + 1] = src[3 * i + 1];
+    dst[4 * i + 2] = src[3 * i + 2];
+    dst[4 * i + 3] = 0xff;
+  }
+}
+
+static void rgb_to_argb_scalar(uint32_t *dst, const uint8_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = 0xff000000 | (uint32_t) src[3 * i] << 16 | src[3 * i + 1] << 8 | src[3 * i + 2];
+}
+
+static void swap_rb_scalar(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t p = src[i];
+
+    dst[i] = (p & 0xff00ff00) | (p >> 16 & 0xff) | (p & 0xff) << 16;
+  }
+}
+
+/* c * a / 255, rounded, exactly. */
+static inline uint32_t mul255(uint32_t c, uint32_t a)
+{
+  uint32_t t = c * a + 128;
+
+  return (t + (t >> 8)) >> 8;
+}
+
+static void premultiply_scalar(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t p = src[i], a = p >> 24;
+
+    dst[i] = a << 24 | mul255(p >> 16 & 0xff, a) << 16 |
+             mul255(p >> 8 & 0xff, a) << 8 | mul255(p & 0xff, a);
+  }
+}
+
+static inline uint32_t unmul(uint32_t c, float scale)
+{
+  float f = c * scale;
+
+  return lrintf(f < 255.0f ? f : 255.0f);
+}
+
+static void unpremultiply_scalar(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t p = src[i], a = p >> 24;
+    float scale;
+
+    if (a == 0) {
+      dst[i] = 0;
+      continue;
+    }
+
+    scale = 255.0f / a;
+    dst[i] = a << 24 | unmul(p >> 16 & 0xff, scale) << 16 |
+             unmul(p >> 8 & 0xff, scale) << 8 | unmul(p & 0xff, scale);
+  }
+}
+
+static void argb_to_rgb565_scalar(uint16_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t p = src[i];
+
+    dst[i] = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+  }
+}
+
+static void rgb565_to_argb_scalar(uint32_t *dst, const uint16_t *src, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    uint32_t p = src[i];
+    uint32_t r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+
+    dst[i] = 0xff000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+  }
+}
+
+static inline int sat16(int v)
+{
+  return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+static inline uint32_t clamp8(int v)
+{
+  v >>= 6;
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static inline uint32_t yuv_pixel(int y, int u, int v, const struct yuv_coeffs *k)
+{
+  int yy = (int) ((y * 0x0101u * YUV_YG) >> 16) + YUV_YB;
+  int r, g, b;
+
+  u -= 128;
+  v -= 128;
+  r = sat16(yy + v * k->rv);
+  g = sat16(sat16(yy - u * k->gu) - v * k->gv);
+  b = sat16(yy + u * k->bu);
+
+  return 0xff000000 | clamp8(r) << 16 | clamp8(g) << 8 | clamp8(b);
+}
+
+static void yuv_row_scalar(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                           int width, const struct yuv_coeffs *k)
+{
+  int x;
+
+  for (x = 0; x < width; x++)
+    dst[x] = yuv_pixel(y[x], u[x / 2], v[x / 2], k);
+}
+
+static void nv12_row_scalar(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+                            int width, const struct yuv_coeffs *k)
+{
+  int x;
+
+  for (x = 0; x < width; x++)
+    dst[x] = yuv_pixel(y[x], uv[x / 2 * 2], uv[x / 2 * 2 + 1], k);
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * SSE2 and SSSE3 loops.  Each handles whole vectors and leaves the tail to
+ * the scalar loop.
+ */
+
+#define SHUFFLE_RGB_TO_RGBA 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+#define SHUFFLE_RGB_TO_BGRA 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1
+#define SHUFFLE_SWAP_RB 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+
+/* 4 pixels per 16 byte load, of which only 12 bytes are used. */
+#define DEFINE_RGB_SSSE3(name, SHUFFLE, type)                                 \
+__attribute__((target("ssse3")))                                              \
+static void name##_ssse3(type *dst, const uint8_t *src, size_t n)             \
+{                                                                             \
+  const __m128i shuffle = _mm_setr_epi8(SHUFFLE);                             \
+  const __m128i alpha = _mm_set1_epi32(0xff000000);                           \
+  size_t i = 0;                                                               \
+                                                                              \
+  for (; i + 6 <= n; i += 4) {                                                \
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + 3 * i));             \
+                                                                              \
+    _mm_storeu_si128((__m128i *) ((uint8_t *) dst + 4 * i),                   \
+                     _mm_or_si128(_mm_shuffle_epi8(x, shuffle), alpha));      \
+  }                                                                           \
+  name##_scalar((type *) ((uint8_t *) dst + 4 * i), src + 3 * i, n - i);      \
+}
+
+DEFINE_RGB_SSSE3(rgb_to_rgba, SHUFFLE_RGB_TO_RGBA, uint8_t)
+DEFINE_RGB_SSSE3(rgb_to_argb, SHUFFLE_RGB_TO_BGRA, uint32_t)
+
+__attribute__((target("ssse3")))
+static void swap_rb_ssse3(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m128i shuffle = _mm_setr_epi8(SHUFFLE_SWAP_RB);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi8(x, shuffle));
+  }
+  swap_rb_scalar(dst + i, src + i, n - i);
+}
+
+/* Two pixels as 16 bit channels, each multiplied by its alpha. */
+static inline __m128i mul255_sse2(__m128i c)
+{
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, 0xff), 0xff);
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void premultiply_sse2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i lo = mul255_sse2(_mm_unpacklo_epi8(x, zero));
+    __m128i hi = mul255_sse2(_mm_unpackhi_epi8(x, zero));
+    __m128i p = _mm_packus_epi16(lo, hi);
+
+    _mm_storeu_si128((__m128i *) (dst + i),
+                     _mm_or_si128(_mm_andnot_si128(alpha, p), _mm_and_si128(x, alpha)));
+  }
+  premultiply_scalar(dst + i, src + i, n - i);
+}
+
+/* One pixel as 32 bit channels.  Alpha 0 gives 0, like the scalar loop. */
+static inline __m128i unmul_sse2(__m128i c)
+{
+  __m128 f = _mm_cvtepi32_ps(c);
+  __m128 a = _mm_shuffle_ps(f, f, 0xff);
+  __m128 scale = _mm_div_ps(_mm_set1_ps(255.0f), a);
+  __m128 r = _mm_min_ps(_mm_mul_ps(f, scale), _mm_set1_ps(255.0f));
+
+  return _mm_cvtps_epi32(_mm_and_ps(r, _mm_cmpneq_ps(a, _mm_setzero_ps())));
+}
+
+/* Division bound, so there is no AVX2 version. */
+static void unpremultiply_sse2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  size_t i = 0;
+
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i lo = _mm_unpacklo_epi8(x, zero), hi = _mm_unpackhi_epi8(x, zero);
+    __m128i p01 = _mm_packs_epi32(unmul_sse2(_mm_unpacklo_epi16(lo, zero)),
+                                  unmul_sse2(_mm_unpackhi_epi16(lo, zero)));
+    __m128i p23 = _mm_packs_epi32(unmul_sse2(_mm_unpacklo_epi16(hi, zero)),
+                                  unmul_sse2(_mm_unpackhi_epi16(hi, zero)));
+    __m128i p = _mm_packus_epi16(p01, p23);
+
+    _mm_storeu_si128((__m128i *) (dst + i),
+                     _mm_or_si128(_mm_andnot_si128(alpha, p), _mm_and_si128(x, alpha)));
+  }
+  unpremultiply_scalar(dst + i, src + i, n - i);
+}
+
+/* RGB565 in the low half of each 32 bit lane, sign extended for packs. */
+static inline __m128i to_rgb565_sse2(__m128i p)
+{
+  __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+  __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+
+  return _mm_srai_epi32(_mm_slli_epi32(_mm_or_si128(_mm_or_si128(r, g), b), 16), 16);
+}
+
+static void argb_to_rgb565_sse2(uint16_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = to_rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i)));
+    __m128i b = to_rgb565_sse2(_mm_loadu_si128((const __m128i *) (src + i + 4)));
+
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(a, b));
+  }
+  argb_to_rgb565_scalar(dst + i, src + i, n - i);
+}
+
+/* Store 8 pixels given as 16 bit channels, clamping them to 0..255. */
+static inline void store_argb_sse2(uint32_t *dst, __m128i b, __m128i g, __m128i r)
+{
+  __m128i br = _mm_packus_epi16(b, r);
+  __m128i ga = _mm_packus_epi16(g, _mm_set1_epi16(255));
+  __m128i bg = _mm_unpacklo_epi8(br, ga);
+  __m128i ra = _mm_unpackhi_epi8(br, ga);
+
+  _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+  _mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+/* Expand 5 and 6 bit channels by replicating their top bits. */
+#define RGB565_CHANNELS(SIMD, SI, p, r, g, b)                                 \
+  do {                                                                        \
+    r = SIMD##_or_##SI(SIMD##_and_##SI(SIMD##_srli_epi16(p, 8), SIMD##_set1_epi16(0xf8)), \
+                       SIMD##_srli_epi16(p, 13));                            \
+    g = SIMD##_or_##SI(SIMD##_and_##SI(SIMD##_srli_epi16(p, 3), SIMD##_set1_epi16(0xfc)), \
+                       SIMD##_and_##SI(SIMD##_srli_epi16(p, 9), SIMD##_set1_epi16(3))); \
+    b = SIMD##_or_##SI(SIMD##_and_##SI(SIMD##_slli_epi16(p, 3), SIMD##_set1_epi16(0xf8)), \
+                       SIMD##_and_##SI(SIMD##_srli_epi16(p, 2), SIMD##_set1_epi16(7))); \
+  } while (0)
+
+static void rgb565_to_argb_sse2(uint32_t *dst, const uint16_t *src, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i p = _mm_loadu_si128((const __m128i *) (src + i));
+    __m128i r, g, b;
+
+    RGB565_CHANNELS(_mm, si128, p, r, g, b);
+    store_argb_sse2(dst + i, b, g, r);
+  }
+  rgb565_to_argb_scalar(dst + i, src + i, n - i);
+}
+
+/*
+ * 8 pixels of YCbCr as 16 bit lanes: y replicated into both bytes, u and
+ * v centered and replicated per pixel.  Same operations, in the same order, as yuv_pixel().
+ */
+static inline void yuv8_sse2(uint32_t *dst, __m128i y, __m128i u, __m128i v,
+                             const struct yuv_coeffs *k)
+{
+  __m128i yy = _mm_add_epi16(_mm_mulhi_epu16(y, _mm_set1_epi16(YUV_YG)),
+                             _mm_set1_epi16(YUV_YB));
+  __m128i r = _mm_adds_epi16(yy, _mm_mullo_epi16(v, _mm_set1_epi16(k->rv)));
+  __m128i g = _mm_subs_epi16(_mm_subs_epi16(yy, _mm_mullo_epi16(u, _mm_set1_epi16(k->gu))),
+                             _mm_mullo_epi16(v, _mm_set1_epi16(k->gv)));
+  __m128i b = _mm_adds_epi16(yy, _mm_mullo_epi16(u, _mm_set1_epi16(k->bu)));
+
+  store_argb_sse2(dst, _mm_srai_epi16(b, 6), _mm_srai_epi16(g, 6), _mm_srai_epi16(r, 6));
+}
+
+/* 4 chroma bytes -> 8 centered 16 bit lanes, each value twice. */
+static inline __m128i chroma4_sse2(const uint8_t *c)
+{
+  uint32_t w;
+  __m128i x;
+
+  memcpy(&w, c, sizeof w);
+  x = _mm_unpacklo_epi8(_mm_cvtsi32_si128(w), _mm_setzero_si128());
+  return _mm_sub_epi16(_mm_unpacklo_epi16(x, x), _mm_set1_epi16(128));
+}
+
+/* 4 interleaved CbCr pairs as 16 bit lanes -> centered, replicated u, v. */
+static inline void split_uv_sse2(__m128i uv, __m128i *u, __m128i *v)
+{
+  const __m128i low = _mm_set1_epi32(0xffff);
+
+  *u = _mm_or_si128(_mm_slli_epi32(uv, 16), _mm_and_si128(uv, low));
+  *v = _mm_or_si128(_mm_srli_epi32(uv, 16), _mm_andnot_si128(low, uv));
+  *u = _mm_sub_epi16(*u, _mm_set1_epi16(128));
+  *v = _mm_sub_epi16(*v, _mm_set1_epi16(128));
+}
+
+static void yuv_row_sse2(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                         int width, const struct yuv_coeffs *k)
+{
+  int x = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    __m128i l = _mm_loadl_epi64((const __m128i *) (y + x));
+    __m128i yy = _mm_unpacklo_epi8(l, l);
+
+    yuv8_sse2(dst + x, yy, chroma4_sse2(u + x / 2), chroma4_sse2(v + x / 2), k);
+  }
+  yuv_row_scalar(dst + x, y + x, u + x / 2, v + x / 2, width - x, k);
+}
+
+static void nv12_row_sse2(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+                          int width, const struct yuv_coeffs *k)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+
+  for (; x + 8 <= width; x += 8) {
+    __m128i l = _mm_loadl_epi64((const __m128i *) (y + x));
+    __m128i yy = _mm_unpacklo_epi8(l, l);
+    __m128i c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (uv + x)), zero);
+    __m128i cu, cv;
+
+    split_uv_sse2(c, &cu, &cv);
+    yuv8_sse2(dst + x, yy, cu, cv, k);
+  }
+  nv12_row_scalar(dst + x, y + x, uv + x, width - x, k);
+}
+
+/*
+ * AVX2 loops: the same math on twice the pixels.  Tails go to the SSSE3
+ * loops, which every AVX2 CPU can run.
+ */
+
+#define DEFINE_RGB_AVX2(name, SHUFFLE, type)                                  \
+__attribute__((target("avx2")))                                               \
+static void name##_avx2(type *dst, const uint8_t *src, size_t n)              \
+{                                                                             \
+  const __m256i shuffle = _mm256_setr_epi8(SHUFFLE, SHUFFLE);                 \
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);                        \
+  size_t i = 0;                                                               \
+                                                                              \
+  for (; i + 10 <= n; i += 8) {                                               \
+    const uint8_t *s = src + 3 * i;                                           \
+    __m256i x = _mm256_inserti128_si256(                                      \
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) s)),           \
+      _mm_loadu_si128((const __m128i *) (s + 12)), 1);                        \
+                                                                              \
+    _mm256_storeu_si256((__m256i *) ((uint8_t *) dst + 4 * i),                \
+                        _mm256_or_si256(_mm256_shuffle_epi8(x, shuffle), alpha)); \
+  }                                                                           \
+  name##_ssse3((type *) ((uint8_t *) dst + 4 * i), src + 3 * i, n - i);       \
+}
+
+DEFINE_RGB_AVX2(rgb_to_rgba, SHUFFLE_RGB_TO_RGBA, uint8_t)
+DEFINE_RGB_AVX2(rgb_to_argb, SHUFFLE_RGB_TO_BGRA, uint32_t)
+
+__attribute__((target("avx2")))
+static void swap_rb_avx2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m256i shuffle = _mm256_setr_epi8(SHUFFLE_SWAP_RB, SHUFFLE_SWAP_RB);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (src + i));
+
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_shuffle_epi8(x, shuffle));
+  }
+  swap_rb_ssse3(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul255_avx2(__m256i c)
+{
+  __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(c, 0xff), 0xff);
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(c, a), _mm256_set1_epi16(128));
+
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void premultiply_avx2(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+  size_t i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i lo = mul255_avx2(_mm256_unpacklo_epi8(x, zero));
+    __m256i hi = mul255_avx2(_mm256_unpackhi_epi8(x, zero));
+    __m256i p = _mm256_packus_epi16(lo, hi);
+
+    _mm256_storeu_si256((__m256i *) (dst + i),
+                        _mm256_or_si256(_mm256_andnot_si256(alpha, p),
+                                        _mm256_and_si256(x, alpha)));
+  }
+  premultiply_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i to_rgb565_avx2(__m256i p)
+{
+  __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+  __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+
+  return _mm256_srai_epi32(_mm256_slli_epi32(_mm256_or_si256(_mm256_or_si256(r, g), b), 16), 16);
+}
+
+__attribute__((target("avx2")))
+static void argb_to_rgb565_avx2(uint16_t *dst, const uint32_t *src, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m256i a = to_rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i)));
+    __m256i b = to_rgb565_avx2(_mm256_loadu_si256((const __m256i *) (src + i + 8)));
+
+    /* packs works within 128 bit lanes, put the quarters back in order. */
+    _mm256_storeu_si256((__m256i *) (dst + i),
+                        _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+  }
+  argb_to_rgb565_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline void store_argb_avx2(uint32_t *dst, __m256i b, __m256i g, __m256i r)
+{
+  __m256i br = _mm256_packus_epi16(b, r);
+  __m256i ga = _mm256_packus_epi16(g, _mm256_set1_epi16(255));
+  __m256i bg = _mm256_unpacklo_epi8(br, ga);
+  __m256i ra = _mm256_unpackhi_epi8(br, ga);
+  __m256i lo = _mm256_unpacklo_epi16(bg, ra); /* pixels 0-3, 8-11 */
+  __m256i hi = _mm256_unpackhi_epi16(bg, ra); /* pixels 4-7, 12-15 */
+
+  _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256((__m256i *) (dst + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+__attribute__((target("avx2")))
+static void rgb565_to_argb_avx2(uint32_t *dst, const uint16_t *src, size_t n)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m256i p = _mm256_loadu_si256((const __m256i *) (src + i));
+    __m256i r, g, b;
+
+    RGB565_CHANNELS(_mm256, si256, p, r, g, b);
+    store_argb_avx2(dst + i, b, g, r);
+  }
+  rgb565_to_argb_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline void yuv16_avx2(uint32_t *dst, __m256i y, __m256i u, __m256i v,
+                              const struct yuv_coeffs *k)
+{
+  __m256i yy = _mm256_add_epi16(_mm256_mulhi_epu16(y, _mm256_set1_epi16(YUV_YG)),
+                                _mm256_set1_epi16(YUV_YB));
+  __m256i r = _mm256_adds_epi16(yy, _mm256_mullo_epi16(v, _mm256_set1_epi16(k->rv)));
+  __m256i g = _mm256_subs_epi16(_mm256_subs_epi16(yy, _mm256_mullo_epi16(u, _mm256_set1_epi16(k->gu))),
+                                _mm256_mullo_epi16(v, _mm256_set1_epi16(k->gv)));
+  __m256i b = _mm256_adds_epi16(yy, _mm256_mullo_epi16(u, _mm256_set1_epi16(k->bu)));
+
+  store_argb_avx2(dst, _mm256_srai_epi16(b, 6), _mm256_srai_epi16(g, 6), _mm256_srai_epi16(r, 6));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i combine_avx2(__m128i lo, __m128i hi)
+{
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+__attribute__((target("avx2")))
+static void yuv_row_avx2(uint32_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                         int width, const struct yuv_coeffs *k)
+{
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x)));
+    __m256i yy = _mm256_or_si256(l, _mm256_slli_epi16(l, 8));
+    __m256i cu = combine_avx2(chroma4_sse2(u + x / 2), chroma4_sse2(u + x / 2 + 4));
+    __m256i cv = combine_avx2(chroma4_sse2(v + x / 2), chroma4_sse2(v + x / 2 + 4));
+
+    yuv16_avx2(dst + x, yy, cu, cv, k);
+  }
+  yuv_row_sse2(dst + x, y + x, u + x / 2, v + x / 2, width - x, k);
+}
+
+__attribute__((target("avx2")))
+static void nv12_row_avx2(uint32_t *dst, const uint8_t *y, const uint8_t *uv,
+                          int width, const struct yuv_coeffs *k)
+{
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+
+  for (; x + 16 <= width; x += 16) {
+    __m256i l = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (y + x)));
+    __m256i yy = _mm256_or_si256(l, _mm256_slli_epi16(l, 8));
+    __m128i c = _mm_loadu_si128((const __m128i *) (uv + x));
+    __m128i u0, v0, u1, v1;
+
+    split_uv_sse2(_mm_unpacklo_epi8(c, zero), &u0, &v0);
+    split_uv_sse2(_mm_unpackhi_epi8(c, zero), &u1, &v1);
+    yuv16_avx2(dst + x, yy, combine_avx2(u0, u1), combine_avx2(v0, v1), k);
+  }
+  nv12_row_sse2(dst + x, y + x, uv + x, width - x, k);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const struct convert_ops scalar_ops = {
+  rgb_to_rgba_scalar, rgb_to_argb_scalar, swap_rb_scalar,
+  premultiply_scalar, unpremultiply_scalar,
+  argb_to_rgb565_scalar, rgb565_to_argb_scalar,
+  yuv_row_scalar, nv12_row_scalar,
+};
+
+#ifdef HAVE_X86_SIMD
+static const struct convert_ops sse2_ops = {
+  rgb_to_rgba_scalar, rgb_to_argb_scalar, swap_rb_scalar,
+  premultiply_sse2, unpremultiply_sse2,
+  argb_to_rgb565_sse2, rgb565_to_argb_sse2,
+  yuv_row_sse2, nv12_row_sse2,
+};
+
+static const struct convert_ops ssse3_ops = {
+  rgb_to_rgba_ssse3, rgb_to_argb_ssse3, swap_rb_ssse3,
+  premultiply_sse2, unpremultiply_sse2,
+  argb_to_rgb565_sse2, rgb565_to_argb_sse2,
+  yuv_row_sse2, nv12_row_sse2,
+};
+
+static const struct convert_ops avx2_ops = {
+  rgb_to_rgba_avx2, rgb_to_argb_avx2, swap_rb_avx2,
+  premultiply_avx2, unpremultiply_sse2,
+  argb_to_rgb565_avx2, rgb565_to_argb_avx2,
+  yuv_row_avx2, nv12_row_avx2,
+};
+#endif
+
+static const struct convert_ops *ops = &scalar_ops;
+
+enum pixel_isa pixel_convert_set_isa(enum pixel_isa isa)
+{
+  enum pixel_isa best = PIXEL_ISA_SCALAR;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    best = PIXEL_ISA_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    best = PIXEL_ISA_SSE2;
+#endif
+
+  if (isa == PIXEL_ISA_AUTO || isa > best)
+    isa = best;
+
+  switch (isa) {
+#ifdef HAVE_X86_SIMD
+  case PIXEL_ISA_AVX2:
+    ops = &avx2_ops;
+    break;
+  case PIXEL_ISA_SSE2:
+    ops = __builtin_cpu_supports("ssse3") ? &ssse3_ops : &sse2_ops;
+    break;
+#endif
+  default:
+    ops = &scalar_ops;
+    break;
+  }
+
+  return isa;
+}
+
+__attribute__((constructor))
+static void pixel_convert_init(void)
+{
+  const char *env = getenv("PIXEL_CONVERT_ISA");
+  enum pixel_isa isa = PIXEL_ISA_AUTO;
+
+  if (env && strcmp(env, "scalar") == 0)
+    isa = PIXEL_ISA_SCALAR;
+  else if (env && strcmp(env, "sse2") == 0)
+    isa = PIXEL_ISA_SSE2;
+  else if (env && strcmp(env, "avx2") == 0)
+    isa = PIXEL_ISA_AVX2;
+
+  pixel_convert_set_isa(isa);
+}
+
+void pixel_convert_rgb_to_rgba(void *dst, const void *src, size_t n)
+{
+  ops->rgb_to_rgba(dst, src, n);
+}
+
+void pixel_convert_rgb_to_argb(uint32_t *dst, const void *src, size_t n)
+{
+  ops->rgb_to_argb(dst, src, n);
+}
+
+void pixel_convert_swap_rb(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  ops->swap_rb(dst, src, n);
+}
+
+void pixel_convert_premultiply(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  ops->premultiply(dst, src, n);
+}
+
+void pixel_convert_unpremultiply(uint32_t *dst, const uint32_t *src, size_t n)
+{
+  ops->unpremultiply(dst, src, n);
+}
+
+void pixel_convert_argb_to_rgb565(uint16_t *dst, const uint32_t *src, size_t n)
+{
+  ops->argb_to_rgb565(dst, src, n);
+}
+
+void pixel_convert_rgb565_to_argb(uint32_t *dst, const uint16_t *src, size_t n)
+{
+  ops->rgb565_to_argb(dst, src, n);
+}
+
+void pixel_convert_yuv420_to_argb(uint32_t *dst, int dst_stride,
+                                  const uint8_t *y, int y_stride,
+                                  const uint8_t *u, const uint8_t *v, int uv_stride,
+                                  int width, int height, enum yuv_matrix matrix)
+{
+  const struct yuv_coeffs *k = &yuv_coeffs[matrix];
+  int row;
+
+  for (row = 0; row < height; row++)
+    ops->yuv_row((uint32_t *) ((uint8_t *) dst + (size_t) row * dst_stride),
+                 y + (size_t) row * y_stride,
+                 u + (size_t) (row / 2) * uv_stride, v + (size_t) (row / 2) * uv_stride,
+                 width, k);
+}
+
+void pixel_convert_nv12_to_argb(uint32_t *dst, int dst_stride,
+                                const uint8_t *y, int y_stride,
+                                const uint8_t *uv, int uv_stride,
+                                int width, int height, enum yuv_matrix matrix)
+{
+  const struct yuv_coeffs *k = &yuv_coeffs[matrix];
+  int row;
+
+  for (row = 0; row < height; row++)
+    ops->nv12_row((uint32_t *) ((uint8_t *) dst + (size_t) row * dst_stride),
+                  y + (size_t) row * y_stride, uv + (size_t) (row / 2) * uv_stride,
+                  width, k);
+}
@@ -0,0 +1,68 @@
+/*
+ * Pixel format conversions for image loaders and the SHM path.
+ *
+ * Byte order names (RGB, RGBA, BGRA) describe bytes in memory, the way GL
+ * upload formats do.  ARGB8888 is the wl_shm format, a native endian 32
+ * bit value, i.e. BGRA bytes on little endian machines.  Every conversion
+ * has scalar and SSE loops, and all but unpremultiply have AVX2 ones; the
+ * scalar loops define the results and the vector loops match them bit for
+ * bit.
+ *
+ * Row conversions take a pixel count and may run in place when source and
+ * destination pixels have the same size.
+ */
+
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pixel-fill.h"
+
+/* YCbCr matrices, limited (video) range. */
+enum yuv_matrix {
+  YUV_BT601,
+  YUV_BT709,
+};
+
+/* RGB -> RGBA bytes with opaque alpha, for GL_RGBA uploads. */
+void pixel_convert_rgb_to_rgba(void *dst, const void *src, size_t n);
+
+/* RGB bytes -> opaque ARGB8888. */
+void pixel_convert_rgb_to_argb(uint32_t *dst, const void *src, size_t n);
+
+/* Swap the red and blue bytes: RGBA <-> BGRA, i.e. GL_RGBA <-> ARGB8888. */
+void pixel_convert_swap_rb(uint32_t *dst, const uint32_t *src, size_t n);
+
+/* Straight to premultiplied alpha and back, alpha in the top byte. */
+void pixel_convert_premultiply(uint32_t *dst, const uint32_t *src, size_t n);
+void pixel_convert_unpremultiply(uint32_t *dst, const uint32_t *src, size_t n);
+
+/* ARGB8888 <-> RGB565.  Alpha is dropped, or set opaque. */
+void pixel_convert_argb_to_rgb565(uint16_t *dst, const uint32_t *src, size_t n);
+void pixel_convert_rgb565_to_argb(uint32_t *dst, const uint16_t *src, size_t n);
+
+/*
+ * 4:2:0 YCbCr -> opaque ARGB8888, from three planes (I420, or YV12 with
+ * |u| and |v| swapped) or from a Y plane and an interleaved CbCr plane
+ * (NV12).  Chroma is replicated over each 2x2 block.  Strides are in bytes.
+ */
+void pixel_convert_yuv420_to_argb(uint32_t *dst, int dst_stride,
+                                  const uint8_t *y, int y_stride,
+                                  const uint8_t *u, const uint8_t *v, int uv_stride,
+                                  int width, int height, enum yuv_matrix matrix);
+
+void pixel_convert_nv12_to_argb(uint32_t *dst, int dst_stride,
+                                const uint8_t *y, int y_stride,
+                                const uint8_t *uv, int uv_stride,
+                                int width, int height, enum yuv_matrix matrix);
+
+/*
+ * Force the loops used, like pixel_fill_set_isa().  PIXEL_ISA_SSE2 also
+ * uses SSSE3 byte shuffles when the CPU has them.  The default is the best
+ * supported, overridable with PIXEL_CONVERT_ISA=scalar|sse2|avx2.
+ */
+enum pixel_isa pixel_convert_set_isa(enum pixel_isa isa);
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ * Pixel fill kernels
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pixel-fill.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define DEFAULT_LLC_SIZE (8 * 1024 * 1024)
+
+/*
+ * Store loops.  |fill| repeats a 32 bit pattern over |bytes| bytes, |copy|
+ * is a plain memcpy.  Both expect |dst| aligned to the pixel size and
+ * |bytes| a multiple of it.  For 16 bit pixels the pattern holds two
+ * (possibly different) pixels, the low half going to |dst|.
+ */
+struct store_ops {
+  void (*fill)(void *dst, uint32_t pattern, size_t bytes);
+  void (*copy)(void *dst, const void *src, size_t bytes);
+  int non_temporal;
+};
+
+static void fill_scalar(void *dst, uint32_t pattern, size_t bytes)
+{
+  uint32_t *p = dst;
+  size_t i, n;
+
+  /* 16 bit pixels may start half way into a word. */
+  if (((uintptr_t) p & 2) && bytes >= 2) {
+    *(uint16_t *) p = pattern;
+    pattern = pattern >> 16 | pattern << 16;
+    p = (uint32_t *) ((uint8_t *) p + 2);
+    bytes -= 2;
+  }
+
+  n = bytes / 4;
+
+  for (i = 0; i < n; i++)
+    p[i] = pattern;
+  if (bytes & 2)
+    *(uint16_t *) (p + n) = pattern;
+}
+
+static void copy_scalar(void *dst, const void *src, size_t bytes)
+{
+  memcpy(dst, src, bytes);
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Write the unaligned head with scalar stores so that the vector loop can
+ * use aligned (and streaming) stores.  A head of an odd number of 16 bit
+ * pixels shifts the phase of |*pattern|, which is rotated to match.
+ */
+static size_t fill_head(uint8_t **dst, uint32_t *pattern, size_t bytes, size_t align)
+{
+  size_t head = (align - ((uintptr_t) *dst & (align - 1))) & (align - 1);
+
+  if (head > bytes)
+    head = bytes;
+  fill_scalar(*dst, *pattern, head);
+  *dst += head;
+  if (head & 2)
+    *pattern = *pattern >> 16 | *pattern << 16;
+
+  return bytes - head;
+}
+
+#define DEFINE_SSE2_OPS(suffix, STORE, FENCE)                                 \
+static void fill_sse2##suffix(void *dst, uint32_t pattern, size_t bytes)      \
+{                                                                             \
+  uint8_t *p = dst;                                                           \
+  __m128i v;                                                                  \
+                                                                              \
+  bytes = fill_head(&p, &pattern, bytes, 16);                                 \
+  v = _mm_set1_epi32(pattern);                                                \
+  for (; bytes >= 64; bytes -= 64, p += 64) {                                 \
+    STORE((__m128i *) p, v);                                                  \
+    STORE((__m128i *) (p + 16), v);                                           \
+    STORE((__m128i *) (p + 32), v);                                           \
+    STORE((__m128i *) (p + 48), v);                                           \
+  }                                                                           \
+  for (; bytes >= 16; bytes -= 16, p += 16)                                   \
+    STORE((__m128i *) p, v);                                                  \
+  fill_scalar(p, pattern, bytes);                                             \
+  FENCE;                                                                      \
+}                                                                             \
+                                                                              \
+static void copy_sse2##suffix(void *dst, const void *src, size_t bytes)       \
+{                                                                             \
+  uint8_t *p = dst;                                                           \
+  const uint8_t *s = src;                                                     \
+  size_t head = (16 - ((uintptr_t) p & 15)) & 15;                             \
+                                                                              \
+  if (head > bytes)                                                           \
+    head = bytes;                                                             \
+  memcpy(p, s, head);                                                         \
+  p += head, s += head, bytes -= head;                                        \
+  for (; bytes >= 64; bytes -= 64, p += 64, s += 64) {                        \
+    __m128i a = _mm_loadu_si128((const __m128i *) s);                         \
+    __m128i b = _mm_loadu_si128((const __m128i *) (s + 16));                  \
+    __m128i c = _mm_loadu_si128((const __m128i *) (s + 32));                  \
+    __m128i d = _mm_loadu_si128((const __m128i *) (s + 48));                  \
+    STORE((__m128i *) p, a);                                                  \
+    STORE((__m128i *) (p + 16), b);                                           \
+    STORE((__m128i *) (p + 32), c);                                           \
+    STORE((__m128i *) (p + 48), d);                                           \
+  }                                                                           \
+  for (; bytes >= 16; bytes -= 16, p += 16, s += 16)                          \
+    STORE((__m128i *) p, _mm_loadu_si128((const __m128i *) s));               \
+  memcpy(p, s, bytes);                                                        \
+  FENCE;                                                                      \
+}
+
+DEFINE_SSE2_OPS(, _mm_store_si128, (void) 0)
+DEFINE_SSE2_OPS(_nt, _mm_stream_si128, _mm_sfence())
+
+#define DEFINE_AVX2_OPS(suffix, STORE, FENCE)                                 \
+__attribute__((target("avx2")))                                               \
+static void fill_avx2##suffix(void *dst, uint32_t pattern, size_t bytes)      \
+{                                                                             \
+  uint8_t *p = dst;                                                           \
+  __m256i v;                                                                  \
+                                                                              \
+  bytes = fill_head(&p, &pattern, bytes, 32);                                 \
+  v = _mm256_set1_epi32(pattern);                                             \
+  for (; bytes >= 128; bytes -= 128, p += 128) {                              \
+    STORE((__m256i *) p, v);                                                  \
+    STORE((__m256i *) (p + 32), v);                                           \
+    STORE((__m256i *) (p + 64), v);                                           \
+    STORE((__m256i *) (p + 96), v);                                           \
+  }                                                                           \
+  for (; bytes >= 32; bytes -= 32, p += 32)                                   \
+    STORE((__m256i *) p, v);                                                  \
+  fill_scalar(p, pattern, bytes);                                             \
+  FENCE;                                                                      \
+}                                                                             \
+                                                                              \
+__attribute__((target("avx2")))                                               \
+static void copy_avx2##suffix(void *dst, const void *src, size_t bytes)       \
+{                                                                             \
+  uint8_t *p = dst;                                                           \
+  const uint8_t *s = src;                                                     \
+  size_t head = (32 - ((uintptr_t) p & 31)) & 31;                             \
+                                                                              \
+  if (head > bytes)                                                           \
+    head = bytes;                                                             \
+  memcpy(p, s, head);                                                         \
+  p += head, s += head, bytes -= head;                                        \
+  for (; bytes >= 128; bytes -= 128, p += 128, s += 128) {                    \
+    __m256i a = _mm256_loadu_si256((const __m256i *) s);                      \
+    __m256i b = _mm256_loadu_si256((const __m256i *) (s + 32));               \
+    __m256i c = _mm256_loadu_si256((const __m256i *) (s + 64));               \
+    __m256i d = _mm256_loadu_si256((const __m256i *) (s + 96));               \
+    STORE((__m256i *) p, a);                                                  \
+    STORE((__m256i *) (p + 32), b);                                           \
+    STORE((__m256i *) (p + 64), c);                                           \
+    STORE((__m256i *) (p + 96), d);                                           \
+  }                                                                           \
+  for (; bytes >= 32; bytes -= 32, p += 32, s += 32)                          \
+    STORE((__m256i *) p, _mm256_loadu_si256((const __m256i *) s));            \
+  memcpy(p, s, bytes);                                                        \
+  FENCE;                                                                      \
+}
+
+DEFINE_AVX2_OPS(, _mm256_store_si256, (void) 0)
+DEFINE_AVX2_OPS(_nt, _mm256_stream_si256, _mm_sfence())
+
+#endif /* HAVE_X86_SIMD */
+
+static const struct store_ops scalar_ops = { fill_scalar, copy_scalar, 0 };
+#ifdef HAVE_X86_SIMD
+static const struct store_ops sse2_ops = { fill_sse2, copy_sse2, 0 };
+static const struct store_ops sse2_nt_ops = { fill_sse2_nt, copy_sse2_nt, 1 };
+static const struct store_ops avx2_ops = { fill_avx2, copy_avx2, 0 };
+static const struct store_ops avx2_nt_ops = { fill_avx2_nt, copy_avx2_nt, 1 };
+#endif
+
+static enum pixel_isa selected_isa;
+static const struct store_ops *cached_ops = &scalar_ops;
+static const struct store_ops *streaming_ops = &scalar_ops;
+static size_t llc_size = DEFAULT_LLC_SIZE;
+
+static enum pixel_isa detect_isa(void)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return PIXEL_ISA_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return PIXEL_ISA_SSE2;
+#endif
+  return PIXEL_ISA_SCALAR;
+}
+
+enum pixel_isa pixel_fill_set_isa(enum pixel_isa isa)
+{
+  enum pixel_isa best = detect_isa();
+
+  if (isa == PIXEL_ISA_AUTO || isa > best)
+    isa = best;
+
+  selected_isa = isa;
+  switch (isa) {
+#ifdef HAVE_X86_SIMD
+  case PIXEL_ISA_AVX2:
+    cached_ops = &avx2_ops;
+    streaming_ops = &avx2_nt_ops;
+    break;
+  case PIXEL_ISA_SSE2:
+    cached_ops = &sse2_ops;
+    streaming_ops = &sse2_nt_ops;
+    break;
+#endif
+  default:
+    cached_ops = &scalar_ops;
+    streaming_ops = &scalar_ops;
+    break;
+  }
+
+  return isa;
+}
+
+const char *pixel_isa_name(enum pixel_isa isa)
+{
+  switch (isa) {
+  case PIXEL_ISA_SCALAR:
+    return "scalar";
+  case PIXEL_ISA_SSE2:
+    return "sse2";
+  case PIXEL_ISA_AVX2:
+    return "avx2";
+  default:
+    return "auto";
+  }
+}
+
+__attribute__((constructor))
+static void pixel_fill_init(void)
+{
+  const char *env = getenv("PIXEL_FILL_ISA");
+  enum pixel_isa isa = PIXEL_ISA_AUTO;
+  long size;
+
+  size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size <= 0)
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  if (size > 0)
+    llc_size = size;
+
+  if (env && strcmp(env, "scalar") == 0)
+    isa = PIXEL_ISA_SCALAR;
+  else if (env && strcmp(env, "sse2") == 0)
+    isa = PIXEL_ISA_SSE2;
+  else if (env && strcmp(env, "avx2") == 0)
+    isa = PIXEL_ISA_AVX2;
+
+  pixel_fill_set_isa(isa);
+}
+
+/*
+ * 2x2 ordered dither for RGB565, in quarters of a quantization step.  Its
+ * period of two pixels fits one 32 bit fill pattern, so dithered rows are
+ * still plain pattern fills.
+ */
+static const uint8_t dither[2][2] = { { 0, 2 }, { 3, 1 } };
+
+static inline uint32_t to_rgb565(uint32_t argb, uint32_t d)
+{
+  uint32_t r = ((argb >> 16) & 0xff) + d * 2;
+  uint32_t g = ((argb >> 8) & 0xff) + d;
+  uint32_t b = (argb & 0xff) + d * 2;
+
+  r = r > 0xff ? 0xff : r;
+  g = g > 0xff ? 0xff : g;
+  b = b > 0xff ? 0xff : b;
+
+  return (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+}
+
+/*
+ * The fill pattern for a run of |argb| starting at pixel (x, y), converted
+ * to the destination format and replicated to 32 bits so the fill loops
+ * can use it directly.
+ */
+static inline uint32_t pack(enum pixel_format format, uint32_t argb, int x, int y)
+{
+  switch (format) {
+  case PIXEL_FORMAT_XRGB8888:
+    return argb | 0xff000000;
+  case PIXEL_FORMAT_RGB565:
+    return to_rgb565(argb, dither[y & 1][x & 1]) |
+           to_rgb565(argb, dither[y & 1][~x & 1]) << 16;
+  default:
+    return argb;
+  }
+}
+
+static inline uint32_t checker_color(int mx, int my)
+{
+  uint32_t code = (mx / 2) % 8; // X axis determines a color code from 0 to 7.
+  uint32_t red = code & 1 ? 0xff0000 : 0;
+  uint32_t green = code & 2 ? 0x00ff00 : 0;
+  uint32_t blue = code & 4 ? 0x0000ff : 0;
+  uint32_t alpha = (uint32_t) (my / 2) % 8 * 32 << 24; // Y axis determines alpha value from 0 to 0xf0
+
+  return alpha + red + green + blue;
+}
+
+/*
+ * Build pixel row |y| (in tile row |my|) into |row|.  The pattern repeats
+ * every 16 tiles, so only the first period is computed tile by tile (one
+ * fill per tile, no per pixel work) and the rest is doubled with memcpy.
+ * The period is even, so the dither pattern survives the doubling.
+ */
+static inline void build_row(uint8_t *row, const struct checker *c, int y, int my,
+                             enum pixel_format format, int tile)
+{
+  const int bpp = pixel_format_bpp(format);
+  const int period = 16 * tile;
+  const int limit = c->width < period ? c->width : period;
+  size_t done, total = (size_t) c->width * bpp;
+  int x = 0, mx = c->offset / tile;
+  int run = tile - c->offset % tile;
+
+  while (x < limit) {
+    int n = run < limit - x ? run : limit - x;
+    uint32_t value = pack(format, mx % 2 == 0 ? checker_color(mx, my) : 0, x, y);
+
+    cached_ops->fill(row + (size_t) x * bpp, value, (size_t) n * bpp);
+    x += n;
+    mx++;
+    run = tile;
+  }
+
+  for (done = (size_t) limit * bpp; done < total; done *= 2)
+    memcpy(row + done, row, done < total - done ? done : total - done);
+}
+
+/*
+ * The kernel body.  It is always inlined into one function per format and
+ * tile size below, so |format| and |tile| are compile time constants there
+ * and the divisions, modulos and format conversions fold away.
+ */
+static inline __attribute__((always_inline))
+void checker_rows(void *data, const struct checker *c, int x0, int x1, int y0, int y1,
+                  enum pixel_format format, int tile)
+{
+  const struct store_ops *ops = cached_ops;
+  const int bpp = pixel_format_bpp(format);
+  size_t row_bytes = (size_t) c->width * bpp;
+  size_t span = (size_t) x0 * bpp, span_bytes = (size_t) (x1 - x0) * bpp;
+  uint8_t *row;
+  int y, built = -1;
+
+  /*
+   * Buffers that don't fit in the last level cache would only evict
+   * useful data on their way to the compositor, stream them instead.
+   */
+  if ((size_t) c->stride * c->height > llc_size)
+    ops = streaming_ops;
+
+  row = aligned_alloc(64, (row_bytes + 63) & ~(size_t) 63);
+  if (!row)
+    return;
+
+  for (y = y0; y < y1; y++) {
+    uint8_t *dst = (uint8_t *) data + (size_t) y * c->stride + span;
+    int my = y / tile;
+    /* Dithered rows also differ by the parity of y within a tile row. */
+    int key = format == PIXEL_FORMAT_RGB565 ? my * 2 + (y & 1) : my;
+
+    if (my % 2) {
+      ops->fill(dst, pack(format, 0, x0, y), span_bytes);
+      continue;
+    }
+
+    if (key != built) {
+      build_row(row, c, y, my, format, tile);
+      built = key;
+    }
+    ops->copy(dst, row + span, span_bytes);
+  }
+
+  free(row);
+}
+
+typedef void (*checker_kernel_t)(void *data, const struct checker *c,
+                                 int x0, int x1, int y0, int y1);
+
+#define DEFINE_CHECKER_KERNEL(name, FORMAT, TILE)                             \
+static void name(void *data, const struct checker *c,                         \
+                 int x0, int x1, int y0, int y1)                              \
+{                                                                             \
+  checker_rows(data, c, x0, x1, y0, y1, FORMAT, TILE ? TILE : c->tile);       \
+}
+
+DEFINE_CHECKER_KERNEL(checker_argb_1, PIXEL_FORMAT_ARGB8888, 1)
+DEFINE_CHECKER_KERNEL(checker_argb_20, PIXEL_FORMAT_ARGB8888, 20)
+DEFINE_CHECKER_KERNEL(checker_argb_n, PIXEL_FORMAT_ARGB8888, 0)
+DEFINE_CHECKER_KERNEL(checker_xrgb_1, PIXEL_FORMAT_XRGB8888, 1)
+DEFINE_CHECKER_KERNEL(checker_xrgb_20, PIXEL_FORMAT_XRGB8888, 20)
+DEFINE_CHECKER_KERNEL(checker_xrgb_n, PIXEL_FORMAT_XRGB8888, 0)
+DEFINE_CHECKER_KERNEL(checker_rgb565_1, PIXEL_FORMAT_RGB565, 1)
+DEFINE_CHECKER_KERNEL(checker_rgb565_20, PIXEL_FORMAT_RGB565, 20)
+DEFINE_CHECKER_KERNEL(checker_rgb565_n, PIXEL_FORMAT_RGB565, 0)
+
+/* Indexed by format, then tile size 1, 20 or anything else. */
+static const checker_kernel_t checker_kernels[][3] = {
+  [PIXEL_FORMAT_ARGB8888] = { checker_argb_1, checker_argb_20, checker_argb_n },
+  [PIXEL_FORMAT_XRGB8888] = { checker_xrgb_1, checker_xrgb_20, checker_xrgb_n },
+  [PIXEL_FORMAT_RGB565] = { checker_rgb565_1, checker_rgb565_20, checker_rgb565_n },
+};
+
+void pixel_fill_checker_rect(void *data, const struct checker *checker,
+                             int x, int y, int width, int height)
+{
+  int variant = checker->tile == 1 ? 0 : checker->tile == 20 ? 1 : 2;
+  int x0 = x < 0 ? 0 : x, y0 = y < 0 ? 0 : y;
+  int x1 = x + width > checker->width ? checker->width : x + width;
+  int y1 = y + height > checker->height ? checker->height : y + height;
+
+  if (x1 <= x0 || y1 <= y0)
+    return;
+
+  checker_kernels[checker->format][variant](data, checker, x0, x1, y0, y1);
+}
+
+void pixel_fill_checker(void *data, const struct checker *checker, int y0, int y1)
+{
+  pixel_fill_checker_rect(data, checker, 0, y0, checker->width, y1 - y0);
+}
+
+void pixel_fill_rect(void *data, int stride, enum pixel_format format,
+                     int x, int y, int width, int height, uint32_t argb)
+{
+  const int bpp = pixel_format_bpp(format);
+  int row;
+
+  for (row = y; row < y + height; row++)
+    cached_ops->fill((uint8_t *) data + (size_t) row * stride + (size_t) x * bpp,
+                     pack(format, argb, x, row), (size_t) width * bpp);
+}
+
+void pixel_band(int index, int bands, int y, int height, int stride, int *y0, int *y1)
+{
+  int a = stride & 63, b = 64, granule, first, units;
+
+  /* Smallest number of rows that spans a whole number of cache lines. */
+  while (a) {
+    int t = b % a;
+    b = a;
+    a = t;
+  }
+  granule = 64 / b;
+
+  /* Split the granules touched by [y, y + height) and clip to that range. */
+  first = y / granule;
+  units = (y + height + granule - 1) / granule - first;
+  *y0 = (first + (int) ((long) units * index / bands)) * granule;
+  *y1 = (first + (int) ((long) units * (index + 1) / bands)) * granule;
+  if (*y0 < y)
+    *y0 = y;
+  if (*y1 > y + height)
+    *y1 = y + height;
+  if (*y1 < *y0)
+    *y1 = *y0;
+}
+
+void pixel_fill_checker_band(void *data, int index, int count)
+{
+  struct checker_job *job = data;
+  int y0, y1;
+
+  pixel_band(index, count, job->y, job->height, job->checker.stride, &y0, &y1);
+  pixel_fill_checker_rect(job->data, &job->checker, job->x, y0, job->width, y1 - y0);
+}
@@ -0,0 +1,89 @@
+/*
+ * Pixel fill kernels for the SHM samples.
+ *
+ * The kernels work on whole row spans.  Each one is specialized at compile
+ * time on the pixel format and tile size, while the store loops underneath
+ * (scalar, SSE2 or AVX2, regular or non-temporal) are picked at runtime.
+ */
+
+#ifndef PIXEL_FILL_H
+#define PIXEL_FILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum pixel_format {
+  PIXEL_FORMAT_ARGB8888,
+  PIXEL_FORMAT_XRGB8888,
+  PIXEL_FORMAT_RGB565,
+};
+
+enum pixel_isa {
+  PIXEL_ISA_AUTO,
+  PIXEL_ISA_SCALAR,
+  PIXEL_ISA_SSE2,
+  PIXEL_ISA_AVX2,
+};
+
+/*
+ * The sample checkerboard: every other |tile| x |tile| cell is lit, its
+ * color picked by the column and its alpha by the row, scrolled left by
+ * |offset| pixels.
+ */
+struct checker {
+  enum pixel_format format;
+  int tile;
+  int offset;
+  int width, height, stride;
+};
+
+static inline int pixel_format_bpp(enum pixel_format format)
+{
+  return format == PIXEL_FORMAT_RGB565 ? 2 : 4;
+}
+
+/*
+ * Paint rows [y0, y1) of |checker| into |data|, which points at row 0.
+ * Rows outside that range are not touched, so disjoint ranges can be
+ * painted concurrently.
+ */
+void pixel_fill_checker(void *data, const struct checker *checker, int y0, int y1);
+
+/* Paint only the part of |checker| inside the given rectangle. */
+void pixel_fill_checker_rect(void *data, const struct checker *checker,
+                             int x, int y, int width, int height);
+
+/* Fill a rectangle with one color, given as ARGB8888. */
+void pixel_fill_rect(void *data, int stride, enum pixel_format format,
+                     int x, int y, int width, int height, uint32_t argb);
+
+/*
+ * Return in [*y0, *y1) the rows of band |index| out of |bands| when
+ * splitting rows [y, y + height) of |stride| bytes each.  Band boundaries
+ * fall on cache line boundaries so concurrent painters never share a line.
+ */
+void pixel_band(int index, int bands, int y, int height, int stride, int *y0, int *y1);
+
+/*
+ * The part of a checkerboard inside a rectangle, split into bands, one per
+ * thread_pool job: submit pixel_fill_checker_band with a struct
+ * checker_job as data.
+ */
+struct checker_job {
+  void *data;
+  struct checker checker;
+  int x, y, width, height;
+};
+
+void pixel_fill_checker_band(void *job, int index, int count);
+
+/*
+ * Force a store implementation, mostly for benchmarking.  PIXEL_ISA_AUTO
+ * (the default, overridable with PIXEL_FILL_ISA=scalar|sse2|avx2) picks
+ * the best one the CPU supports.  Returns the ISA actually selected.
+ */
+enum pixel_isa pixel_fill_set_isa(enum pixel_isa isa);
+
+const char *pixel_isa_name(enum pixel_isa isa);
+
+#endif
@@ -0,0 +1,339 @@
+/*
+ * Program binary cache on top of GL_OES_get_program_binary
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include "program-cache.h"
+
+#define PROGRAM_CACHE_MAGIC 0x47525050 /* "PPRG" */
+
+/* Binaries over this are not worth caching, or the file is corrupt. */
+#define PROGRAM_CACHE_MAX_SIZE (16 << 20)
+
+struct cache_header {
+  uint32_t magic;
+  uint32_t format;           /* binary format, as returned by the driver */
+  uint32_t length;           /* bytes of binary following the header */
+  uint32_t checksum;         /* of the binary, so damaged files never reach the driver */
+  uint64_t key;
+};
+
+struct binary_ext {
+  PFNGLGETPROGRAMBINARYOESPROC get;
+  PFNGLPROGRAMBINARYOESPROC load;
+};
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+  const uint8_t *p = data;
+
+  while (size--)
+    hash = (hash ^ *p++) * FNV_PRIME;
+  return hash;
+}
+
+/* Strings are hashed with their terminator so "ab" "c" and "a" "bc" differ. */
+static uint64_t fnv1a_string(uint64_t hash, const char *s)
+{
+  return fnv1a(hash, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static uint64_t program_key(const char *vert_source, const char *frag_source,
+                            const struct program_attrib *attribs, int n_attribs)
+{
+  uint64_t hash = FNV_OFFSET;
+  int i;
+
+  hash = fnv1a_string(hash, vert_source);
+  hash = fnv1a_string(hash, frag_source);
+  for (i = 0; i < n_attribs; i++) {
+    hash = fnv1a_string(hash, attribs[i].name);
+    hash = fnv1a(hash, &attribs[i].location, sizeof(attribs[i].location));
+  }
+  hash = fnv1a_string(hash, (const char *) glGetString(GL_RENDERER));
+  hash = fnv1a_string(hash, (const char *) glGetString(GL_VERSION));
+  return hash;
+}
+
+/* NULL where binaries can't be saved or the cache is disabled. */
+static const struct binary_ext *binary_ext(void)
+{
+  static struct binary_ext ext;
+  static int checked;
+  const char *extensions, *env;
+  GLint formats = 0;
+
+  if (checked)
+    return ext.get ? &ext : NULL;
+  checked = 1;
+
+  env = getenv("PROGRAM_CACHE");
+  if (env && strcmp(env, "0") == 0)
+    return NULL;
+
+  extensions = (const char *) glGetString(GL_EXTENSIONS);
+  if (!extensions || !strstr(extensions, "GL_OES_get_program_binary"))
+    return NULL;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+  if (formats < 1)
+    return NULL;
+
+  ext.get = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+  ext.load = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+  if (!ext.load)
+    ext.get = NULL;
+  return ext.get ? &ext : NULL;
+}
+
+/* Creates every missing directory of |path| up to its last '/'. */
+static int make_parents(char *path)
+{
+  char *p;
+
+  for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+      *p = '/';
+      return -1;
+    }
+    *p = '/';
+  }
+  return 0;
+}
+
+static char *cache_path(uint64_t key)
+{
+  const char *base = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+  char *path;
+  int ret;
+
+  if (base && base[0] == '/')
+    ret = asprintf(&path, "%s/wayland-sample/programs/%016llx",
+                   base, (unsigned long long) key);
+  else if (home && home[0] == '/')
+    ret = asprintf(&path, "%s/.cache/wayland-sample/programs/%016llx",
+                   home, (unsigned long long) key);
+  else
+    return NULL;
+  if (ret < 0)
+    return NULL;
+
+  if (make_parents(path) < 0) {
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+static uint32_t checksum(const void *data, size_t size)
+{
+  uint64_t hash = fnv1a(FNV_OFFSET, data, size);
+
+  return (uint32_t) (hash ^ hash >> 32);
+}
+
+/* Returns 0 if |program| now holds the cached binary. */
+static int load_binary(const struct binary_ext *ext, GLuint program,
+                       const char *path, uint64_t key)
+{
+  struct cache_header h;
+  void *binary = NULL;
+  struct stat st;
+  GLint status = 0;
+  int fd, ret = -1;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof h ||
+      read(fd, &h, sizeof h) != sizeof h ||
+      h.magic != PROGRAM_CACHE_MAGIC || h.key != key ||
+      h.length > PROGRAM_CACHE_MAX_SIZE || st.st_size != (off_t) (sizeof h + h.length))
+    goto out;
+
+  binary = malloc(h.length);
+  if (!binary || read(fd, binary, h.length) != (ssize_t) h.length ||
+      checksum(binary, h.length) != h.checksum)
+    goto out;
+
+  ext->load(program, h.format, binary, h.length);
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status)
+    ret = 0;
+
+out:
+  free(binary);
+  close(fd);
+  return ret;
+}
+
+/* Failures only cost the next run a compile, so they are silent. */
+static void save_binary(const struct binary_ext *ext, GLuint program,
+                        const char *path, uint64_t key)
+{
+  struct cache_header h = {
+    .magic = PROGRAM_CACHE_MAGIC,
+    .key = key,
+  };
+  void *binary = NULL;
+  GLint length = 0;
+  GLsizei written = 0;
+  GLenum format = 0;
+  char *tmp = NULL;
+  FILE *f = NULL;
+  int fd, ok = 0;
+
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+  if (length <= 0 || length > PROGRAM_CACHE_MAX_SIZE || !(binary = malloc(length)))
+    goto out;
+  ext->get(program, length, &written, &format, binary);
+  if (written <= 0 || written > length)
+    goto out;
+  h.format = format;
+  h.length = written;
+  h.checksum = checksum(binary, written);
+
+  /* Write a temporary and rename it, so other instances never load half a file. */
+  if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+    tmp = NULL;
+    goto out;
+  }
+  fd = mkstemp(tmp);
+  if (fd < 0 || !(f = fdopen(fd, "wb"))) {
+    if (fd >= 0)
+      close(fd);
+    goto out;
+  }
+  if (fwrite(&h, sizeof h, 1, f) != 1 || fwrite(binary, 1, written, f) != (size_t) written)
+    goto out;
+  fd = fclose(f);
+  f = NULL;
+  if (fd == 0 && rename(tmp, path) == 0)
+    ok = 1;
+
+out:
+  if (f)
+    fclose(f);
+  if (tmp && !ok)
+    unlink(tmp);
+  free(tmp);
+  free(binary);
+}
+
+static GLuint compile_shader(const char *source, GLenum type)
+{
+  GLuint shader;
+  GLint status;
+
+  shader = glCreateShader(type);
+  if (!shader)
+    return 0;
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+  if (!status) {
+    char log[1000];
+    GLsizei len;
+
+    glGetShaderInfoLog(shader, sizeof(log), &len, log);
+    fprintf(stderr, "Error: compiling %s: %*s\n",
+            type == GL_VERTEX_SHADER ? "vertex" : "fragment", len, log);
+    glDeleteShader(shader);
+    return 0;
+  }
+
+  return shader;
+}
+
+static int link_source(GLuint program, const char *vert_source, const char *frag_source,
+                       const struct program_attrib *attribs, int n_attribs)
+{
+  GLuint vert, frag;
+  GLint status;
+  int i;
+
+  vert = compile_shader(vert_source, GL_VERTEX_SHADER);
+  frag = compile_shader(frag_source, GL_FRAGMENT_SHADER);
+  if (!vert || !frag) {
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    return -1;
+  }
+
+  glAttachShader(program, vert);
+  glAttachShader(program, frag);
+  for (i = 0; i < n_attribs; i++)
+    glBindAttribLocation(program, attribs[i].location, attribs[i].name);
+  glLinkProgram(program);
+
+  /* The program keeps them alive for as long as they stay attached. */
+  glDeleteShader(vert);
+  glDeleteShader(frag);
+
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (!status) {
+    char log[1000];
+    GLsizei len;
+
+    glGetProgramInfoLog(program, sizeof(log), &len, log);
+    fprintf(stderr, "Error: linking:\n%*s\n", len, log);
+    return -1;
+  }
+
+  return 0;
+}
+
+GLuint program_cache_link(const char *vert_source, const char *frag_source,
+                          const struct program_attrib *attribs, int n_attribs)
+{
+  const struct binary_ext *ext = binary_ext();
+  GLuint program = glCreateProgram();
+  char *path = NULL;
+  uint64_t key = 0;
+
+  if (!program)
+    return 0;
+
+  if (ext) {
+    key = program_key(vert_source, frag_source, attribs, n_attribs);
+    path = cache_path(key);
+  }
+  if (path) {
+    if (load_binary(ext, program, path, key) == 0) {
+      free(path);
+      return program;
+    }
+    /* Rejected, e.g. by a driver built differently: start from a fresh program. */
+    glDeleteProgram(program);
+    program = glCreateProgram();
+  }
+
+  if (!program || link_source(program, vert_source, frag_source, attribs, n_attribs) < 0) {
+    glDeleteProgram(program);
+    free(path);
+    return 0;
+  }
+
+  if (path)
+    save_binary(ext, program, path, key);
+  free(path);
+  return program;
+}
@@ -0,0 +1,36 @@
+/*
+ * On disk cache of linked GLES2 programs.
+ *
+ * program_cache_link() builds a program from vertex and fragment shader
+ * sources with fixed attribute locations.  Where GL_OES_get_program_binary
+ * is supported, the linked binary is saved under
+ * $XDG_CACHE_HOME/wayland-sample/programs (~/.cache by default) in a file
+ * named by a hash of the sources, the attribute bindings, GL_RENDERER and
+ * GL_VERSION, so another GPU or a driver update misses instead of loading
+ * a stale binary.  Later runs load it with glProgramBinaryOES() and only
+ * compile when the driver rejects it, after which the entry is rewritten.
+ *
+ * PROGRAM_CACHE=0 in the environment compiles from source every time.
+ *
+ * Call with the GL context current.
+ */
+
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GLES2/gl2.h>
+
+struct program_attrib {
+  const char *name;
+  GLuint location;
+};
+
+/*
+ * Returns the linked program, or 0 after printing the compile or link log
+ * on stderr.  The |n_attribs| bindings in |attribs| are applied before
+ * linking.
+ */
+GLuint program_cache_link(const char *vert_source, const char *frag_source,
+                          const struct program_attrib *attribs, int n_attribs);
+
+#endif
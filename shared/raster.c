@@ -0,0 +1,263 @@
+/*
+ * Tiled fixed point triangle rasterizer
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "raster.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL (1 << SUBPIXEL_BITS)
+
+/*
+ * Edge function of the directed edge a -> b in sub pixel units.  It is
+ * positive on the inside of a triangle wound so that its area is positive,
+ * and steps by |dx| per pixel to the right and |dy| per row down.
+ */
+struct edge {
+  int64_t dx, dy;
+  int64_t origin; /* value at the center of pixel (0, 0), fill rule applied */
+};
+
+/* Linear color channel: value = c + dcdx * x + dcdy * y at pixel centers. */
+struct plane {
+  float c, dcdx, dcdy;
+};
+
+struct setup {
+  struct edge e[3];
+  struct plane r, g, b, a;
+  int x0, y0, x1, y1; /* pixel bounding box, exclusive */
+};
+
+static void setup_edge(struct edge *e, int64_t xa, int64_t ya, int64_t xb, int64_t yb)
+{
+  int64_t ex = xb - xa, ey = yb - ya;
+  /* Pixels exactly on an edge belong to the triangle only for top or left edges. */
+  int top_left = ey < 0 || (ey == 0 && ex > 0);
+  int64_t px = SUBPIXEL / 2, py = SUBPIXEL / 2;
+
+  e->dx = -ey * SUBPIXEL;
+  e->dy = ex * SUBPIXEL;
+  e->origin = ex * (py - ya) - ey * (px - xa) - (top_left ? 0 : 1);
+}
+
+static void setup_plane(struct plane *p, const float x[3], const float y[3],
+                        const float c[3], float area)
+{
+  p->dcdx = ((c[1] - c[0]) * (y[2] - y[0]) - (c[2] - c[0]) * (y[1] - y[0])) / area;
+  p->dcdy = ((c[2] - c[0]) * (x[1] - x[0]) - (c[1] - c[0]) * (x[2] - x[0])) / area;
+  p->c = c[0] - p->dcdx * (x[0] - 0.5f) - p->dcdy * (y[0] - 0.5f);
+}
+
+static inline int clampi(int v, int lo, int hi)
+{
+  return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Returns 0 for triangles that cover no pixel of the target. */
+static int setup_triangle(struct setup *s, const struct raster_job *job)
+{
+  int64_t X[3], Y[3], area;
+  float x[3], y[3], r[3], g[3], b[3], a[3];
+  int i, order[3] = { 0, 1, 2 };
+
+  for (i = 0; i < 3; i++) {
+    X[i] = lroundf(job->v[i].x * SUBPIXEL);
+    Y[i] = lroundf(job->v[i].y * SUBPIXEL);
+  }
+
+  area = (X[1] - X[0]) * (Y[2] - Y[0]) - (Y[1] - Y[0]) * (X[2] - X[0]);
+  if (area == 0)
+    return 0;
+  if (area < 0) {
+    /* Back facing: flip the winding, there is no culling. */
+    order[1] = 2;
+    order[2] = 1;
+    area = -area;
+  }
+
+  for (i = 0; i < 3; i++) {
+    const struct raster_vertex *v = &job->v[order[i]];
+
+    x[i] = (float) X[order[i]] / SUBPIXEL;
+    y[i] = (float) Y[order[i]] / SUBPIXEL;
+    /* Interpolate premultiplied, in 0..255. */
+    a[i] = v->a * 255.0f;
+    r[i] = v->r * a[i];
+    g[i] = v->g * a[i];
+    b[i] = v->b * a[i];
+  }
+
+  for (i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+
+    setup_edge(&s->e[i], X[order[i]], Y[order[i]], X[order[j]], Y[order[j]]);
+  }
+
+  setup_plane(&s->r, x, y, r, (float) area / (SUBPIXEL * SUBPIXEL));
+  setup_plane(&s->g, x, y, g, (float) area / (SUBPIXEL * SUBPIXEL));
+  setup_plane(&s->b, x, y, b, (float) area / (SUBPIXEL * SUBPIXEL));
+  setup_plane(&s->a, x, y, a, (float) area / (SUBPIXEL * SUBPIXEL));
+
+  s->x0 = clampi(floorf(fminf(x[0], fminf(x[1], x[2]))), 0, job->width);
+  s->y0 = clampi(floorf(fminf(y[0], fminf(y[1], y[2]))), 0, job->height);
+  s->x1 = clampi(ceilf(fmaxf(x[0], fmaxf(x[1], x[2]))), 0, job->width);
+  s->y1 = clampi(ceilf(fmaxf(y[0], fmaxf(y[1], y[2]))), 0, job->height);
+
+  return s->x0 < s->x1 && s->y0 < s->y1;
+}
+
+static inline int64_t edge_at(const struct edge *e, int x, int y)
+{
+  return e->origin + e->dx * x + e->dy * y;
+}
+
+static inline float plane_at(const struct plane *p, int x, int y)
+{
+  return p->c + p->dcdx * x + p->dcdy * y;
+}
+
+static inline uint32_t pack_pixel(float r, float g, float b, float a, uint32_t alpha_or)
+{
+  /* Round like _mm_cvtps_epi32 so both paths agree. */
+  uint32_t ir = lrintf(fminf(fmaxf(r, 0.0f), 255.0f));
+  uint32_t ig = lrintf(fminf(fmaxf(g, 0.0f), 255.0f));
+  uint32_t ib = lrintf(fminf(fmaxf(b, 0.0f), 255.0f));
+  uint32_t ia = lrintf(fminf(fmaxf(a, 0.0f), 255.0f));
+
+  return (ia << 24 | ir << 16 | ig << 8 | ib) | alpha_or;
+}
+
+/* Shade pixels [x0, x1) of row |y|. */
+static void shade_span(uint32_t *row, const struct setup *s, int x0, int x1, int y,
+                       uint32_t alpha_or)
+{
+  float r = plane_at(&s->r, x0, y), g = plane_at(&s->g, x0, y);
+  float b = plane_at(&s->b, x0, y), a = plane_at(&s->a, x0, y);
+  int x = x0;
+
+#ifdef __SSE2__
+  {
+    const __m128 step = _mm_set_ps(3, 2, 1, 0);
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(255.0f);
+    const __m128i opaque = _mm_set1_epi32(alpha_or);
+    __m128 vr = _mm_add_ps(_mm_set1_ps(r), _mm_mul_ps(step, _mm_set1_ps(s->r.dcdx)));
+    __m128 vg = _mm_add_ps(_mm_set1_ps(g), _mm_mul_ps(step, _mm_set1_ps(s->g.dcdx)));
+    __m128 vb = _mm_add_ps(_mm_set1_ps(b), _mm_mul_ps(step, _mm_set1_ps(s->b.dcdx)));
+    __m128 va = _mm_add_ps(_mm_set1_ps(a), _mm_mul_ps(step, _mm_set1_ps(s->a.dcdx)));
+    const __m128 dr = _mm_set1_ps(4 * s->r.dcdx), dg = _mm_set1_ps(4 * s->g.dcdx);
+    const __m128 db = _mm_set1_ps(4 * s->b.dcdx), da = _mm_set1_ps(4 * s->a.dcdx);
+
+    for (; x + 4 <= x1; x += 4) {
+      __m128i ir = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(vr, lo), hi));
+      __m128i ig = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(vg, lo), hi));
+      __m128i ib = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(vb, lo), hi));
+      __m128i ia = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(va, lo), hi));
+      __m128i p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(ia, 24), _mm_slli_epi32(ir, 16)),
+                               _mm_or_si128(_mm_slli_epi32(ig, 8), ib));
+
+      _mm_storeu_si128((__m128i *) (row + x), _mm_or_si128(p, opaque));
+      vr = _mm_add_ps(vr, dr);
+      vg = _mm_add_ps(vg, dg);
+      vb = _mm_add_ps(vb, db);
+      va = _mm_add_ps(va, da);
+    }
+
+    r = _mm_cvtss_f32(vr);
+    g = _mm_cvtss_f32(vg);
+    b = _mm_cvtss_f32(vb);
+    a = _mm_cvtss_f32(va);
+  }
+#endif
+
+  for (; x < x1; x++) {
+    row[x] = pack_pixel(r, g, b, a, alpha_or);
+    r += s->r.dcdx;
+    g += s->g.dcdx;
+    b += s->b.dcdx;
+    a += s->a.dcdx;
+  }
+}
+
+static void raster_tile(const struct raster_job *job, const struct setup *s,
+                        int tx0, int ty0, int tx1, int ty1, uint32_t alpha_or)
+{
+  int full = 1, i, x, y;
+
+  /* Edge functions are linear, so their minimum is at a corner. */
+  for (i = 0; i < 3; i++) {
+    const struct edge *e = &s->e[i];
+    int64_t m = edge_at(e, e->dx < 0 ? tx1 - 1 : tx0, e->dy < 0 ? ty1 - 1 : ty0);
+    int64_t M = edge_at(e, e->dx < 0 ? tx0 : tx1 - 1, e->dy < 0 ? ty0 : ty1 - 1);
+
+    if (M < 0)
+      return;
+    if (m < 0)
+      full = 0;
+  }
+
+  for (y = ty0; y < ty1; y++) {
+    uint32_t *row = (uint32_t *) ((uint8_t *) job->data + (size_t) y * job->stride);
+    int first = tx1, last = tx0;
+
+    if (full) {
+      shade_span(row, s, tx0, tx1, y, alpha_or);
+      continue;
+    }
+
+    /* Triangles are convex, so the covered pixels of a row are one span. */
+    for (x = tx0; x < tx1; x++) {
+      if ((edge_at(&s->e[0], x, y) | edge_at(&s->e[1], x, y) | edge_at(&s->e[2], x, y)) >= 0) {
+        if (x < first)
+          first = x;
+        last = x + 1;
+      }
+    }
+    if (first < last)
+      shade_span(row, s, first, last, y, alpha_or);
+  }
+}
+
+void raster_triangle(const struct raster_job *job, int y0, int y1)
+{
+  uint32_t alpha_or = job->format == PIXEL_FORMAT_XRGB8888 ? 0xff000000 : 0;
+  struct setup s;
+  int tx, ty;
+
+  pixel_fill_rect(job->data, job->stride, job->format, 0, y0, job->width, y1 - y0, job->clear);
+
+  if (!setup_triangle(&s, job))
+    return;
+  if (s.y0 > y0)
+    y0 = s.y0;
+  if (s.y1 < y1)
+    y1 = s.y1;
+
+  /* Tiles are aligned to the tile grid so bands split them consistently. */
+  for (ty = y0 / RASTER_TILE * RASTER_TILE; ty < y1; ty += RASTER_TILE) {
+    int row0 = ty > y0 ? ty : y0;
+    int row1 = ty + RASTER_TILE < y1 ? ty + RASTER_TILE : y1;
+
+    for (tx = s.x0 / RASTER_TILE * RASTER_TILE; tx < s.x1; tx += RASTER_TILE) {
+      int col0 = tx > s.x0 ? tx : s.x0;
+      int col1 = tx + RASTER_TILE < s.x1 ? tx + RASTER_TILE : s.x1;
+
+      raster_tile(job, &s, col0, row0, col1, row1, alpha_or);
+    }
+  }
+}
+
+void raster_triangle_band(void *data, int index, int count)
+{
+  struct raster_job *job = data;
+  int y0, y1;
+
+  pixel_band(index, count, 0, job->height, job->stride, &y0, &y1);
+  raster_triangle(job, y0, y1);
+}
@@ -0,0 +1,46 @@
+/*
+ * Software triangle rasterizer for the SHM paths of the samples.
+ *
+ * Triangles are rasterized with fixed point edge functions (4 bits of sub
+ * pixel precision, top-left fill rule) over 8x8 pixel tiles: tiles fully
+ * outside an edge are skipped, tiles fully inside are shaded without any
+ * coverage test, and only tiles crossing an edge are tested per pixel.
+ * Colors are interpolated linearly and shaded a span at a time, four
+ * pixels per SSE2 store.
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+
+#include "pixel-fill.h"
+
+#define RASTER_TILE 8
+
+/* A vertex in pixel coordinates (y down) with a straight alpha color. */
+struct raster_vertex {
+  float x, y;
+  float r, g, b, a;
+};
+
+/*
+ * One frame: clear a 32 bpp buffer to |clear| (premultiplied ARGB8888)
+ * and draw a smooth shaded triangle over it.  Split into bands, one per
+ * thread_pool job: submit raster_triangle_band with a struct raster_job as
+ * data.
+ */
+struct raster_job {
+  void *data;
+  int width, height, stride;
+  enum pixel_format format; /* PIXEL_FORMAT_ARGB8888 or PIXEL_FORMAT_XRGB8888 */
+  uint32_t clear;
+  struct raster_vertex v[3];
+};
+
+/* Clear and rasterize rows [y0, y1) of |job|. */
+void raster_triangle(const struct raster_job *job, int y0, int y1);
+
+void raster_triangle_band(void *job, int index, int count);
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Preprocessed, mmap-able texture files
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "raw-texture.h"
+
+#define LEVEL_ALIGN 64
+
+static uint64_t align(uint64_t v)
+{
+  return (v + LEVEL_ALIGN - 1) & ~(uint64_t) (LEVEL_ALIGN - 1);
+}
+
+int raw_texture_open(struct raw_texture *tex, const char *path)
+{
+  const struct raw_texture_header *h;
+  struct stat st;
+  uint32_t level;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Can't open %s: %m\n", path);
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof *h) {
+    fprintf(stderr, "%s is not a raw texture\n", path);
+    close(fd);
+    return -1;
+  }
+
+  tex->size = st.st_size;
+  tex->map = mmap(NULL, tex->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (tex->map == MAP_FAILED) {
+    fprintf(stderr, "Can't map %s: %m\n", path);
+    return -1;
+  }
+
+  /* The upload reads all of it right away; start the page-ins now. */
+  madvise(tex->map, tex->size, MADV_WILLNEED);
+
+  h = tex->header = tex->map;
+  if (h->magic != RAW_TEXTURE_MAGIC || h->version != RAW_TEXTURE_VERSION ||
+      h->format != RAW_TEXTURE_RGBA8888 ||
+      h->width < 1 || h->width > RAW_TEXTURE_MAX_SIZE ||
+      h->height < 1 || h->height > RAW_TEXTURE_MAX_SIZE ||
+      h->stride != raw_texture_level_stride(h->width) ||
+      (h->levels != 1 && h->levels != (uint32_t) mip_level_count(h->width, h->height)))
+    goto invalid;
+
+  for (level = 0; level < h->levels; level++) {
+    int width = raw_texture_level_size(h->width, level);
+    int height = raw_texture_level_size(h->height, level);
+    uint64_t offset = h->offset[level];
+
+    if (offset < sizeof *h || offset % 4 != 0 || offset > tex->size ||
+        raw_texture_level_stride(width) * height > tex->size - offset)
+      goto invalid;
+  }
+
+  return 0;
+
+invalid:
+  fprintf(stderr, "%s is not a valid raw texture\n", path);
+  munmap(tex->map, tex->size);
+  return -1;
+}
+
+void raw_texture_close(struct raw_texture *tex)
+{
+  munmap(tex->map, tex->size);
+}
+
+const void *raw_texture_level(const struct raw_texture *tex, int level,
+                              int *width, int *height)
+{
+  *width = raw_texture_level_size(tex->header->width, level);
+  *height = raw_texture_level_size(tex->header->height, level);
+
+  return (const uint8_t *) tex->map + tex->header->offset[level];
+}
+
+int raw_texture_write(const char *path, const struct mip_chain *chain, int mipmaps)
+{
+  const struct mip_level *base = &chain->level[0];
+  struct raw_texture_header h = {
+    .magic = RAW_TEXTURE_MAGIC,
+    .version = RAW_TEXTURE_VERSION,
+    .format = RAW_TEXTURE_RGBA8888,
+    .width = base->width,
+    .height = base->height,
+    .stride = raw_texture_level_stride(base->width),
+    .levels = mipmaps ? chain->levels : 1,
+  };
+  static const uint8_t zero[LEVEL_ALIGN];
+  char *tmp = NULL;
+  uint64_t offset;
+  uint32_t level;
+  FILE *f = NULL;
+  int ret = -1, saved;
+
+  if (base->width < 1 || base->width > RAW_TEXTURE_MAX_SIZE ||
+      base->height < 1 || base->height > RAW_TEXTURE_MAX_SIZE ||
+      h.levels > RAW_TEXTURE_MAX_LEVELS) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  offset = align(sizeof h);
+  for (level = 0; level < h.levels; level++) {
+    const struct mip_level *l = &chain->level[level];
+
+    h.offset[level] = offset;
+    offset = align(offset + raw_texture_level_stride(l->width) * l->height);
+  }
+
+  /* Write a temporary and rename it, so readers never map a partial file. */
+  if (asprintf(&tmp, "%s.XXXXXX", path) < 0) {
+    tmp = NULL;
+    goto out;
+  }
+  saved = mkstemp(tmp);
+  if (saved < 0 || !(f = fdopen(saved, "wb"))) {
+    if (saved >= 0)
+      close(saved);
+    goto out;
+  }
+
+  if (fwrite(&h, sizeof h, 1, f) != 1)
+    goto out;
+  for (level = 0; level < h.levels; level++) {
+    const struct mip_level *l = &chain->level[level];
+    size_t row = raw_texture_level_stride(l->width);
+    long pad = h.offset[level] - ftell(f);
+    int y;
+
+    if (fwrite(zero, 1, pad, f) != (size_t) pad)
+      goto out;
+    for (y = 0; y < l->height; y++)
+      if (fwrite(l->data + y * l->stride, 1, row, f) != row)
+        goto out;
+  }
+
+  if (fchmod(fileno(f), 0644) < 0)
+    goto out;
+  saved = fclose(f);
+  f = NULL;
+  if (saved != 0)
+    goto out;
+
+  if (rename(tmp, path) < 0)
+    goto out;
+  ret = 0;
+
+out:
+  saved = errno;
+  if (f)
+    fclose(f);
+  if (tmp && ret < 0)
+    unlink(tmp);
+  free(tmp);
+  errno = saved;
+
+  return ret;
+}
@@ -0,0 +1,77 @@
+/*
+ * Preprocessed, mmap-able texture files.
+ *
+ * A .rawtex file is a header followed by GPU-ready pixel rows, one image
+ * per mip level, so loading it costs an mmap and the page-ins instead of
+ * a PNG decode.  Rows are tightly packed, as GLES2 has no
+ * GL_UNPACK_ROW_LENGTH, and 4 byte aligned, so the default
+ * GL_UNPACK_ALIGNMENT applies.  Levels start on 64 byte boundaries.
+ *
+ * Files hold either one level or a full chain down to 1x1, built with
+ * mipmap.h.  Header fields are in host byte order; a file from a machine of the
+ * other endianness fails the magic check.  Write files with
+ * tools/rawtex-convert.
+ */
+
+#ifndef RAW_TEXTURE_H
+#define RAW_TEXTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mipmap.h"
+
+#define RAW_TEXTURE_MAGIC 0x58545752 /* "RWTX" on little endian */
+#define RAW_TEXTURE_VERSION 1
+#define RAW_TEXTURE_MAX_LEVELS 16
+#define RAW_TEXTURE_MAX_SIZE 16384
+
+enum raw_texture_format {
+  RAW_TEXTURE_RGBA8888 = 1, /* GL_RGBA, GL_UNSIGNED_BYTE */
+};
+
+struct raw_texture_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format;
+  uint32_t width, height;
+  uint32_t stride; /* bytes per row of level 0 */
+  uint32_t levels;
+  uint32_t reserved;
+  uint64_t offset[RAW_TEXTURE_MAX_LEVELS]; /* from the start of the file */
+};
+
+struct raw_texture {
+  void *map;
+  size_t size;
+  const struct raw_texture_header *header;
+};
+
+/*
+ * Map |path| read only and check its header and that every level is
+ * inside the file.  Returns -1 with a message on stderr on failure.
+ */
+int raw_texture_open(struct raw_texture *tex, const char *path);
+void raw_texture_close(struct raw_texture *tex);
+
+/* Pixels of mip |level|, rows of raw_texture_level_stride() bytes. */
+const void *raw_texture_level(const struct raw_texture *tex, int level,
+                              int *width, int *height);
+
+static inline int raw_texture_level_size(int size, int level)
+{
+  return size >> level > 0 ? size >> level : 1;
+}
+
+static inline size_t raw_texture_level_stride(int width)
+{
+  return (size_t) width * 4;
+}
+
+/*
+ * Write level 0 of |chain|, or all its levels if |mipmaps|, as |path|.
+ * Returns -1 on failure, with errno set.
+ */
+int raw_texture_write(const char *path, const struct mip_chain *chain, int mipmaps);
+
+#endif
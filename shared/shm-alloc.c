@@ -0,0 +1,343 @@
+/*
+ * memfd backed shared memory allocator
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shm-alloc.h"
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define DEFAULT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static size_t huge_page_size(void)
+{
+  static size_t size;
+  char line[128];
+  FILE *f;
+
+  if (size)
+    return size;
+
+  size = DEFAULT_HUGE_PAGE_SIZE;
+  f = fopen("/proc/meminfo", "r");
+  if (!f)
+    return size;
+
+  while (fgets(line, sizeof line, f)) {
+    unsigned long kb;
+
+    if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+      size = kb * 1024;
+      break;
+    }
+  }
+  fclose(f);
+
+  return size;
+}
+
+size_t shm_region_round_size(size_t size, uint32_t flags)
+{
+  size_t page;
+
+  if (flags & SHM_ALLOC_HUGETLB)
+    page = huge_page_size();
+  else
+    page = sysconf(_SC_PAGESIZE);
+
+  if (size == 0)
+    size = 1;
+
+  return (size + page - 1) / page * page;
+}
+
+/*
+ * Fallback for kernels without memfd_create: an unlinked file in
+ * $XDG_RUNTIME_DIR, the way weston's os_create_anonymous_file() does it.
+ */
+static int create_tmpfile(void)
+{
+  static const char template[] = "/shm-sample-XXXXXX";
+  const char *path;
+  char *name;
+  int fd;
+
+  path = getenv("XDG_RUNTIME_DIR");
+  if (!path) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  name = malloc(strlen(path) + sizeof template);
+  if (!name)
+    return -1;
+
+  strcpy(name, path);
+  strcat(name, template);
+
+  fd = mkostemp(name, O_CLOEXEC);
+  if (fd >= 0)
+    unlink(name);
+  free(name);
+
+  return fd;
+}
+
+static int create_fd(uint32_t *flags)
+{
+  int fd;
+
+  if (*flags & SHM_ALLOC_HUGETLB) {
+    fd = memfd_create("shm-sample", MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB);
+    if (fd >= 0)
+      return fd;
+
+    fprintf(stderr, "memfd_create(MFD_HUGETLB) failed: %m, using transparent huge pages\n");
+    *flags = (*flags & ~SHM_ALLOC_HUGETLB) | SHM_ALLOC_THP;
+  }
+
+  fd = memfd_create("shm-sample", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd >= 0)
+    return fd;
+
+  if (errno != ENOSYS)
+    return -1;
+
+  return create_tmpfile();
+}
+
+/*
+ * Apply the advice and prefaulting the flags ask for to [start, start + len)
+ * of the mapping.  Both are best effort: older kernels lack
+ * MADV_POPULATE_WRITE and shmem THP depends on
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled.
+ */
+static void advise(struct shm_region *region, size_t start, size_t len)
+{
+  char *addr = (char *) region->data + start;
+
+  if (region->flags & SHM_ALLOC_THP)
+    madvise(addr, len, MADV_HUGEPAGE);
+
+  if (region->flags & SHM_ALLOC_POPULATE)
+    madvise(addr, len, MADV_POPULATE_WRITE);
+}
+
+/*
+ * Map |len| bytes of the file at |offset|, either anywhere or over the
+ * reservation at |addr|.
+ */
+static void *map_range(struct shm_region *region, void *addr, size_t len, off_t offset)
+{
+  int map_flags = MAP_SHARED;
+
+  if (addr)
+    map_flags |= MAP_FIXED;
+
+  /* THP advice has to land before the pages are faulted in. */
+  if ((region->flags & SHM_ALLOC_POPULATE) && !(region->flags & SHM_ALLOC_THP))
+    map_flags |= MAP_POPULATE;
+
+  return mmap(addr, len, PROT_READ | PROT_WRITE, map_flags, region->fd, offset);
+}
+
+/*
+ * Reserve |max_size| bytes of address space, aligned for the page size in
+ * use, without committing any memory.
+ */
+static void *reserve(size_t max_size, uint32_t flags)
+{
+  size_t align = shm_region_round_size(1, flags);
+  uintptr_t start, aligned;
+  void *addr;
+
+  addr = mmap(NULL, max_size + align, PROT_NONE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (addr == MAP_FAILED)
+    return NULL;
+
+  start = (uintptr_t) addr;
+  aligned = (start + align - 1) / align * align;
+  if (aligned > start)
+    munmap(addr, aligned - start);
+  munmap((void *) (aligned + max_size), start + align - aligned);
+
+  return (void *) aligned;
+}
+
+static int try_create_region(struct shm_region *region, size_t size,
+                             size_t max_size, uint32_t flags)
+{
+  void *base = NULL;
+  int fd;
+
+  fd = create_fd(&flags);
+  if (fd < 0)
+    return -1;
+
+  size = shm_region_round_size(size, flags);
+  if (ftruncate(fd, size) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  /* Not supported by the tmpfile fallback, which is fine to ignore. */
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+  region->fd = fd;
+  region->flags = flags;
+  region->reserved = 0;
+
+  if (max_size > size) {
+    region->reserved = shm_region_round_size(max_size, flags);
+    base = reserve(region->reserved, flags);
+    if (!base)
+      region->reserved = 0;
+  }
+
+  region->data = map_range(region, base, size, 0);
+  if (region->data == MAP_FAILED) {
+    if (base)
+      munmap(base, region->reserved);
+    close(fd);
+    return -1;
+  }
+  region->size = size;
+
+  if (flags & SHM_ALLOC_THP)
+    advise(region, 0, size);
+
+  return 0;
+}
+
+/* The hugetlb fallback flags: regular pages with THP advice. */
+static uint32_t without_hugetlb(uint32_t flags)
+{
+  return (flags & ~SHM_ALLOC_HUGETLB) | SHM_ALLOC_THP;
+}
+
+/*
+ * memfd_create(MFD_HUGETLB) succeeds even with no huge pages reserved;
+ * only mapping the file fails, with ENOMEM, so that is where to fall back.
+ */
+static int create_region(struct shm_region *region, size_t size,
+                         size_t max_size, uint32_t flags)
+{
+  if (try_create_region(region, size, max_size, flags) == 0)
+    return 0;
+  if (!(flags & SHM_ALLOC_HUGETLB))
+    return -1;
+
+  fprintf(stderr, "Can't map huge pages: %m, using transparent huge pages\n");
+  return try_create_region(region, size, max_size, without_hugetlb(flags));
+}
+
+int shm_region_create(struct shm_region *region, size_t size, uint32_t flags)
+{
+  return create_region(region, size, 0, flags);
+}
+
+int shm_region_create_reserved(struct shm_region *region, size_t size,
+                               size_t max_size, uint32_t flags)
+{
+  return create_region(region, size, max_size, flags);
+}
+
+/*
+ * Move a hugetlb region that can't grow to a new file of regular pages,
+ * copying what it held.  The old mapping and file go away.
+ */
+static int migrate(struct shm_region *region, size_t size)
+{
+  struct shm_region moved;
+
+  fprintf(stderr, "Can't map more huge pages: %m, moving to transparent huge pages\n");
+  if (try_create_region(&moved, size, 0, without_hugetlb(region->flags)) < 0)
+    return -1;
+
+  memcpy(moved.data, region->data, region->size);
+  shm_region_destroy(region);
+  *region = moved;
+
+  return 0;
+}
+
+int shm_region_grow(struct shm_region *region, size_t size)
+{
+  size_t old_size = region->size;
+  void *data;
+
+  size = shm_region_round_size(size, region->flags);
+  if (size <= old_size)
+    return 0;
+
+  if (ftruncate(region->fd, size) < 0)
+    return region->flags & SHM_ALLOC_HUGETLB ? migrate(region, size) : -1;
+
+  if (size <= region->reserved) {
+    /* Map the new tail into the reservation, nothing moves. */
+    data = map_range(region, (char *) region->data + old_size,
+                     size - old_size, old_size);
+    if (data == MAP_FAILED) {
+      /* MAP_FIXED failing leaves the reservation over the tail as it was. */
+      return region->flags & SHM_ALLOC_HUGETLB ? migrate(region, size) : -1;
+    }
+  } else {
+    if (region->reserved > old_size)
+      munmap((char *) region->data + old_size, region->reserved - old_size);
+    region->reserved = 0;
+
+    data = mremap(region->data, old_size, size, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED)
+      return region->flags & SHM_ALLOC_HUGETLB ? migrate(region, size) : -1;
+    region->data = data;
+  }
+
+  region->size = size;
+  advise(region, old_size, size - old_size);
+
+  return 0;
+}
+
+void shm_region_destroy(struct shm_region *region)
+{
+  munmap(region->data, region->reserved > region->size ? region->reserved : region->size);
+  close(region->fd);
+  region->data = NULL;
+  region->fd = -1;
+  region->size = 0;
+  region->reserved = 0;
+}
+
+uint32_t shm_alloc_flags_from_env(void)
+{
+  const char *env = getenv("SHM_ALLOC");
+  uint32_t flags = 0;
+
+  if (!env)
+    return SHM_ALLOC_POPULATE;
+
+  if (strstr(env, "hugetlb"))
+    flags |= SHM_ALLOC_HUGETLB;
+  if (strstr(env, "thp"))
+    flags |= SHM_ALLOC_THP;
+  if (strstr(env, "populate"))
+    flags |= SHM_ALLOC_POPULATE;
+
+  return flags;
+}
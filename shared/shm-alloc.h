@@ -0,0 +1,59 @@
+/*
+ * Anonymous shared memory for wl_shm pools.
+ *
+ * A region is a memfd sealed against shrinking (the compositor maps it
+ * too, so truncating it under its feet would SIGBUS the compositor) and
+ * mapped read/write in this process.  It can only ever grow.
+ */
+
+#ifndef SHM_ALLOC_H
+#define SHM_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_ALLOC_HUGETLB  (1 << 0) /* back with hugetlbfs pages (MFD_HUGETLB) */
+#define SHM_ALLOC_THP      (1 << 1) /* madvise(MADV_HUGEPAGE) the mapping */
+#define SHM_ALLOC_POPULATE (1 << 2) /* prefault the mapping (MAP_POPULATE) */
+
+struct shm_region {
+  int fd;
+  void *data;
+  size_t size;
+  size_t reserved; /* address space kept for growing in place, or 0 */
+  uint32_t flags;  /* flags actually in effect, see shm_region_create */
+};
+
+/*
+ * Create and map a region of at least |size| bytes.  |size| is rounded up
+ * to the page size in use.  If huge pages can't be reserved the region
+ * falls back to regular pages with THP advice and SHM_ALLOC_HUGETLB is
+ * cleared from region->flags.  Returns 0 on success, -1 with errno set.
+ */
+int shm_region_create(struct shm_region *region, size_t size, uint32_t flags);
+
+/*
+ * Like shm_region_create, but also reserve |max_size| bytes of address
+ * space so that growing up to that size never moves region->data.
+ */
+int shm_region_create_reserved(struct shm_region *region, size_t size,
+                               size_t max_size, uint32_t flags);
+
+/*
+ * Grow the region to at least |size| bytes.  Unless the region was created
+ * with enough reserved address space the mapping may move, so pointers
+ * into region->data must be recomputed afterwards.  A hugetlb region that
+ * runs out of huge pages moves to a new file of regular pages, as
+ * shm_region_create falls back, so region->fd can change too.
+ */
+int shm_region_grow(struct shm_region *region, size_t size);
+
+void shm_region_destroy(struct shm_region *region);
+
+/* Round |size| up to the page size |flags| would allocate with. */
+size_t shm_region_round_size(size_t size, uint32_t flags);
+
+/* Parse the SHM_ALLOC_* flags from the SHM_ALLOC environment variable. */
+uint32_t shm_alloc_flags_from_env(void);
+
+#endif
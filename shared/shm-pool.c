@@ -0,0 +1,342 @@
+/*
+ * Client wide wl_shm_pool with a first-fit slice allocator
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shm-pool.h"
+
+static size_t align_up(size_t size)
+{
+  return (size + SHM_POOL_ALIGN - 1) / SHM_POOL_ALIGN * SHM_POOL_ALIGN;
+}
+
+int shm_format_bpp(uint32_t format)
+{
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+  case WL_SHM_FORMAT_XRGB8888:
+  case WL_SHM_FORMAT_ABGR8888:
+  case WL_SHM_FORMAT_XBGR8888:
+    return 4;
+  case WL_SHM_FORMAT_RGB565:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+uint32_t shm_format_bit(uint32_t format)
+{
+  switch (format) {
+  case WL_SHM_FORMAT_ARGB8888:
+    return SHM_FORMAT_ARGB8888_BIT;
+  case WL_SHM_FORMAT_XRGB8888:
+    return SHM_FORMAT_XRGB8888_BIT;
+  case WL_SHM_FORMAT_RGB565:
+    return SHM_FORMAT_RGB565_BIT;
+  default:
+    return 0;
+  }
+}
+
+uint32_t shm_format_choose(uint32_t formats, int opaque, int bpp)
+{
+  if (bpp == 16) {
+    if (formats & SHM_FORMAT_RGB565_BIT)
+      return WL_SHM_FORMAT_RGB565;
+    fprintf(stderr, "Compositor doesn't support RGB565, using XRGB8888\n");
+    return WL_SHM_FORMAT_XRGB8888;
+  }
+
+  return opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+}
+
+enum pixel_format shm_format_to_pixel_format(uint32_t format)
+{
+  switch (format) {
+  case WL_SHM_FORMAT_XRGB8888:
+    return PIXEL_FORMAT_XRGB8888;
+  case WL_SHM_FORMAT_RGB565:
+    return PIXEL_FORMAT_RGB565;
+  default:
+    return PIXEL_FORMAT_ARGB8888;
+  }
+}
+
+/* Insert [offset, offset + size) into the free list, merging neighbours. */
+static int free_range(struct shm_pool *pool, size_t offset, size_t size)
+{
+  struct shm_extent *e;
+  int i;
+
+  for (i = 0; i < pool->n_free; i++) {
+    if (pool->free[i].offset > offset)
+      break;
+  }
+
+  if (i > 0 && pool->free[i - 1].offset + pool->free[i - 1].size == offset) {
+    e = &pool->free[i - 1];
+    e->size += size;
+    if (i < pool->n_free && e->offset + e->size == pool->free[i].offset) {
+      e->size += pool->free[i].size;
+      memmove(&pool->free[i], &pool->free[i + 1],
+              (pool->n_free - i - 1) * sizeof *pool->free);
+      pool->n_free--;
+    }
+    return 0;
+  }
+
+  if (i < pool->n_free && offset + size == pool->free[i].offset) {
+    pool->free[i].offset = offset;
+    pool->free[i].size += size;
+    return 0;
+  }
+
+  if (pool->n_free == pool->free_capacity) {
+    int capacity = pool->free_capacity ? pool->free_capacity * 2 : 8;
+
+    e = realloc(pool->free, capacity * sizeof *e);
+    if (!e)
+      return -1;
+    pool->free = e;
+    pool->free_capacity = capacity;
+  }
+
+  memmove(&pool->free[i + 1], &pool->free[i],
+          (pool->n_free - i) * sizeof *pool->free);
+  pool->free[i].offset = offset;
+  pool->free[i].size = size;
+  pool->n_free++;
+
+  return 0;
+}
+
+/* Take |size| bytes from the first free range large enough, or -1. */
+static int take_range(struct shm_pool *pool, size_t size, size_t *offset)
+{
+  int i;
+
+  for (i = 0; i < pool->n_free; i++) {
+    struct shm_extent *e = &pool->free[i];
+
+    if (e->size < size)
+      continue;
+
+    *offset = e->offset;
+    e->offset += size;
+    e->size -= size;
+    if (e->size == 0) {
+      memmove(e, e + 1, (pool->n_free - i - 1) * sizeof *e);
+      pool->n_free--;
+    }
+    return 0;
+  }
+
+  return -1;
+}
+
+static void unref_retired_pool(struct shm_retired_pool *retired)
+{
+  if (!retired || --retired->buffers > 0)
+    return;
+
+  wl_shm_pool_destroy(retired->pool);
+  free(retired);
+}
+
+void shm_slice_retire(struct shm_slice *slice)
+{
+  if (!slice->retired)
+    return;
+
+  wl_buffer_destroy(slice->retired);
+  unref_retired_pool(slice->retired_pool);
+  slice->retired = NULL;
+  slice->retired_pool = NULL;
+}
+
+/*
+ * The region moved to a new file, which only happens when a hugetlb pool
+ * runs out of huge pages: share the new file and give every slice a
+ * wl_buffer in it.  The compositor may still be reading the old wl_buffers,
+ * so they stay alive, along with the wl_shm_pool they came from, until
+ * shm_slice_retire.  A slice whose previous move is still pending has
+ * never handed out its newer buffer, which can go right away.  Should
+ * there be no memory to track the old pool it is destroyed at once, which
+ * the protocol allows: its buffers keep their memory either way.
+ */
+static void reshare(struct shm_pool *pool)
+{
+  struct shm_retired_pool *retired;
+  struct shm_slice *slice;
+
+  retired = calloc(1, sizeof *retired);
+  if (retired)
+    retired->pool = pool->pool;
+  else
+    wl_shm_pool_destroy(pool->pool);
+  pool->pool = wl_shm_create_pool(pool->shm, pool->region.fd, pool->region.size);
+
+  wl_list_for_each(slice, &pool->slices, link) {
+    if (slice->retired) {
+      wl_buffer_destroy(slice->buffer);
+    } else {
+      slice->retired = slice->buffer;
+      slice->retired_pool = retired;
+      if (retired)
+        retired->buffers++;
+    }
+    slice->buffer = wl_shm_pool_create_buffer(pool->pool, slice->offset, slice->width,
+                                              slice->height, slice->stride, slice->format);
+  }
+
+  /* No slices, nothing to wait for. */
+  if (retired && retired->buffers == 0) {
+    wl_shm_pool_destroy(retired->pool);
+    free(retired);
+  }
+}
+
+/*
+ * Grow the pool so that |size| contiguous bytes are free at its end.  The
+ * pool at least doubles so that a series of allocations costs a
+ * logarithmic number of resizes.
+ */
+static int grow(struct shm_pool *pool, size_t size)
+{
+  size_t old_size = pool->region.size;
+  size_t tail = 0, want;
+  int fd = pool->region.fd;
+
+  if (pool->n_free > 0) {
+    struct shm_extent *last = &pool->free[pool->n_free - 1];
+
+    if (last->offset + last->size == old_size)
+      tail = last->size;
+  }
+
+  want = old_size + size - tail;
+  if (want < old_size * 2)
+    want = old_size * 2;
+  if (want > SHM_POOL_MAX_SIZE)
+    want = SHM_POOL_MAX_SIZE;
+  if (want < old_size + size - tail) {
+    fprintf(stderr, "shm pool would exceed %zu bytes\n", SHM_POOL_MAX_SIZE);
+    return -1;
+  }
+
+  if (shm_region_grow(&pool->region, want) < 0) {
+    fprintf(stderr, "Can't grow shared memory: %m\n");
+    return -1;
+  }
+
+  if (pool->region.fd != fd)
+    reshare(pool);
+  else
+    wl_shm_pool_resize(pool->pool, pool->region.size);
+
+  return free_range(pool, old_size, pool->region.size - old_size);
+}
+
+struct shm_pool *shm_pool_create(struct wl_shm *shm, size_t size,
+                                 size_t max_size, uint32_t alloc_flags)
+{
+  struct shm_pool *pool;
+
+  if (max_size > SHM_POOL_MAX_SIZE)
+    max_size = SHM_POOL_MAX_SIZE;
+
+  pool = calloc(1, sizeof *pool);
+  if (!pool)
+    return NULL;
+
+  pool->shm = shm;
+  wl_list_init(&pool->slices);
+
+  if (shm_region_create_reserved(&pool->region, size, max_size, alloc_flags) < 0) {
+    fprintf(stderr, "Can't allocate shared memory: %m\n");
+    free(pool);
+    return NULL;
+  }
+
+  if (free_range(pool, 0, pool->region.size) < 0) {
+    shm_region_destroy(&pool->region);
+    free(pool);
+    return NULL;
+  }
+
+  pool->pool = wl_shm_create_pool(shm, pool->region.fd, pool->region.size);
+
+  return pool;
+}
+
+void shm_pool_destroy(struct shm_pool *pool)
+{
+  wl_shm_pool_destroy(pool->pool);
+  shm_region_destroy(&pool->region);
+  free(pool->free);
+  free(pool);
+}
+
+struct shm_slice *shm_pool_alloc(struct shm_pool *pool, int32_t width,
+                                 int32_t height, uint32_t format)
+{
+  struct shm_slice *slice;
+  int bpp = shm_format_bpp(format);
+  size_t stride, size, offset;
+
+  if (bpp == 0 || width <= 0 || height <= 0) {
+    fprintf(stderr, "Invalid shm buffer %dx%d format 0x%x\n", width, height, format);
+    return NULL;
+  }
+
+  stride = align_up((size_t) width * bpp);
+  size = align_up(stride * height);
+  if (stride > INT32_MAX || size > SHM_POOL_MAX_SIZE) {
+    fprintf(stderr, "shm buffer %dx%d is too large\n", width, height);
+    return NULL;
+  }
+
+  slice = calloc(1, sizeof *slice);
+  if (!slice)
+    return NULL;
+
+  if (take_range(pool, size, &offset) < 0) {
+    if (grow(pool, size) < 0 || take_range(pool, size, &offset) < 0) {
+      free(slice);
+      return NULL;
+    }
+  }
+
+  slice->pool = pool;
+  slice->offset = offset;
+  slice->size = size;
+  slice->width = width;
+  slice->height = height;
+  slice->stride = stride;
+  slice->format = format;
+  slice->buffer = wl_shm_pool_create_buffer(pool->pool, offset, width, height,
+                                            stride, format);
+  wl_list_insert(&pool->slices, &slice->link);
+
+  return slice;
+}
+
+void shm_slice_free(struct shm_slice *slice)
+{
+  struct shm_pool *pool = slice->pool;
+
+  shm_slice_retire(slice);
+  wl_buffer_destroy(slice->buffer);
+  wl_list_remove(&slice->link);
+
+  /*
+   * On allocation failure the range is leaked rather than lost track of
+   * in a corrupt list; it is still unmapped with the pool.
+   */
+  free_range(pool, slice->offset, slice->size);
+  free(slice);
+}
@@ -0,0 +1,129 @@
+/*
+ * One growable wl_shm_pool per client, sub-allocated into wl_buffers.
+ *
+ * Every buffer of every surface (main surfaces, subsurfaces, cursors,
+ * popups) is a slice of the same shared memory region, so creating a
+ * buffer costs neither a new file descriptor nor a new mapping on either
+ * side of the connection.  Slices start on 64 byte boundaries and their
+ * stride is padded to a multiple of 64 bytes, so rows never share cache
+ * lines.  When the pool runs out of room it is grown with
+ * wl_shm_pool_resize rather than replaced, so existing wl_buffers stay
+ * valid.  Only a hugetlb pool that runs out of huge pages moves to a new
+ * file; its slices then get new wl_buffers, and the old ones (and the old
+ * wl_shm_pool) are kept until their owner has seen them released.
+ */
+
+#ifndef SHM_POOL_H
+#define SHM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "pixel-fill.h"
+#include "shm-alloc.h"
+
+#define SHM_POOL_ALIGN 64
+
+/*
+ * wl_shm_pool sizes travel as int32 on the wire; stop at 1 GiB, which is
+ * a whole number of pages of every size in use.
+ */
+#define SHM_POOL_MAX_SIZE ((size_t) 1 << 30)
+
+struct shm_extent {
+  size_t offset, size;
+};
+
+/* A wl_shm_pool left behind by a move, alive while its buffers are. */
+struct shm_retired_pool {
+  struct wl_shm_pool *pool;
+  int buffers;
+};
+
+struct shm_pool {
+  struct wl_shm *shm;
+  struct wl_shm_pool *pool;
+  struct shm_region region;
+  struct wl_list slices;
+
+  /* free ranges, sorted by offset and never adjacent */
+  struct shm_extent *free;
+  int n_free, free_capacity;
+};
+
+struct shm_slice {
+  struct shm_pool *pool;
+  size_t offset, size;
+  int32_t width, height, stride;
+  uint32_t format;
+  struct wl_buffer *buffer; /* replaced if the pool moves to a new file */
+  struct wl_list link;
+
+  /* the buffer in the file the pool moved from, until it is retired */
+  struct wl_buffer *retired;
+  struct shm_retired_pool *retired_pool;
+};
+
+/*
+ * Create a pool of |size| bytes that can grow in place to |max_size|
+ * (beyond that the mapping has to move, see shm_region_grow).
+ */
+struct shm_pool *shm_pool_create(struct wl_shm *shm, size_t size,
+                                 size_t max_size, uint32_t alloc_flags);
+
+/* Destroy the pool.  All slices must have been freed. */
+void shm_pool_destroy(struct shm_pool *pool);
+
+/*
+ * Carve a |width| x |height| buffer of wl_shm |format| out of the pool,
+ * growing it if needed.  Returns NULL on error.
+ */
+struct shm_slice *shm_pool_alloc(struct shm_pool *pool, int32_t width,
+                                 int32_t height, uint32_t format);
+
+/* Destroy the slice's wl_buffers and give its memory back to the pool. */
+void shm_slice_free(struct shm_slice *slice);
+
+/*
+ * Destroy the wl_buffer |slice| had before the pool moved.  Call once the
+ * compositor has released it, before attaching slice->buffer instead.
+ */
+void shm_slice_retire(struct shm_slice *slice);
+
+/*
+ * Pixels of |slice|.  Only valid until the pool grows past its reserved
+ * address space, so look it up again after allocating.
+ */
+static inline void *shm_slice_data(const struct shm_slice *slice)
+{
+  return (char *) slice->pool->region.data + slice->offset;
+}
+
+/* Bytes per pixel of a wl_shm format, 0 if unknown. */
+int shm_format_bpp(uint32_t format);
+
+/*
+ * The wl_shm formats the samples can paint, as bits of a mask collected
+ * from wl_shm.format events.  ARGB8888 and XRGB8888 are always supported.
+ */
+#define SHM_FORMAT_ARGB8888_BIT (1 << 0)
+#define SHM_FORMAT_XRGB8888_BIT (1 << 1)
+#define SHM_FORMAT_RGB565_BIT   (1 << 2)
+#define SHM_FORMATS_REQUIRED (SHM_FORMAT_ARGB8888_BIT | SHM_FORMAT_XRGB8888_BIT)
+
+/* The mask bit of |format|, 0 for formats the samples can't paint. */
+uint32_t shm_format_bit(uint32_t format);
+
+/*
+ * Pick the cheapest of the advertised |formats| for content of |bpp| bits
+ * per pixel: RGB565 for 16, XRGB8888 when |opaque| (the compositor can skip
+ * blending), ARGB8888 otherwise.  Falls back to a 32 bpp format when the
+ * compositor doesn't offer RGB565.
+ */
+uint32_t shm_format_choose(uint32_t formats, int opaque, int bpp);
+
+/* The pixel-fill format to paint wl_shm |format| with, ARGB8888 if unknown. */
+enum pixel_format shm_format_to_pixel_format(uint32_t format);
+
+#endif
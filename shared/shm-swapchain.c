@@ -0,0 +1,157 @@
+/*
+ * SHM swapchain with wl_buffer release tracking
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shm-swapchain.h"
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+  struct shm_buffer *buffer = data;
+
+  buffer->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+  buffer_release
+};
+
+static int init_buffer(struct shm_swapchain *chain, struct shm_buffer *buffer)
+{
+  buffer->slice = shm_pool_alloc(chain->pool, chain->width, chain->height, chain->format);
+  if (!buffer->slice)
+    return -1;
+
+  buffer->chain = chain;
+  buffer->buffer = buffer->slice->buffer;
+  buffer->data = shm_slice_data(buffer->slice);
+  buffer->busy = 0;
+  buffer->last_used = 0;
+  chain->stride = buffer->slice->stride;
+  wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+
+  return 0;
+}
+
+struct shm_swapchain *shm_swapchain_create(struct shm_pool *pool,
+                                           int width, int height,
+                                           uint32_t format, int count)
+{
+  struct shm_swapchain *chain;
+
+  if (count < SHM_SWAPCHAIN_MIN_BUFFERS)
+    count = SHM_SWAPCHAIN_MIN_BUFFERS;
+  if (count > SHM_SWAPCHAIN_MAX_BUFFERS)
+    count = SHM_SWAPCHAIN_MAX_BUFFERS;
+
+  chain = calloc(1, sizeof *chain);
+  if (!chain)
+    return NULL;
+
+  chain->pool = pool;
+  chain->width = width;
+  chain->height = height;
+  chain->format = format;
+
+  for (chain->count = 0; chain->count < count; chain->count++) {
+    if (init_buffer(chain, &chain->buffers[chain->count]) < 0) {
+      shm_swapchain_destroy(chain);
+      return NULL;
+    }
+  }
+
+  return chain;
+}
+
+void shm_swapchain_destroy(struct shm_swapchain *chain)
+{
+  int i;
+
+  for (i = 0; i < chain->count; i++)
+    shm_slice_free(chain->buffers[i].slice);
+  free(chain);
+}
+
+/*
+ * Pick up the wl_buffer the pool made when it moved to a new file, once
+ * the compositor has released the old one.
+ */
+static void sync_buffer(struct shm_buffer *buffer)
+{
+  if (buffer->buffer == buffer->slice->buffer || buffer->busy)
+    return;
+
+  shm_slice_retire(buffer->slice);
+  buffer->buffer = buffer->slice->buffer;
+  buffer->busy = 0;
+  wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+}
+
+static struct shm_buffer *find_free(struct shm_swapchain *chain)
+{
+  struct shm_buffer *oldest = NULL;
+  int i;
+
+  for (i = 0; i < chain->count; i++) {
+    struct shm_buffer *buffer = &chain->buffers[i];
+
+    sync_buffer(buffer);
+    if (buffer->busy)
+      continue;
+    if (!oldest || buffer->last_used < oldest->last_used)
+      oldest = buffer;
+  }
+
+  return oldest;
+}
+
+static struct shm_buffer *grow(struct shm_swapchain *chain)
+{
+  struct shm_buffer *buffer;
+
+  if (chain->count >= SHM_SWAPCHAIN_MAX_BUFFERS)
+    return NULL;
+
+  buffer = &chain->buffers[chain->count];
+  if (init_buffer(chain, buffer) < 0)
+    return NULL;
+  chain->count++;
+
+  return buffer;
+}
+
+struct shm_buffer *shm_swapchain_acquire(struct shm_swapchain *chain,
+                                         struct wl_display *display,
+                                         enum shm_acquire_mode mode)
+{
+  struct shm_buffer *buffer;
+
+  buffer = find_free(chain);
+  if (!buffer && mode == SHM_ACQUIRE_GROW)
+    buffer = grow(chain);
+
+  /* Every buffer is on screen or queued, wait for a release event. */
+  while (!buffer) {
+    if (wl_display_dispatch(display) == -1)
+      return NULL;
+    buffer = find_free(chain);
+  }
+
+  /* The pool may have been moved by another surface growing it. */
+  buffer->data = shm_slice_data(buffer->slice);
+
+  return buffer;
+}
+
+void shm_swapchain_attach(struct shm_swapchain *chain,
+                          struct shm_buffer *buffer,
+                          struct wl_surface *surface)
+{
+  sync_buffer(buffer);
+  buffer->busy = 1;
+  buffer->last_used = ++chain->sequence;
+  wl_surface_attach(surface, buffer->buffer, 0, 0);
+}
@@ -0,0 +1,80 @@
+/*
+ * SHM swapchain: a small ring of wl_buffers carved out of a shared
+ * client wide shm_pool.
+ *
+ * Buffers are handed out by shm_swapchain_acquire() and become busy once
+ * they are attached to a surface.  The compositor gives them back through
+ * wl_buffer.release, after which they can be drawn into again.
+ */
+
+#ifndef SHM_SWAPCHAIN_H
+#define SHM_SWAPCHAIN_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "shm-pool.h"
+
+#define SHM_SWAPCHAIN_MIN_BUFFERS 2
+#define SHM_SWAPCHAIN_MAX_BUFFERS 4
+
+/*
+ * What shm_swapchain_acquire() does when every buffer is still held by
+ * the compositor.
+ */
+enum shm_acquire_mode {
+  SHM_ACQUIRE_BLOCK, /* dispatch events until a buffer is released */
+  SHM_ACQUIRE_GROW,  /* add a buffer if below the maximum, else block */
+};
+
+struct shm_swapchain;
+
+struct shm_buffer {
+  struct shm_swapchain *chain;
+  struct shm_slice *slice;
+  struct wl_buffer *buffer;
+  void *data; /* refreshed by shm_swapchain_acquire */
+  int busy;
+  uint64_t last_used; /* attach sequence number, 0 if never attached */
+};
+
+struct shm_swapchain {
+  struct shm_pool *pool;
+
+  int width, height, stride;
+  uint32_t format;
+
+  int count;
+  struct shm_buffer buffers[SHM_SWAPCHAIN_MAX_BUFFERS];
+  uint64_t sequence;
+};
+
+/*
+ * Create a swapchain of |count| buffers (clamped to 2..4) allocated from
+ * |pool|.  The stride is chosen by the pool, see chain->stride.
+ * Returns NULL on error.
+ */
+struct shm_swapchain *shm_swapchain_create(struct shm_pool *pool,
+                                           int width, int height,
+                                           uint32_t format, int count);
+
+void shm_swapchain_destroy(struct shm_swapchain *chain);
+
+/*
+ * Return the free buffer that has been idle the longest.  If none is free,
+ * either block on |display| or grow the chain, depending on |mode|.
+ * Returns NULL if the display connection fails while waiting.
+ */
+struct shm_buffer *shm_swapchain_acquire(struct shm_swapchain *chain,
+                                         struct wl_display *display,
+                                         enum shm_acquire_mode mode);
+
+/*
+ * Attach |buffer| to |surface| and mark it busy until the compositor
+ * releases it.  The caller still damages and commits the surface.
+ */
+void shm_swapchain_attach(struct shm_swapchain *chain,
+                          struct shm_buffer *buffer,
+                          struct wl_surface *surface);
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Texture sorted quad batching through a streaming VBO
+ */
+
+#define GL_GLEXT_PROTOTYPES
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "sprite-batch.h"
+
+/* The most quads whose vertices 16 bit indices can address. */
+#define BUFFER_QUADS 16384
+
+struct vertex {
+  GLfloat x, y, u, v;
+  uint32_t color;
+};
+
+#define QUAD_BYTES (4 * sizeof(struct vertex))
+
+struct sprite_batch {
+  GLuint vbo, ibo;
+  int used;                  /* quads written since the VBO was last orphaned */
+
+  struct sprite *sprites;
+  uint64_t *keys;            /* texture << 32 | index, sorted at flush */
+  int count, capacity;
+  int sorted;                /* textures were queued in nondecreasing order */
+  GLuint last;
+
+  struct vertex *staging;    /* BUFFER_QUADS quads */
+};
+
+struct sprite_batch *sprite_batch_create(void)
+{
+  struct sprite_batch *batch = calloc(1, sizeof(*batch));
+  GLushort *indices;
+  int i;
+
+  if (!batch)
+    return NULL;
+  batch->staging = malloc(BUFFER_QUADS * QUAD_BYTES);
+  indices = malloc(BUFFER_QUADS * 6 * sizeof(*indices));
+  if (!batch->staging || !indices) {
+    free(indices);
+    free(batch->staging);
+    free(batch);
+    return NULL;
+  }
+
+  /* Same corner order as a GL_TRIANGLE_STRIP quad. */
+  for (i = 0; i < BUFFER_QUADS; i++) {
+    GLushort *q = indices + i * 6;
+
+    q[0] = i * 4;
+    q[1] = q[4] = i * 4 + 1;
+    q[2] = q[3] = i * 4 + 2;
+    q[5] = i * 4 + 3;
+  }
+
+  glGenBuffers(1, &batch->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, BUFFER_QUADS * 6 * sizeof(*indices), indices,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  free(indices);
+
+  glGenBuffers(1, &batch->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+  glBufferData(GL_ARRAY_BUFFER, BUFFER_QUADS * QUAD_BYTES, NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  batch->sorted = 1;
+  return batch;
+}
+
+void sprite_batch_destroy(struct sprite_batch *batch)
+{
+  if (!batch)
+    return;
+  glDeleteBuffers(1, &batch->vbo);
+  glDeleteBuffers(1, &batch->ibo);
+  free(batch->sprites);
+  free(batch->keys);
+  free(batch->staging);
+  free(batch);
+}
+
+int sprite_batch_add(struct sprite_batch *batch, const struct sprite *sprite)
+{
+  if (batch->count == batch->capacity) {
+    int capacity = batch->capacity ? batch->capacity * 2 : 256;
+    struct sprite *sprites = realloc(batch->sprites, capacity * sizeof(*sprites));
+    uint64_t *keys;
+
+    if (!sprites)
+      return -1;
+    batch->sprites = sprites;
+    keys = realloc(batch->keys, capacity * sizeof(*keys));
+    if (!keys)
+      return -1;
+    batch->keys = keys;
+    batch->capacity = capacity;
+  }
+
+  if (batch->count && sprite->texture < batch->last)
+    batch->sorted = 0;
+  batch->last = sprite->texture;
+  batch->sprites[batch->count++] = *sprite;
+  return 0;
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+  uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+
+  return ka < kb ? -1 : ka > kb;
+}
+
+/* The |i|th quad in draw order. */
+static inline const struct sprite *sorted_sprite(const struct sprite_batch *batch, int i)
+{
+  return batch->sorted ? &batch->sprites[i] : &batch->sprites[(uint32_t) batch->keys[i]];
+}
+
+static void write_quads(struct sprite_batch *batch, int first, int n)
+{
+  struct vertex *v = batch->staging;
+  int i;
+
+  for (i = first; i < first + n; i++, v += 4) {
+    const struct sprite *s = sorted_sprite(batch, i);
+
+    v[0] = (struct vertex) { s->x0, s->y0, s->u0, s->v0, s->color };
+    v[1] = (struct vertex) { s->x1, s->y0, s->u1, s->v0, s->color };
+    v[2] = (struct vertex) { s->x0, s->y1, s->u0, s->v1, s->color };
+    v[3] = (struct vertex) { s->x1, s->y1, s->u1, s->v1, s->color };
+  }
+}
+
+/* Draw quads [first, first + n), uploaded at quad |base| of the VBO. */
+static void draw_runs(struct sprite_batch *batch, int first, int n, int base,
+                      struct sprite_batch_stats *stats)
+{
+  int run = first, i;
+
+  for (i = first + 1; i <= first + n; i++) {
+    GLuint texture = sorted_sprite(batch, run)->texture;
+
+    if (i < first + n && sorted_sprite(batch, i)->texture == texture)
+      continue;
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDrawElements(GL_TRIANGLES, (i - run) * 6, GL_UNSIGNED_SHORT,
+                   (const void *) ((size_t) (base + run - first) * 6 * sizeof(GLushort)));
+    stats->draws++;
+    run = i;
+  }
+}
+
+void sprite_batch_flush(struct sprite_batch *batch, struct sprite_batch_stats *stats)
+{
+  struct sprite_batch_stats s = { 0 };
+  int i, n;
+
+  s.quads = batch->count;
+  if (!batch->count)
+    goto out;
+
+  if (!batch->sorted) {
+    for (i = 0; i < batch->count; i++)
+      batch->keys[i] = (uint64_t) batch->sprites[i].texture << 32 | (uint32_t) i;
+    qsort(batch->keys, batch->count, sizeof(*batch->keys), compare_keys);
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+  glVertexPointer(2, GL_FLOAT, sizeof(struct vertex), (const void *) offsetof(struct vertex, x));
+  glTexCoordPointer(2, GL_FLOAT, sizeof(struct vertex), (const void *) offsetof(struct vertex, u));
+  glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(struct vertex),
+                 (const void *) offsetof(struct vertex, color));
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+
+  /*
+   * Append behind what earlier flushes wrote, so frames with few quads
+   * share one buffer; once it is full, orphan it rather than wait for the
+   * GPU to finish reading.
+   */
+  for (i = 0; i < batch->count; i += n) {
+    if (batch->used == BUFFER_QUADS) {
+      glBufferData(GL_ARRAY_BUFFER, BUFFER_QUADS * QUAD_BYTES, NULL, GL_STREAM_DRAW);
+      batch->used = 0;
+    }
+    n = batch->count - i;
+    if (n > BUFFER_QUADS - batch->used)
+      n = BUFFER_QUADS - batch->used;
+
+    write_quads(batch, i, n);
+    glBufferSubData(GL_ARRAY_BUFFER, batch->used * QUAD_BYTES, n * QUAD_BYTES, batch->staging);
+    s.uploads++;
+    draw_runs(batch, i, n, batch->used, &s);
+    batch->used += n;
+  }
+
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  batch->count = 0;
+  batch->sorted = 1;
+
+out:
+  if (stats)
+    *stats = s;
+}
@@ -0,0 +1,63 @@
+/*
+ * Batched textured quads for the fixed function GL samples.
+ *
+ * Quads are queued with sprite_batch_add() and drawn by sprite_batch_flush()
+ * grouped by texture, one glDrawElements() per run of quads sharing a
+ * texture.  Vertices stream through a single VBO that is filled with
+ * glBufferSubData() and orphaned when full, so the driver never has to copy
+ * client arrays at draw time; indices come from a static element buffer.
+ *
+ * Quads are stably sorted by texture, so quads of one texture keep their
+ * order but are drawn before or after those of other textures.  Where
+ * overlapping quads of different textures must blend in submission order,
+ * flush between them.
+ *
+ * Create, flush and destroy with the GL context current.
+ */
+
+#ifndef SPRITE_BATCH_H
+#define SPRITE_BATCH_H
+
+#include <stdint.h>
+#include <GL/gl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sprite_batch;
+
+/* Axis aligned quad, in whatever space the current matrices expect. */
+struct sprite {
+  GLuint texture;
+  float x0, y0, x1, y1;
+  float u0, v0, u1, v1;
+  uint32_t color;            /* RGBA bytes in memory order, modulates the texture */
+};
+
+struct sprite_batch_stats {
+  int quads;
+  int draws;                 /* glDrawElements() calls */
+  int uploads;               /* glBufferSubData() calls */
+};
+
+/* Returns NULL if out of memory. */
+struct sprite_batch *sprite_batch_create(void);
+
+void sprite_batch_destroy(struct sprite_batch *batch);
+
+/* Queue a quad.  Returns -1 if out of memory, the quad is dropped. */
+int sprite_batch_add(struct sprite_batch *batch, const struct sprite *sprite);
+
+/*
+ * Draw and clear everything queued, and fill |stats| if not NULL.  Client
+ * arrays are left disabled, buffers unbound and the current color
+ * undefined; GL_TEXTURE_2D must already be enabled.
+ */
+void sprite_batch_flush(struct sprite_batch *batch, struct sprite_batch_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
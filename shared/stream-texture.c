@@ -0,0 +1,240 @@
+/*
+ * Ring buffered streaming textures with damage tracked sub-image uploads
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include "stream-texture.h"
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+
+struct stream_slot {
+  GLuint texture;
+  GLuint pbo;                /* GLES3 only */
+  struct damage damage;      /* what changed since this texture was written */
+};
+
+struct stream_texture {
+  int width, height;
+  int ring, current;         /* current: the slot last written, -1 before that */
+  struct stream_slot slots[STREAM_TEXTURE_MAX_RING];
+
+  /* GLES3 entry points; the EXT_map_buffer_range and OES_mapbuffer
+   * prototypes and bits are the same as the core ones. */
+  PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+  PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+
+  uint8_t *scratch;          /* GLES2: one rectangle, tightly packed */
+};
+
+static int is_gles3(void)
+{
+  const char *version = (const char *) glGetString(GL_VERSION);
+
+  return version && strncmp(version, "OpenGL ES ", 10) == 0 && version[10] >= '3';
+}
+
+struct stream_texture *stream_texture_create(int width, int height, int ring)
+{
+  struct stream_texture *stream;
+  int i;
+
+  stream = calloc(1, sizeof *stream);
+  if (!stream)
+    return NULL;
+  stream->width = width;
+  stream->height = height;
+  stream->ring = ring < 1 ? 1 : ring > STREAM_TEXTURE_MAX_RING ? STREAM_TEXTURE_MAX_RING : ring;
+  stream->current = -1;
+
+  if (is_gles3()) {
+    stream->map_buffer_range =
+      (PFNGLMAPBUFFERRANGEEXTPROC) eglGetProcAddress("glMapBufferRange");
+    stream->unmap_buffer = (PFNGLUNMAPBUFFEROESPROC) eglGetProcAddress("glUnmapBuffer");
+    if (!stream->unmap_buffer)
+      stream->map_buffer_range = NULL;
+  }
+  if (!stream->map_buffer_range) {
+    stream->scratch = malloc((size_t) width * height * 4);
+    if (!stream->scratch) {
+      free(stream);
+      return NULL;
+    }
+  }
+
+  for (i = 0; i < stream->ring; i++) {
+    struct stream_slot *slot = &stream->slots[i];
+
+    glGenTextures(1, &slot->texture);
+    glBindTexture(GL_TEXTURE_2D, slot->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    /* Its content is undefined until written in full. */
+    damage_add(&slot->damage, 0, 0, width, height, width, height);
+
+    if (stream->map_buffer_range) {
+      glGenBuffers(1, &slot->pbo);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) width * height * 4, NULL,
+                   GL_STREAM_DRAW);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+  }
+
+  return stream;
+}
+
+void stream_texture_destroy(struct stream_texture *stream)
+{
+  int i;
+
+  for (i = 0; i < stream->ring; i++) {
+    glDeleteTextures(1, &stream->slots[i].texture);
+    if (stream->slots[i].pbo)
+      glDeleteBuffers(1, &stream->slots[i].pbo);
+  }
+  free(stream->scratch);
+  free(stream);
+}
+
+static void copy_rect(uint8_t *dst, const uint8_t *pixels, int stride,
+                      const struct damage_rect *r)
+{
+  size_t row = (size_t) r->width * 4;
+  int y;
+
+  for (y = 0; y < r->height; y++)
+    memcpy(dst + y * row, pixels + (size_t) (r->y + y) * stride + (size_t) r->x * 4, row);
+}
+
+static void upload_client(struct stream_texture *stream, const uint8_t *pixels, int stride,
+                          const struct damage *damage)
+{
+  int i;
+
+  for (i = 0; i < damage->n_rects; i++) {
+    const struct damage_rect *r = &damage->rects[i];
+
+    /* Whole rows of a tightly packed image can be read in place. */
+    if (r->width == stream->width && stride == stream->width * 4) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, r->y, r->width, r->height,
+                      GL_RGBA, GL_UNSIGNED_BYTE, pixels + (size_t) r->y * stride);
+    } else {
+      copy_rect(stream->scratch, pixels, stride, r);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->width, r->height,
+                      GL_RGBA, GL_UNSIGNED_BYTE, stream->scratch);
+    }
+  }
+}
+
+/* Returns -1 if the buffer can't be mapped; nothing has been uploaded then. */
+static int upload_pbo(struct stream_texture *stream, struct stream_slot *slot,
+                      const uint8_t *pixels, int stride, const struct damage *damage)
+{
+  struct damage bounds;
+  size_t size = 0, offset = 0;
+  uint8_t *map;
+  int i;
+
+  for (i = 0; i < damage->n_rects; i++)
+    size += (size_t) damage->rects[i].width * damage->rects[i].height * 4;
+
+  /* Overlapping rectangles may add up to more than the buffer holds. */
+  if (size > (size_t) stream->width * stream->height * 4) {
+    struct damage_rect b = damage->rects[0];
+
+    for (i = 1; i < damage->n_rects; i++) {
+      const struct damage_rect *r = &damage->rects[i];
+      int32_t x1 = b.x + b.width > r->x + r->width ? b.x + b.width : r->x + r->width;
+      int32_t y1 = b.y + b.height > r->y + r->height ? b.y + b.height : r->y + r->height;
+
+      b.x = b.x < r->x ? b.x : r->x;
+      b.y = b.y < r->y ? b.y : r->y;
+      b.width = x1 - b.x;
+      b.height = y1 - b.y;
+    }
+    bounds.n_rects = 1;
+    bounds.rects[0] = b;
+    damage = &bounds;
+    size = (size_t) b.width * b.height * 4;
+  }
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->pbo);
+  /* Invalidation lets the driver hand out fresh memory instead of waiting
+   * for the GPU to finish the last upload from this buffer. */
+  map = stream->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_BUFFER_BIT_EXT);
+  if (!map) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return -1;
+  }
+  for (i = 0; i < damage->n_rects; i++) {
+    const struct damage_rect *r = &damage->rects[i];
+
+    copy_rect(map + offset, pixels, stride, r);
+    offset += (size_t) r->width * r->height * 4;
+  }
+  stream->unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+
+  for (i = 0, offset = 0; i < damage->n_rects; i++) {
+    const struct damage_rect *r = &damage->rects[i];
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y, r->width, r->height,
+                    GL_RGBA, GL_UNSIGNED_BYTE, (const void *) offset);
+    offset += (size_t) r->width * r->height * 4;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return 0;
+}
+
+GLuint stream_texture_update(struct stream_texture *stream, const void *pixels, int stride,
+                             const struct damage *dirty)
+{
+  struct stream_slot *slot;
+  int i, next = (stream->current + 1) % stream->ring;
+
+  for (i = 0; i < stream->ring; i++)
+    damage_union(&stream->slots[i].damage, dirty);
+
+  slot = &stream->slots[next];
+  glBindTexture(GL_TEXTURE_2D, slot->texture);
+
+  if (!damage_is_empty(&slot->damage)) {
+    int uploaded = slot->pbo && upload_pbo(stream, slot, pixels, stride, &slot->damage) == 0;
+
+    if (!uploaded) {
+      if (!stream->scratch)
+        stream->scratch = malloc((size_t) stream->width * stream->height * 4);
+      if (stream->scratch) {
+        upload_client(stream, pixels, stride, &slot->damage);
+        uploaded = 1;
+      }
+    }
+    /*
+     * Otherwise keep the damage for the next call, and stay on the
+     * texture from the last upload rather than show this stale one.
+     */
+    if (!uploaded)
+      return stream_texture_current(stream);
+    damage_clear(&slot->damage);
+  }
+
+  stream->current = next;
+  return slot->texture;
+}
+
+GLuint stream_texture_current(const struct stream_texture *stream)
+{
+  return stream->current < 0 ? 0 : stream->slots[stream->current].texture;
+}
@@ -0,0 +1,50 @@
+/*
+ * Textures for continuously changing content.
+ *
+ * Storage is allocated once, as a ring of two or three same sized RGBA
+ * textures.  Each update writes the next texture in the ring, one the GPU
+ * has most likely finished sampling, so the upload doesn't have to wait
+ * for the frame that is still reading the previous one.  Only damaged
+ * rectangles are uploaded, with glTexSubImage2D(); each texture
+ * accumulates the damage of the updates it missed, the way SHM buffers
+ * track buffer age.
+ *
+ * On GLES3 contexts the rectangles go through a pixel unpack buffer per
+ * texture, mapped with invalidation so the copy never waits on the GPU
+ * either.  On GLES2 rectangles narrower than the image are packed into a
+ * scratch buffer first, as there is no GL_UNPACK_ROW_LENGTH.
+ *
+ * All calls need the GL context to be current.
+ */
+
+#ifndef STREAM_TEXTURE_H
+#define STREAM_TEXTURE_H
+
+#include <GLES2/gl2.h>
+
+#include "damage.h"
+
+#define STREAM_TEXTURE_MAX_RING 3
+
+struct stream_texture;
+
+/* |ring| is clamped to [1, STREAM_TEXTURE_MAX_RING].  Returns NULL if out of memory. */
+struct stream_texture *stream_texture_create(int width, int height, int ring);
+
+void stream_texture_destroy(struct stream_texture *stream);
+
+/*
+ * Upload what |dirty| covers of |pixels|, a whole RGBA image |stride|
+ * bytes per row, into the next texture of the ring and return that
+ * texture.  The first update of each texture uploads the whole image.
+ * If nothing could be uploaded for lack of memory, the ring doesn't move
+ * and the previous texture is returned instead, 0 if there is none.
+ * May leave GL_TEXTURE_2D bound to some texture of the ring.
+ */
+GLuint stream_texture_update(struct stream_texture *stream, const void *pixels, int stride,
+                             const struct damage *dirty);
+
+/* The texture written by the last update, 0 before the first. */
+GLuint stream_texture_current(const struct stream_texture *stream);
+
+#endif
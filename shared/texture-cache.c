@@ -0,0 +1,218 @@
+/*
+ * Decoded image cache for GL textures
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <SOIL/SOIL.h>
+
+#include "mipmap.h"
+#include "pixel-convert.h"
+#include "raw-texture.h"
+#include "texture-cache.h"
+
+struct texture_cache *texture_cache_create(void)
+{
+  return calloc(1, sizeof(struct texture_cache));
+}
+
+void texture_cache_destroy(struct texture_cache *cache)
+{
+  struct texture_cache_entry *entry, *next;
+
+  for (entry = cache->entries; entry; entry = next) {
+    next = entry->next;
+    if (entry->texture)
+      glDeleteTextures(1, &entry->texture);
+    free(entry->path);
+    free(entry);
+  }
+
+  free(cache);
+}
+
+static int same_version(const struct texture_cache_entry *entry, const struct stat *st)
+{
+  return entry->dev == st->st_dev && entry->ino == st->st_ino &&
+         entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Bind the entry's texture, creating it on first use. */
+static void bind_texture(struct texture_cache_entry *entry, int levels)
+{
+  if (!entry->texture) {
+    glGenTextures(1, &entry->texture);
+    glBindTexture(GL_TEXTURE_2D, entry->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, entry->texture);
+  }
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+/* One level of a new version, replaced in place if the layout is unchanged. */
+static void upload_level(int replace, int level, int width, int height, const void *rgba)
+{
+  if (replace)
+    glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+  else
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
+
+/* GLES2 only mipmaps power of two sizes unless GL_OES_texture_npot is there. */
+static int can_mipmap(int width, int height)
+{
+  const char *extensions;
+
+  if ((width & (width - 1)) == 0 && (height & (height - 1)) == 0)
+    return 1;
+
+  extensions = (const char *) glGetString(GL_EXTENSIONS);
+  return extensions && strstr(extensions, "GL_OES_texture_npot") != NULL;
+}
+
+static int load_image(struct texture_cache_entry *entry)
+{
+  int width, height, level, replace;
+  struct mip_chain chain;
+  unsigned char *image;
+  void *rgba;
+
+  image = SOIL_load_image(entry->path, &width, &height, 0, SOIL_LOAD_RGB);
+  if (!image) {
+    fprintf(stderr, "Can't load %s: %s\n", entry->path, SOIL_last_result());
+    return -1;
+  }
+
+  /* Tightly packed RGB rows need GL_UNPACK_ALIGNMENT 1 and usually a driver
+   * side conversion; upload 4 byte aligned RGBA instead. */
+  rgba = malloc((size_t) width * height * 4);
+  if (!rgba) {
+    SOIL_free_image_data(image);
+    return -1;
+  }
+  pixel_convert_rgb_to_rgba(rgba, image, (size_t) width * height);
+  SOIL_free_image_data(image);
+
+  /* Without mips, minified images alias and read far more texels than shown. */
+  if (!can_mipmap(width, height) ||
+      mip_chain_build(&chain, rgba, width, height, MIP_FILTER_BOX, MIP_SRGB, NULL) < 0) {
+    chain = (struct mip_chain) {
+      .levels = 1,
+      .level[0] = { rgba, width, height, (size_t) width * 4 },
+    };
+  }
+
+  replace = entry->width == width && entry->height == height && entry->levels == chain.levels;
+  bind_texture(entry, chain.levels);
+  for (level = 0; level < chain.levels; level++)
+    upload_level(replace, level, chain.level[level].width, chain.level[level].height,
+                 chain.level[level].data);
+  mip_chain_release(&chain);
+  free(rgba);
+
+  entry->width = width;
+  entry->height = height;
+  entry->levels = chain.levels;
+  return 0;
+}
+
+/* GL reads the pixels straight out of the mapping. */
+static int load_raw_texture(struct texture_cache_entry *entry)
+{
+  struct raw_texture tex;
+  int levels, level, replace;
+
+  if (raw_texture_open(&tex, entry->path) < 0)
+    return -1;
+
+  levels = tex.header->levels;
+  replace = entry->width == (int) tex.header->width && entry->height == (int) tex.header->height &&
+            entry->levels == levels;
+  bind_texture(entry, levels);
+  for (level = 0; level < levels; level++) {
+    int width, height;
+    const void *pixels = raw_texture_level(&tex, level, &width, &height);
+
+    upload_level(replace, level, width, height, pixels);
+  }
+
+  entry->width = tex.header->width;
+  entry->height = tex.header->height;
+  entry->levels = levels;
+  raw_texture_close(&tex);
+  return 0;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+  size_t n = strlen(s), m = strlen(suffix);
+
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int load_file(struct texture_cache_entry *entry)
+{
+  if (has_suffix(entry->path, ".rawtex"))
+    return load_raw_texture(entry);
+  return load_image(entry);
+}
+
+GLuint texture_cache_load(const char *path)
+{
+  struct texture_cache_entry entry = { .path = (char *) path };
+
+  if (load_file(&entry) < 0)
+    return 0;
+  return entry.texture;
+}
+
+GLuint texture_cache_get(struct texture_cache *cache, const char *path)
+{
+  struct texture_cache_entry *entry;
+  struct stat st;
+
+  for (entry = cache->entries; entry; entry = entry->next)
+    if (strcmp(entry->path, path) == 0)
+      break;
+
+  if (!entry) {
+    entry = calloc(1, sizeof *entry);
+    if (!entry)
+      return 0;
+    entry->path = strdup(path);
+    if (!entry->path) {
+      free(entry);
+      return 0;
+    }
+    entry->next = cache->entries;
+    cache->entries = entry;
+
+    if (stat(path, &st) < 0) {
+      fprintf(stderr, "Can't stat %s: %m\n", path);
+      return 0;
+    }
+  } else if (stat(path, &st) < 0 || same_version(entry, &st)) {
+    /* Gone may mean mid-replace; keep serving what is resident. */
+    return entry->texture;
+  }
+
+  /* Record the version even if it fails to load, so it isn't retried every
+   * frame. */
+  entry->dev = st.st_dev;
+  entry->ino = st.st_ino;
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtim;
+  load_file(entry);
+  return entry->texture;
+}
@@ -0,0 +1,61 @@
+/*
+ * Decoded image cache for GL textures.
+ *
+ * Images are decoded and uploaded once, then served from the resident
+ * texture.  Entries are keyed by path and revalidated with a stat() on
+ * every lookup: when the file's device, inode, size or mtime change, it is
+ * decoded again and re-uploaded into the same texture name, so callers
+ * holding the name keep a valid texture.
+ *
+ * Files named *.rawtex (see raw-texture.h) are mapped and uploaded as they
+ * are, mip levels included; anything else is decoded with SOIL and given
+ * an sRGB correct box filtered mip chain where GLES2 allows it.
+ *
+ * All calls need the GL context the textures belong to to be current.
+ */
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <GLES2/gl2.h>
+
+struct texture_cache_entry {
+  struct texture_cache_entry *next;
+  char *path;
+  GLuint texture; /* 0 until the file decodes */
+  int width, height, levels;
+
+  /* the file version last loaded, or last failed to load */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+struct texture_cache {
+  struct texture_cache_entry *entries;
+};
+
+struct texture_cache *texture_cache_create(void);
+
+/* Deletes every cached texture. */
+void texture_cache_destroy(struct texture_cache *cache);
+
+/*
+ * The texture for the image at |path|, loading it if it is new or changed
+ * on disk.  A file that fails to decode or has gone away keeps its last
+ * good texture, if any; 0 means none ever loaded.  A failed version is not
+ * retried until the file changes again.  May leave GL_TEXTURE_2D bound to
+ * the returned texture.
+ */
+GLuint texture_cache_get(struct texture_cache *cache, const char *path);
+
+/*
+ * Load |path| the same way into a new texture that the caller owns,
+ * bypassing the cache.  Returns 0 if it fails to decode.
+ */
+GLuint texture_cache_load(const char *path);
+
+#endif
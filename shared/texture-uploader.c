@@ -0,0 +1,322 @@
+/*
+ * Background texture uploads through a shared EGL context
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "texture-cache.h"
+#include "texture-uploader.h"
+
+#define REVALIDATE_MS 250
+
+struct upload_entry {
+  struct upload_entry *next;
+  char *path;                /* immutable once queued */
+
+  /* render thread only */
+  GLuint texture;
+
+  /* under the mutex: a finished upload the render thread hasn't taken yet */
+  GLuint pending;
+  EGLSyncKHR fence;          /* EGL_NO_SYNC_KHR once complete */
+  int check;                 /* the worker should stat the file */
+
+  /* worker only: the file version last loaded, or last failed to load */
+  int seen;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+};
+
+struct texture_uploader {
+  EGLDisplay display;
+  EGLContext context;
+  EGLSurface surface;
+
+  PFNEGLCREATESYNCKHRPROC create_sync;
+  PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+  PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  struct upload_entry *entries;
+  int started;               /* -1: the worker couldn't make its context current */
+  int quit;
+  pthread_t thread;
+};
+
+static int has_extension(EGLDisplay display, const char *name)
+{
+  const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+
+  return extensions && strstr(extensions, name) != NULL;
+}
+
+/* A changed file, or a new entry.  Called by the worker without the mutex. */
+static int changed(struct upload_entry *entry)
+{
+  struct stat st;
+
+  /* Gone may mean mid-replace; keep what is resident. */
+  if (stat(entry->path, &st) < 0)
+    return 0;
+  if (entry->seen && entry->dev == st.st_dev && entry->ino == st.st_ino &&
+      entry->size == st.st_size && entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+      entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    return 0;
+
+  entry->seen = 1;
+  entry->dev = st.st_dev;
+  entry->ino = st.st_ino;
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtim;
+  return 1;
+}
+
+/* Load a new version and publish it with a fence behind the upload. */
+static void upload(struct texture_uploader *up, struct upload_entry *entry)
+{
+  EGLSyncKHR fence = EGL_NO_SYNC_KHR;
+  GLuint texture;
+
+  texture = texture_cache_load(entry->path);
+  if (!texture)
+    return;
+
+  if (up->create_sync)
+    fence = up->create_sync(up->display, EGL_SYNC_FENCE_KHR, NULL);
+  if (fence != EGL_NO_SYNC_KHR)
+    glFlush(); /* the fence only signals once it has been submitted */
+  else
+    glFinish();
+
+  pthread_mutex_lock(&up->mutex);
+  entry->pending = texture;
+  entry->fence = fence;
+  pthread_mutex_unlock(&up->mutex);
+}
+
+/* Entries not waiting for the render thread to take an upload. */
+static struct upload_entry *next_check(struct texture_uploader *up)
+{
+  struct upload_entry *entry;
+
+  for (entry = up->entries; entry; entry = entry->next)
+    if (entry->check && !entry->pending)
+      return entry;
+  return NULL;
+}
+
+static void *worker(void *data)
+{
+  struct texture_uploader *up = data;
+  struct upload_entry *entry;
+  struct timespec deadline;
+  int ok;
+
+  eglBindAPI(EGL_OPENGL_ES_API);
+  ok = eglMakeCurrent(up->display, up->surface, up->surface, up->context);
+
+  pthread_mutex_lock(&up->mutex);
+  up->started = ok ? 1 : -1;
+  pthread_cond_broadcast(&up->cond);
+  if (!ok) {
+    pthread_mutex_unlock(&up->mutex);
+    return NULL;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  while (!up->quit) {
+    entry = next_check(up);
+    if (entry) {
+      entry->check = 0;
+      pthread_mutex_unlock(&up->mutex);
+      if (changed(entry))
+        upload(up, entry);
+      pthread_mutex_lock(&up->mutex);
+      continue;
+    }
+
+    if (pthread_cond_timedwait(&up->cond, &up->mutex, &deadline) == ETIMEDOUT) {
+      for (entry = up->entries; entry; entry = entry->next)
+        entry->check = 1;
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      deadline.tv_nsec += REVALIDATE_MS * 1000000L;
+      deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+      deadline.tv_nsec %= 1000000000L;
+    }
+  }
+  pthread_mutex_unlock(&up->mutex);
+
+  eglMakeCurrent(up->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglReleaseThread();
+  return NULL;
+}
+
+struct texture_uploader *texture_uploader_create(EGLDisplay display, EGLConfig config,
+                                                 EGLContext share)
+{
+  static const EGLint context_attribs[] = {
+    EGL_CONTEXT_CLIENT_VERSION, 2,
+    EGL_NONE
+  };
+  static const EGLint pbuffer_attribs[] = {
+    EGL_WIDTH, 1,
+    EGL_HEIGHT, 1,
+    EGL_NONE
+  };
+  struct texture_uploader *up;
+  pthread_condattr_t attr;
+
+  up = calloc(1, sizeof *up);
+  if (!up)
+    return NULL;
+  up->display = display;
+
+  if (has_extension(display, "EGL_KHR_fence_sync")) {
+    up->create_sync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+    up->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+    up->client_wait_sync =
+      (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+    if (!up->create_sync || !up->destroy_sync || !up->client_wait_sync)
+      up->create_sync = NULL;
+  }
+
+  up->context = eglCreateContext(display, config, share, context_attribs);
+  if (up->context == EGL_NO_CONTEXT)
+    goto err;
+  if (has_extension(display, "EGL_KHR_surfaceless_context")) {
+    up->surface = EGL_NO_SURFACE;
+  } else {
+    up->surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+    if (up->surface == EGL_NO_SURFACE)
+      goto err;
+  }
+
+  pthread_mutex_init(&up->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&up->cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  if (pthread_create(&up->thread, NULL, worker, up) != 0) {
+    up->started = -1;
+  } else {
+    pthread_mutex_lock(&up->mutex);
+    while (!up->started)
+      pthread_cond_wait(&up->cond, &up->mutex);
+    pthread_mutex_unlock(&up->mutex);
+    if (up->started < 0)
+      pthread_join(up->thread, NULL);
+  }
+  if (up->started < 0) {
+    pthread_cond_destroy(&up->cond);
+    pthread_mutex_destroy(&up->mutex);
+    goto err;
+  }
+
+  return up;
+
+err:
+  fprintf(stderr, "texture uploader: no shared context, loading on the render thread\n");
+  if (up->surface != EGL_NO_SURFACE)
+    eglDestroySurface(display, up->surface);
+  if (up->context != EGL_NO_CONTEXT)
+    eglDestroyContext(display, up->context);
+  free(up);
+  return NULL;
+}
+
+void texture_uploader_destroy(struct texture_uploader *up)
+{
+  struct upload_entry *entry, *next;
+
+  pthread_mutex_lock(&up->mutex);
+  up->quit = 1;
+  pthread_cond_broadcast(&up->cond);
+  pthread_mutex_unlock(&up->mutex);
+  pthread_join(up->thread, NULL);
+
+  for (entry = up->entries; entry; entry = next) {
+    next = entry->next;
+    if (entry->fence != EGL_NO_SYNC_KHR)
+      up->destroy_sync(up->display, entry->fence);
+    if (entry->pending)
+      glDeleteTextures(1, &entry->pending);
+    if (entry->texture)
+      glDeleteTextures(1, &entry->texture);
+    free(entry->path);
+    free(entry);
+  }
+
+  if (up->surface != EGL_NO_SURFACE)
+    eglDestroySurface(up->display, up->surface);
+  eglDestroyContext(up->display, up->context);
+  pthread_cond_destroy(&up->cond);
+  pthread_mutex_destroy(&up->mutex);
+  free(up);
+}
+
+/* Swap in a pending upload if the GPU has finished it.  Holds the mutex. */
+static void take_pending(struct texture_uploader *up, struct upload_entry *entry)
+{
+  if (!entry->pending)
+    return;
+
+  if (entry->fence != EGL_NO_SYNC_KHR) {
+    if (up->client_wait_sync(up->display, entry->fence, 0, 0) != EGL_CONDITION_SATISFIED_KHR)
+      return;
+    up->destroy_sync(up->display, entry->fence);
+    entry->fence = EGL_NO_SYNC_KHR;
+  }
+
+  /* Names are shared, so the render context can delete the old version. */
+  if (entry->texture)
+    glDeleteTextures(1, &entry->texture);
+  entry->texture = entry->pending;
+  entry->pending = 0;
+  /* Let the worker look at the file again. */
+  pthread_cond_signal(&up->cond);
+}
+
+GLuint texture_uploader_get(struct texture_uploader *up, const char *path)
+{
+  struct upload_entry *entry;
+
+  pthread_mutex_lock(&up->mutex);
+  for (entry = up->entries; entry; entry = entry->next)
+    if (strcmp(entry->path, path) == 0)
+      break;
+
+  if (!entry) {
+    entry = calloc(1, sizeof *entry);
+    if (entry)
+      entry->path = strdup(path);
+    if (!entry || !entry->path) {
+      free(entry);
+      pthread_mutex_unlock(&up->mutex);
+      return 0;
+    }
+    entry->fence = EGL_NO_SYNC_KHR;
+    entry->check = 1;
+    entry->next = up->entries;
+    up->entries = entry;
+    pthread_cond_signal(&up->cond);
+  }
+
+  take_pending(up, entry);
+  pthread_mutex_unlock(&up->mutex);
+
+  return entry->texture;
+}
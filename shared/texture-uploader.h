@@ -0,0 +1,43 @@
+/*
+ * Texture loading off the render thread.
+ *
+ * A worker thread with its own EGL context, sharing objects with the
+ * render context, decodes and uploads images the way texture_cache_load()
+ * does and follows each upload with an EGL_KHR_fence_sync fence.  The
+ * render thread picks a texture up only once its fence has signaled, so
+ * loading never blocks a frame.
+ *
+ * Files are revalidated by the worker every few hundred milliseconds; a
+ * changed file is uploaded into a new texture, swapped in when it is
+ * complete, and the old one deleted.  The render thread does no file I/O.
+ */
+
+#ifndef TEXTURE_UPLOADER_H
+#define TEXTURE_UPLOADER_H
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+struct texture_uploader;
+
+/*
+ * |share| is the render context, created on |display| with |config|.
+ * Returns NULL if a second context can't be made current without a
+ * window (EGL_KHR_surfaceless_context or a pbuffer capable config), or the
+ * thread can't be started; callers then load synchronously.
+ */
+struct texture_uploader *texture_uploader_create(EGLDisplay display, EGLConfig config,
+                                                 EGLContext share);
+
+/* Stops the worker and deletes every texture; the render context must be current. */
+void texture_uploader_destroy(struct texture_uploader *uploader);
+
+/*
+ * The newest completely uploaded texture for |path|, queueing the file
+ * the first time it is asked for.  Returns 0 until the first version is
+ * ready, or if it never decodes.  Call from the render thread only; a
+ * returned texture stays valid until a later call for the same path.
+ */
+GLuint texture_uploader_get(struct texture_uploader *uploader, const char *path);
+
+#endif
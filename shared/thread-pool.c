@@ -0,0 +1,182 @@
+/*
+ * Worker thread pool
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "thread-pool.h"
+
+struct thread_pool {
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+
+  thread_pool_job_t job;
+  void *data;
+  int count;
+  int next;      /* next job index to hand out */
+  int finished;  /* jobs that have returned */
+  int busy;      /* a batch is in flight or unacknowledged */
+  int quit;
+
+  int event_fd;
+  int n_threads;
+  pthread_t threads[];
+};
+
+static void *worker(void *data)
+{
+  struct thread_pool *pool = data;
+
+  pthread_mutex_lock(&pool->mutex);
+  for (;;) {
+    while (!pool->quit && pool->next >= pool->count)
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    if (pool->quit)
+      break;
+
+    int index = pool->next++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool->job(pool->data, index, pool->count);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (++pool->finished == pool->count) {
+      uint64_t one = 1;
+
+      pthread_cond_broadcast(&pool->done_cond);
+      if (write(pool->event_fd, &one, sizeof one) < 0)
+        fprintf(stderr, "thread pool: eventfd write failed: %m\n");
+    }
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+struct thread_pool *thread_pool_create(int threads)
+{
+  struct thread_pool *pool;
+  int i;
+
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+
+  pool = calloc(1, sizeof *pool + threads * sizeof pool->threads[0]);
+  if (!pool)
+    return NULL;
+
+  pool->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (pool->event_fd < 0) {
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  for (i = 0; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+      break;
+  }
+  pool->n_threads = i;
+
+  if (pool->n_threads == 0) {
+    thread_pool_destroy(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+  int i;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->n_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->mutex);
+  close(pool->event_fd);
+  free(pool);
+}
+
+int thread_pool_size(struct thread_pool *pool)
+{
+  return pool->n_threads;
+}
+
+/*
+ * Wait for the batch in flight, if any, and consume its completion event.
+ * Called with the mutex held.
+ */
+static void finish_batch(struct thread_pool *pool)
+{
+  uint64_t value;
+
+  while (pool->busy && pool->finished < pool->count)
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+  if (pool->busy && read(pool->event_fd, &value, sizeof value) < 0)
+    fprintf(stderr, "thread pool: eventfd read failed: %m\n");
+  pool->busy = 0;
+}
+
+void thread_pool_submit(struct thread_pool *pool, thread_pool_job_t job,
+                        void *data, int count)
+{
+  pthread_mutex_lock(&pool->mutex);
+  finish_batch(pool);
+
+  pool->busy = 1;
+  pool->job = job;
+  pool->data = data;
+  pool->count = count;
+  pool->next = 0;
+  pool->finished = 0;
+
+  if (count == 0) {
+    uint64_t one = 1;
+
+    if (write(pool->event_fd, &one, sizeof one) < 0)
+      fprintf(stderr, "thread pool: eventfd write failed: %m\n");
+  }
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_wait(struct thread_pool *pool)
+{
+  pthread_mutex_lock(&pool->mutex);
+  finish_batch(pool);
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+void thread_pool_run(struct thread_pool *pool, thread_pool_job_t job,
+                     void *data, int count)
+{
+  thread_pool_submit(pool, job, data, count);
+  thread_pool_wait(pool);
+}
+
+int thread_pool_get_fd(struct thread_pool *pool)
+{
+  return pool->event_fd;
+}
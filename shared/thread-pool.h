@@ -0,0 +1,42 @@
+/*
+ * A fixed set of worker threads that run a batch of indexed jobs.
+ *
+ * A batch is started with thread_pool_submit() and finished once every job
+ * has returned.  The caller either blocks on thread_pool_wait() or polls
+ * thread_pool_get_fd(), which becomes readable when the batch completes,
+ * so a main loop can keep dispatching Wayland events in the meantime.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+typedef void (*thread_pool_job_t)(void *data, int index, int count);
+
+struct thread_pool;
+
+/* |threads| <= 0 uses one thread per online CPU.  Returns NULL on error. */
+struct thread_pool *thread_pool_create(int threads);
+
+void thread_pool_destroy(struct thread_pool *pool);
+
+int thread_pool_size(struct thread_pool *pool);
+
+/*
+ * Run job(data, i, count) for i in [0, count) on the workers and return
+ * immediately.  Only one batch can be in flight at a time, a previous one
+ * is waited for first.
+ */
+void thread_pool_submit(struct thread_pool *pool, thread_pool_job_t job,
+                        void *data, int count);
+
+/* Block until the current batch is done and acknowledge its completion. */
+void thread_pool_wait(struct thread_pool *pool);
+
+/* Submit and wait. */
+void thread_pool_run(struct thread_pool *pool, thread_pool_job_t job,
+                     void *data, int count);
+
+/* An eventfd that is readable while a finished batch is unacknowledged. */
+int thread_pool_get_fd(struct thread_pool *pool);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * XXH3 style per tile content hashing
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tile-hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define STRIPE 64
+#define LANES 8
+
+#define PRIME32_1 0x9e3779b1u
+#define PRIME64_1 0x9e3779b185ebca87ull
+#define PRIME64_2 0xc2b2ae3d27d4eb4full
+
+/* Random key words; stripe n of a row keys with words n to n + 7. */
+static const uint64_t secret[] = {
+  0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+  0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+  0xcb00c391bb52283cull, 0xa32e531b8b65d088ull, 0x4ef90da297486471ull, 0xd8acdea946ef1938ull,
+};
+
+struct tile_hash {
+  int width, height, cpp;
+  int columns, rows;
+  int valid;                 /* hashes hold the last update */
+  uint64_t *hashes;
+  unsigned char *seen;       /* tiles already hashed by this update */
+};
+
+/*
+ * The lanes take a stripe at a time, as XXH3's accumulate: each adds the
+ * neighbouring lane's data and the product of its data's halves, both
+ * keyed by the secret.  Between rows they are scrambled, as XXH3 does
+ * between blocks, so moving content from one row to another changes the
+ * hash.  Every variant computes exactly what the scalar one does.
+ */
+static inline void accumulate_scalar(uint64_t acc[LANES], const unsigned char *p,
+                                     const uint64_t *key)
+{
+  uint64_t data[LANES];
+  int i;
+
+  memcpy(data, p, STRIPE);
+  for (i = 0; i < LANES; i++) {
+    uint64_t mixed = data[i] ^ key[i];
+
+    acc[i] += data[i ^ 1] + (mixed & 0xffffffff) * (mixed >> 32);
+  }
+}
+
+static inline void scramble_scalar(uint64_t acc[LANES])
+{
+  int i;
+
+  for (i = 0; i < LANES; i++) {
+    uint64_t a = acc[i];
+
+    a ^= a >> 47;
+    a ^= secret[i];
+    acc[i] = a * PRIME32_1;
+  }
+}
+
+/* Edge tiles end in a partial stripe, padded with zeros. */
+#define DEFINE_ROWS(isa, state, load, store)                                  \
+static void rows_##isa(uint64_t lanes[LANES], const unsigned char *p,         \
+                       int stride, int row_bytes, int rows)                   \
+{                                                                             \
+  unsigned char tail[STRIPE];                                                 \
+  state;                                                                      \
+  int y, x;                                                                   \
+                                                                              \
+  load;                                                                       \
+  for (y = 0; y < rows; y++, p += stride) {                                   \
+    for (x = 0; x + STRIPE <= row_bytes; x += STRIPE)                         \
+      accumulate_##isa(acc, p + x, secret + x / STRIPE);                      \
+    if (x < row_bytes) {                                                      \
+      memset(tail, 0, sizeof tail);                                           \
+      memcpy(tail, p + x, row_bytes - x);                                     \
+      accumulate_##isa(acc, tail, secret + x / STRIPE);                       \
+    }                                                                         \
+    scramble_##isa(acc);                                                      \
+  }                                                                           \
+  store;                                                                      \
+}
+
+DEFINE_ROWS(scalar, uint64_t *acc = lanes, (void) 0, (void) 0)
+
+#ifdef HAVE_X86_SIMD
+
+static inline void accumulate_sse2(__m128i acc[4], const unsigned char *p, const uint64_t *key)
+{
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    __m128i data = _mm_loadu_si128((const __m128i *) p + i);
+    __m128i mixed = _mm_xor_si128(data, _mm_loadu_si128((const __m128i *) (key + 2 * i)));
+    __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+    __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+    acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+  }
+}
+
+/* 64 by 32 bit multiplies, from two 32x32->64 bit ones. */
+static inline void scramble_sse2(__m128i acc[4])
+{
+  const __m128i prime = _mm_set1_epi32(PRIME32_1);
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    __m128i a = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+    __m128i lo, hi;
+
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *) secret + i));
+    lo = _mm_mul_epu32(a, prime);
+    hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    acc[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void accumulate_avx2(__m256i acc[2], const unsigned char *p, const uint64_t *key)
+{
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    __m256i data = _mm256_loadu_si256((const __m256i *) p + i);
+    __m256i mixed = _mm256_xor_si256(data, _mm256_loadu_si256((const __m256i *) (key + 4 * i)));
+    __m256i product = _mm256_mul_epu32(mixed, _mm256_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+    __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+
+    acc[i] = _mm256_add_epi64(acc[i], _mm256_add_epi64(product, swapped));
+  }
+}
+
+__attribute__((target("avx2")))
+static inline void scramble_avx2(__m256i acc[2])
+{
+  const __m256i prime = _mm256_set1_epi32(PRIME32_1);
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    __m256i a = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+    __m256i lo, hi;
+
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *) secret + i));
+    lo = _mm256_mul_epu32(a, prime);
+    hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    acc[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+  }
+}
+
+DEFINE_ROWS(sse2, __m128i acc[4],
+            for (x = 0; x < 4; x++) acc[x] = _mm_loadu_si128((const __m128i *) lanes + x),
+            for (x = 0; x < 4; x++) _mm_storeu_si128((__m128i *) lanes + x, acc[x]))
+
+__attribute__((target("avx2")))
+DEFINE_ROWS(avx2, __m256i acc[2],
+            for (x = 0; x < 2; x++) acc[x] = _mm256_loadu_si256((const __m256i *) lanes + x),
+            for (x = 0; x < 2; x++) _mm256_storeu_si256((__m256i *) lanes + x, acc[x]))
+
+#endif
+
+static void (*rows_fn)(uint64_t lanes[LANES], const unsigned char *p, int stride,
+                       int row_bytes, int rows) = rows_scalar;
+
+enum pixel_isa tile_hash_set_isa(enum pixel_isa isa)
+{
+  enum pixel_isa best = PIXEL_ISA_SCALAR;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    best = PIXEL_ISA_AVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    best = PIXEL_ISA_SSE2;
+#endif
+
+  if (isa == PIXEL_ISA_AUTO || isa > best)
+    isa = best;
+
+  switch (isa) {
+#ifdef HAVE_X86_SIMD
+  case PIXEL_ISA_AVX2:
+    rows_fn = rows_avx2;
+    break;
+  case PIXEL_ISA_SSE2:
+    rows_fn = rows_sse2;
+    break;
+#endif
+  default:
+    rows_fn = rows_scalar;
+    break;
+  }
+
+  return isa;
+}
+
+__attribute__((constructor))
+static void tile_hash_init(void)
+{
+  const char *env = getenv("TILE_HASH_ISA");
+  enum pixel_isa isa = PIXEL_ISA_AUTO;
+
+  if (env && strcmp(env, "scalar") == 0)
+    isa = PIXEL_ISA_SCALAR;
+  else if (env && strcmp(env, "sse2") == 0)
+    isa = PIXEL_ISA_SSE2;
+  else if (env && strcmp(env, "avx2") == 0)
+    isa = PIXEL_ISA_AVX2;
+
+  tile_hash_set_isa(isa);
+}
+
+static inline uint64_t fold(uint64_t a, uint64_t b)
+{
+  __uint128_t product = (__uint128_t) a * b;
+
+  return (uint64_t) product ^ (uint64_t) (product >> 64);
+}
+
+static uint64_t hash_tile(const unsigned char *p, int stride, int row_bytes, int rows)
+{
+  uint64_t acc[LANES] = {
+    PRIME32_1, PRIME64_1, PRIME64_2, PRIME32_1, PRIME64_2, PRIME64_1, PRIME64_2, PRIME32_1
+  };
+  uint64_t h;
+  int i;
+
+  rows_fn(acc, p, stride, row_bytes, rows);
+
+  h = (uint64_t) row_bytes * rows * PRIME64_1;
+  for (i = 0; i < LANES; i += 2)
+    h += fold(acc[i] ^ secret[i], acc[i + 1] ^ secret[i + 1]);
+  h ^= h >> 37;
+  h *= 0x165667919e3779f9ull;
+  return h ^ (h >> 32);
+}
+
+struct tile_hash *tile_hash_create(int width, int height, int cpp)
+{
+  struct tile_hash *hash;
+
+  /* A tile row must fit the secret. */
+  if (cpp < 1 || cpp > 4)
+    return NULL;
+  hash = calloc(1, sizeof *hash);
+  if (!hash)
+    return NULL;
+  hash->width = width;
+  hash->height = height;
+  hash->cpp = cpp;
+  hash->columns = (width + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+  hash->rows = (height + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+  hash->hashes = calloc((size_t) hash->columns * hash->rows, sizeof *hash->hashes);
+  hash->seen = calloc((size_t) hash->columns * hash->rows, 1);
+  if (!hash->hashes || !hash->seen) {
+    free(hash->hashes);
+    free(hash->seen);
+    free(hash);
+    return NULL;
+  }
+  return hash;
+}
+
+void tile_hash_destroy(struct tile_hash *hash)
+{
+  free(hash->hashes);
+  free(hash->seen);
+  free(hash);
+}
+
+int tile_hash_update(struct tile_hash *hash, const void *pixels, int stride,
+                     const struct damage *damage, struct damage *changed)
+{
+  const unsigned char *base = pixels;
+  int tx, ty, tx0, ty0, tx1, ty1, n, count = 0;
+  int rect, rects = damage ? damage->n_rects : 1;
+
+  damage_clear(changed);
+  /* Rectangles may share tiles; hash each tile once. */
+  memset(hash->seen, 0, (size_t) hash->columns * hash->rows);
+
+  for (rect = 0; rect < rects; rect++) {
+    if (damage) {
+      const struct damage_rect *r = &damage->rects[rect];
+
+      tx0 = r->x / TILE_HASH_SIZE;
+      ty0 = r->y / TILE_HASH_SIZE;
+      tx1 = (r->x + r->width + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+      ty1 = (r->y + r->height + TILE_HASH_SIZE - 1) / TILE_HASH_SIZE;
+      if (tx1 > hash->columns)
+        tx1 = hash->columns;
+      if (ty1 > hash->rows)
+        ty1 = hash->rows;
+    } else {
+      tx0 = ty0 = 0;
+      tx1 = hash->columns;
+      ty1 = hash->rows;
+    }
+
+    for (ty = ty0; ty < ty1; ty++) {
+      for (tx = tx0; tx < tx1; tx++) {
+        int x = tx * TILE_HASH_SIZE, y = ty * TILE_HASH_SIZE;
+        int width = hash->width - x < TILE_HASH_SIZE ? hash->width - x : TILE_HASH_SIZE;
+        int height = hash->height - y < TILE_HASH_SIZE ? hash->height - y : TILE_HASH_SIZE;
+        uint64_t h;
+
+        n = ty * hash->columns + tx;
+        if (hash->seen[n])
+          continue;
+        hash->seen[n] = 1;
+
+        h = hash_tile(base + (size_t) y * stride + (size_t) x * hash->cpp, stride,
+                      width * hash->cpp, height);
+        if (hash->valid && h == hash->hashes[n])
+          continue;
+        hash->hashes[n] = h;
+        damage_add(changed, x, y, width, height, hash->width, hash->height);
+        count++;
+      }
+    }
+  }
+
+  hash->valid = 1;
+  return count;
+}
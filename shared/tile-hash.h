@@ -0,0 +1,49 @@
+/*
+ * Content hashes of a buffer in tiles, to find what a painter actually
+ * changed.
+ *
+ * A painter that regenerates a frame without tracking its own damage
+ * makes the client damage, and the compositor upload and composite, the
+ * whole surface even when most pixels come out the same.  Hashing each
+ * 64x64 tile of the new frame and comparing with the hashes of the last
+ * committed one gives the damage instead; no tile changed means the
+ * commit can be skipped altogether.
+ *
+ * The hash follows XXH3's structure: eight 64-bit lanes take a 64 byte
+ * stripe at a time with one 32x32->64 bit multiply each, in SSE2 or AVX2
+ * where the CPU has it, and a 128-bit multiply folds them at the end.  It
+ * runs at memory bandwidth, far below the cost of painting the tile.  A
+ * change going unnoticed takes a 64-bit collision.
+ */
+
+#ifndef TILE_HASH_H
+#define TILE_HASH_H
+
+#include <stdint.h>
+
+#include "damage.h"
+#include "pixel-fill.h"
+
+#define TILE_HASH_SIZE 64
+
+struct tile_hash;
+
+/* For |width| x |height| buffers of |cpp| bytes per pixel.  Returns NULL if out of memory. */
+struct tile_hash *tile_hash_create(int width, int height, int cpp);
+
+void tile_hash_destroy(struct tile_hash *hash);
+
+/*
+ * Hash the tiles of |pixels| that |damage| touches, all of them if it is
+ * NULL, and set |changed| to those whose hash differs from the last call.
+ * The first call finds every hashed tile changed.  Tiles outside |damage|
+ * must still hold what they held at the last call.  Returns the number of
+ * changed tiles.
+ */
+int tile_hash_update(struct tile_hash *hash, const void *pixels, int stride,
+                     const struct damage *damage, struct damage *changed);
+
+/* Force the loops used, like pixel_fill_set_isa(); also TILE_HASH_ISA. */
+enum pixel_isa tile_hash_set_isa(enum pixel_isa isa);
+
+#endif
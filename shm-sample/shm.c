@@ -7,94 +7,166 @@
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+
+#include "shm-swapchain.h"
+#include "pixel-fill.h"
+#include "thread-pool.h"
+#include "tile-hash.h"
 
 struct wl_compositor *compositor = NULL;
 struct wl_shell *shell;
 struct wl_shm *shm;
+struct shm_pool *shm_pool; /* every wl_buffer of the client lives in here */
+uint32_t shm_formats = SHM_FORMATS_REQUIRED;
 
 int WIDTH = 320;
 int HEIGHT = 320;
 
-void paint_pixels(uint32_t *pixel) {
-  for (int y = 0; y < HEIGHT; y++) {
-    for (int x = 0; x < WIDTH; x++) {
-      int mx = x / 20;
-      int my = y / 20;
-      uint32_t color = 0;
-      if (mx % 2 == 0 && my % 2 == 0) {
-        uint32_t code = (mx / 2) % 8; // X axis determines a color code from 0 to 7.
-        uint32_t red = code & 1 ? 0xff0000 : 0;
-        uint32_t green = code & 2 ? 0x00ff00 : 0;
-        uint32_t blue = code & 4 ? 0x0000ff : 0;
-        uint32_t alpha = (my / 2) % 8 * 32 << 24; // Y axis determines alpha value from 0 to 0xf0
-        color = alpha + red + green + blue;
-      }
-      pixel[x + (y * WIDTH)] = color;
-    }
-  }
-}
+struct window {
+  struct wl_display *display;
+  struct wl_surface *surface;
+  struct wl_callback *callback;
+  struct shm_swapchain *swapchain;
+  struct thread_pool *pool;
+  struct shm_buffer *pending; /* being painted by the pool */
+  struct checker_job job;
+  int frame;
+  int scroll_frames;          /* frames per one pixel of scrolling */
+  struct tile_hash *tiles;    /* --hash: last committed content */
+  int hash, skipped;
+  int opaque, buffer_size;
+  uint32_t format;
+  enum pixel_format pixel_format;
+};
+
+static void redraw(void *data, struct wl_callback *callback, uint32_t time);
+
+static const struct wl_callback_listener frame_listener = {
+  redraw
+};
 
 /*
-* Return a newly created and resized file descriptor.
-* For real use case, mkstemp instead of open is better.
-* See create_tmpfile_cloexec in https://cgit.freedesktop.org/wayland/weston/tree/shared/os-compatibility.c
-*/
-int create_shared_fd(off_t size)
-{
-  char name[1024] = "";
+ * Start painting the next frame into the oldest free buffer of the
+ * swapchain.  The checkerboard, scrolled left by one pixel every
+ * scroll_frames frames and repainted whole every frame, is split into
+ * bands painted by the pool while the main loop keeps dispatching
+ * events; finish_frame() commits it once every band is done.
+ */
+static void redraw(void *data, struct wl_callback *callback, uint32_t time) {
+  struct window *window = data;
+  struct shm_buffer *buffer;
+
+  if (callback)
+    wl_callback_destroy(callback);
+  window->callback = NULL;
 
-  const char *path = getenv("XDG_RUNTIME_DIR");
-  if (!path) {
-    fprintf(stderr, "Please define environment variable XDG_RUNTIME_DIR\n");
+  buffer = shm_swapchain_acquire(window->swapchain, window->display, SHM_ACQUIRE_GROW);
+  if (buffer == NULL) {
+    fprintf(stderr, "Can't acquire a buffer\n");
     exit(1);
   }
 
-  strcpy(name, path);
-  strcat(name, "/shm-test");
+  window->job.data = buffer->data;
+  window->job.checker = (struct checker) {
+    .format = window->pixel_format,
+    .tile = 20,
+    .offset = window->frame++ / window->scroll_frames,
+    .width = WIDTH,
+    .height = HEIGHT,
+    .stride = window->swapchain->stride,
+  };
+  window->job.x = 0;
+  window->job.y = 0;
+  window->job.width = WIDTH;
+  window->job.height = HEIGHT;
+  window->pending = buffer;
+  thread_pool_submit(window->pool, pixel_fill_checker_band, &window->job,
+                     thread_pool_size(window->pool));
+}
 
-  int fd = open(name, O_RDWR | O_EXCL | O_CREAT);
-  if (fd < 0) {
-    fprintf(stderr, "File cannot open: %s\n", name);
-    exit(1);
+/*
+ * Called when the pool reports the frame painted: wait on the barrier and
+ * hand the buffer to the compositor.
+ */
+static void finish_frame(struct window *window) {
+  struct shm_buffer *buffer = window->pending;
+
+  thread_pool_wait(window->pool);
+  if (buffer == NULL)
+    return;
+  window->pending = NULL;
+
+  if (window->tiles) {
+    struct damage changed;
+    int n;
+
+    /*
+     * Damage only the tiles that came out different.  With none, the
+     * buffer stays free and the commit only carries the frame callback,
+     * so the compositor has nothing to upload or composite.
+     */
+    if (tile_hash_update(window->tiles, buffer->data, window->swapchain->stride,
+                         NULL, &changed) == 0) {
+      window->skipped++;
+    } else {
+      shm_swapchain_attach(window->swapchain, buffer, window->surface);
+      for (n = 0; n < changed.n_rects; n++)
+        wl_surface_damage(window->surface, changed.rects[n].x, changed.rects[n].y,
+                          changed.rects[n].width, changed.rects[n].height);
+    }
   } else {
-    unlink(name);
-  }
-
-  if (ftruncate(fd, size) < 0) {
-    fprintf(stderr, "ftruncate failed: fd=%i, size=%li\n", fd, size);
-    close(fd);
-    exit(1);
+    shm_swapchain_attach(window->swapchain, buffer, window->surface);
+    wl_surface_damage(window->surface, 0, 0, WIDTH, HEIGHT);
   }
 
-  return fd;
+  window->callback = wl_surface_frame(window->surface);
+  wl_callback_add_listener(window->callback, &frame_listener, window);
+  wl_surface_commit(window->surface);
 }
 
 /*
- * Create a window and return the attached buffer
+ * Create the buffers of a window and draw its first frame
  */
-void * create_window(struct wl_surface *surface) {
-  int stride = WIDTH * 4; // 4 bytes per pixel
-  int size = stride * HEIGHT;
-
-  int fd = create_shared_fd(size);
-  void *shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (shm_data == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %m\n");
-    close(fd);
+void create_window(struct window *window, int threads) {
+  window->pool = thread_pool_create(threads);
+  if (window->pool == NULL) {
+    fprintf(stderr, "Can't create paint threads\n");
+    exit(1);
+  }
+
+  window->format = shm_format_choose(shm_formats, window->opaque, window->buffer_size);
+  window->pixel_format = shm_format_to_pixel_format(window->format);
+  window->swapchain = shm_swapchain_create(shm_pool, WIDTH, HEIGHT, window->format,
+                                           SHM_SWAPCHAIN_MIN_BUFFERS);
+  if (window->swapchain == NULL) {
+    fprintf(stderr, "Can't create swapchain\n");
     exit(1);
   }
 
-  struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-  struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, WIDTH, HEIGHT, stride, WL_SHM_FORMAT_ARGB8888);
-  wl_shm_pool_destroy(pool);
+  if (window->format != WL_SHM_FORMAT_ARGB8888) {
+    struct wl_region *region = wl_compositor_create_region(compositor);
 
-  wl_surface_attach(surface, buffer, 0, 0);
-  wl_surface_commit(surface);
-  return shm_data;
+    wl_region_add(region, 0, 0, WIDTH, HEIGHT);
+    wl_surface_set_opaque_region(window->surface, region);
+    wl_region_destroy(region);
+  }
+
+  if (window->hash) {
+    window->tiles = tile_hash_create(WIDTH, HEIGHT,
+                                     pixel_format_bpp(window->pixel_format));
+    if (window->tiles == NULL) {
+      fprintf(stderr, "Can't create tile hashes\n");
+      exit(1);
+    }
+  }
+
+  redraw(window, NULL, 0);
 }
 
 void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
 {
+  shm_formats |= shm_format_bit(format);
 }
 
 struct wl_shm_listener shm_listener = {
@@ -147,9 +219,87 @@ const struct wl_shell_surface_listener shell_surface_listener = {
   handle_popup_done
 };
 
+/*
+ * Dispatch Wayland events until the connection fails, committing frames
+ * as soon as the paint threads finish them.
+ */
+static void run(struct window *window) {
+  struct wl_display *display = window->display;
+  struct pollfd fds[2] = {
+    { wl_display_get_fd(display), POLLIN, 0 },
+    { thread_pool_get_fd(window->pool), POLLIN, 0 },
+  };
+
+  for (;;) {
+    while (wl_display_prepare_read(display) != 0) {
+      if (wl_display_dispatch_pending(display) == -1)
+        return;
+    }
+    wl_display_flush(display);
+
+    if (poll(fds, 2, -1) < 0) {
+      wl_display_cancel_read(display);
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN) {
+      if (wl_display_read_events(display) == -1)
+        return;
+    } else {
+      wl_display_cancel_read(display);
+    }
+    if (wl_display_dispatch_pending(display) == -1)
+      return;
+
+    if (fds[1].revents & POLLIN)
+      finish_frame(window);
+  }
+}
+
+static void usage(int error_code) {
+  fprintf(stderr, "Usage: shm-test [OPTIONS]\n\n"
+          "  --threads N\tPaint with N threads (0: one per CPU, default 1)\n"
+          "  --size WxH\tWindow size (default 320x320)\n"
+          "  -o\t\tCreate an opaque surface (XRGB8888)\n"
+          "  -s\t\tUse 16 bpp buffers (RGB565, dithered)\n"
+          "  --scroll N\tScroll one pixel every N frames (default 1), repainting every frame\n"
+          "  --hash\tDamage only tiles whose content hash changed, skip unchanged frames;\n"
+          "\t\tuse with --scroll, as every tile changes when the checkerboard moves\n"
+          "  -h\t\tThis help text\n\n");
+
+  exit(error_code);
+}
+
 int main(int argc, char **argv) {
   struct sigaction sigint;
   struct wl_display *display;
+  struct window window = { 0 };
+  int threads = 1;
+
+  window.buffer_size = 32;
+  window.scroll_frames = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else if (strcmp("--size", argv[i]) == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &WIDTH, &HEIGHT) != 2 || WIDTH <= 0 || HEIGHT <= 0)
+        usage(EXIT_FAILURE);
+    } else if (strcmp("-o", argv[i]) == 0)
+      window.opaque = 1;
+    else if (strcmp("-s", argv[i]) == 0)
+      window.buffer_size = 16;
+    else if (strcmp("--scroll", argv[i]) == 0 && i + 1 < argc) {
+      window.scroll_frames = atoi(argv[++i]);
+      if (window.scroll_frames <= 0)
+        usage(EXIT_FAILURE);
+    } else if (strcmp("--hash", argv[i]) == 0)
+      window.hash = 1;
+    else if (strcmp("-h", argv[i]) == 0)
+      usage(EXIT_SUCCESS);
+    else
+      usage(EXIT_FAILURE);
+  }
 
   sigint.sa_handler = NULL;
   sigemptyset(&sigint.sa_mask);
@@ -174,6 +324,13 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  shm_pool = shm_pool_create(shm, (size_t) WIDTH * HEIGHT * 4 * SHM_SWAPCHAIN_MIN_BUFFERS,
+                             SHM_POOL_MAX_SIZE, shm_alloc_flags_from_env());
+  if (shm_pool == NULL) {
+    fprintf(stderr, "Can't create shm pool\n");
+    exit(1);
+  }
+
   struct wl_surface *surface = wl_compositor_create_surface(compositor);
   if (surface == NULL) {
     fprintf(stderr, "Can't create surface\n");
@@ -189,13 +346,21 @@ int main(int argc, char **argv) {
   wl_shell_surface_set_toplevel(shell_surface);
   wl_shell_surface_add_listener(shell_surface, &shell_surface_listener, NULL);
 
-  void *shm_data = create_window(surface);
-  paint_pixels(shm_data);
+  window.display = display;
+  window.surface = surface;
+  create_window(&window, threads);
 
-  while (wl_display_dispatch(display) != -1) {
-  ;
-  }
+  run(&window);
 
+  thread_pool_destroy(window.pool);
+  if (window.tiles) {
+    printf("%d of %d frames unchanged, not committed\n", window.skipped, window.frame);
+    tile_hash_destroy(window.tiles);
+  }
+  if (window.callback)
+    wl_callback_destroy(window.callback);
+  shm_swapchain_destroy(window.swapchain);
+  shm_pool_destroy(shm_pool);
   wl_display_disconnect(display);
   printf("disconnected from display\n");
 
@@ -10,26 +10,42 @@
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <dirent.h>
 
 #include <wayland-client.h>
 #include <wayland-egl.h>
 #include <EGL/egl.h>
 #include <GL/gl.h>
 
+#include "shm-swapchain.h"
+#include "pixel-fill.h"
+#include "thread-pool.h"
+#include "damage.h"
+#include "display-wait.h"
+#include "tile-hash.h"
+
 struct wl_compositor *compositor = NULL;
+uint32_t compositor_version;
 struct wl_subcompositor *subcompositor = NULL;
 struct wl_shell *shell;
 struct wl_shm *shm;
-struct wl_buffer *buffer;
+struct shm_pool *shm_pool; /* every wl_buffer of the client lives in here */
+uint32_t shm_formats = SHM_FORMATS_REQUIRED;
 
 static int running = 1;
 GLubyte image[64][64][4];
-void *shm_data;
+struct thread_pool *paint_pool;
 
 int WIDTH = 320;
 int HEIGHT = 320;
 int i = 0;
 
+#define MARKER_SIZE 20
+#define MARKER_Y 20
+#define MARKER_STEP 4
+#define MARKER_INTERVAL_MS 100
+
 struct display {
   struct wl_display *display;
   struct wl_registry *registry;
@@ -45,89 +61,102 @@ struct window {
   struct wl_shell_surface *shell_surface;
   struct wl_egl_window *egl_window;
   struct display *display;
+
+  struct shm_swapchain *swapchain;
+  struct wl_callback *frame_callback;
+  struct damage damage; /* main surface area changed since the last commit */
+  /* per swapchain buffer, area changed since that buffer was last painted */
+  struct damage buffer_damage[SHM_SWAPCHAIN_MAX_BUFFERS];
+  int marker_x, marker_dx;
+  uint64_t marker_time;
+  int marker_interval;
+  unsigned long frames;
+  struct tile_hash *tiles; /* --hash: main surface content last committed */
+  unsigned long skipped;
+  int opaque, buffer_size;
+  uint32_t format;
+  enum pixel_format pixel_format;
 };
 
-void paint_pixels(uint32_t *pixel) {
-  int x, y;
-
-  for (y = 0; y < HEIGHT; y++) {
-    for (x = 0; x < WIDTH; x++) {
-      int mx = x / 1;
-      int my = y / 1;
-      uint32_t color = 0;
-      if (mx % 2 == 0 && my % 2 == 0) {
-        uint32_t code = (mx / 2) % 8; // X axis determines a color code from 0 to 7.
-        uint32_t red = code & 1 ? 0xff0000 : 0;
-        uint32_t green = code & 2 ? 0x00ff00 : 0;
-        uint32_t blue = code & 4 ? 0x0000ff : 0;
-        uint32_t alpha = (my / 2) % 8 * 32 << 24; // Y axis determines alpha value from 0 to 0xf0
-        color = alpha + red + green + blue;
-      }
-      pixel[x + (y * WIDTH)] = color;
-    }
-  }
+static uint64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
 }
 
 /*
-* Return a newly created and resized file descriptor.
-* For real use case, mkstemp instead of open is better.
-* See create_tmpfile_cloexec in https://cgit.freedesktop.org/wayland/weston/tree/shared/os-compatibility.c
-*/
-int create_shared_fd(off_t size)
-{
-  char name[1024] = "";
-
-  const char *path = getenv("XDG_RUNTIME_DIR");
-  if (!path) {
-    fprintf(stderr, "Please define environment variable XDG_RUNTIME_DIR\n");
-    exit(1);
-  }
-
-  strcpy(name, path);
-  strcat(name, "/shm-test");
-
-  int fd = open(name, O_RDWR | O_EXCL | O_CREAT);
-  if (fd < 0) {
-    fprintf(stderr, "File cannot open: %s\n", name);
-    exit(1);
-  } else {
-    unlink(name);
-  }
-
-  if (ftruncate(fd, size) < 0) {
-    fprintf(stderr, "ftruncate failed: fd=%i, size=%li\n", fd, size);
-    close(fd);
-    exit(1);
+ * Repaint only the damaged rectangles: the checkerboard in bands across
+ * the paint threads, then the part of the marker that falls inside.  The
+ * pool barrier is passed before the buffer is committed.
+ */
+void paint_pixels(void *pixel, struct window *window, const struct damage *damage) {
+  struct checker_job job = {
+    .data = pixel,
+    .checker = {
+      .format = window->pixel_format,
+      .tile = 1,
+      .width = WIDTH,
+      .height = HEIGHT,
+      .stride = window->swapchain->stride,
+    },
+  };
+  int n;
+
+  for (n = 0; n < damage->n_rects; n++) {
+    const struct damage_rect *r = &damage->rects[n];
+    int x0 = r->x > window->marker_x ? r->x : window->marker_x;
+    int x1 = r->x + r->width < window->marker_x + MARKER_SIZE ? r->x + r->width : window->marker_x + MARKER_SIZE;
+    int y0 = r->y > MARKER_Y ? r->y : MARKER_Y;
+    int y1 = r->y + r->height < MARKER_Y + MARKER_SIZE ? r->y + r->height : MARKER_Y + MARKER_SIZE;
+
+    job.x = r->x;
+    job.y = r->y;
+    job.width = r->width;
+    job.height = r->height;
+    thread_pool_run(paint_pool, pixel_fill_checker_band, &job, thread_pool_size(paint_pool));
+
+    if (x0 < x1 && y0 < y1)
+      pixel_fill_rect(pixel, window->swapchain->stride, window->pixel_format, x0, y0, x1 - x0, y1 - y0, 0xffffffff);
   }
-
-  return fd;
 }
 
 /*
- * Create a window and return the attached buffer
+ * Slide the marker along the top of the main surface every
+ * marker_interval ms, damaging where it was and where it is now.
  */
-void create_shm_buffer(struct wl_surface *surface) {
-  int stride = WIDTH * 4; // 4 bytes per pixel
-  int size = stride * HEIGHT;
-
-  int fd = create_shared_fd(size);
-  shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (shm_data == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %m\n");
-    close(fd);
-    exit(1);
-  }
-
-  struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
-  buffer = wl_shm_pool_create_buffer(pool, 0, WIDTH, HEIGHT, stride, WL_SHM_FORMAT_ARGB8888);
-  wl_shm_pool_destroy(pool);
-  close(fd);
+static void move_marker(struct window *window) {
+  uint64_t time = now_ms();
+
+  if (time - window->marker_time < (uint64_t) window->marker_interval)
+    return;
+  window->marker_time = time;
+
+  damage_add(&window->damage, window->marker_x, MARKER_Y, MARKER_SIZE, MARKER_SIZE, WIDTH, HEIGHT);
+  if (window->marker_x + window->marker_dx < 0 ||
+      window->marker_x + window->marker_dx + MARKER_SIZE > WIDTH)
+    window->marker_dx = -window->marker_dx;
+  window->marker_x += window->marker_dx;
+  damage_add(&window->damage, window->marker_x, MARKER_Y, MARKER_SIZE, MARKER_SIZE, WIDTH, HEIGHT);
+}
 
-  return;
+/*
+ * How long the main surface can go without drawing: until its frame
+ * callback, which wakes the loop by itself, or the next marker move.
+ */
+static int main_surface_timeout(struct window *window) {
+  uint64_t next = window->marker_time + window->marker_interval, time = now_ms();
+
+  if (window->frame_callback)
+    return -1;
+  if (!damage_is_empty(&window->damage))
+    return 0;
+  return next > time ? next - time : 0;
 }
 
 void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
 {
+  shm_formats |= shm_format_bit(format);
 }
 
 struct wl_shm_listener shm_listener = {
@@ -140,7 +169,9 @@ struct wl_shm_listener shm_listener = {
 void global_registry_handler(void *data, struct wl_registry *registry, uint32_t id, const char *interface, uint32_t version)
 {
   if (strcmp(interface, "wl_compositor") == 0) {
-    compositor = wl_registry_bind(registry, id, &wl_compositor_interface, 1);
+    /* wl_surface.damage_buffer needs version 4. */
+    compositor_version = version < 4 ? version : 4;
+    compositor = wl_registry_bind(registry, id, &wl_compositor_interface, compositor_version);
   } else if (strcmp(interface, "wl_shell") == 0) {
     shell = wl_registry_bind(registry, id, &wl_shell_interface, 1);
   } else if (strcmp(interface, "wl_shm") == 0) {
@@ -195,13 +226,82 @@ void create_shell_surface(struct window *window) {
   wl_shell_surface_add_listener(window->shell_surface, &shell_surface_listener, NULL);
 }
 
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+  struct window *window = data;
+
+  wl_callback_destroy(callback);
+  window->frame_callback = NULL;
+}
+
+static const struct wl_callback_listener frame_listener = {
+  frame_done
+};
+
+/*
+ * Repaint and commit only what changed since the last frame, at most once
+ * per frame callback.  Each swapchain buffer remembers what changed since
+ * it was last painted, so undamaged pixels are still valid in whichever
+ * buffer comes back.
+ */
 void draw_main_surface(struct window *window) {
-  create_shm_buffer(window->main_surface);
-  paint_pixels(shm_data);
+  struct shm_buffer *buffer;
+  struct damage *buffer_damage;
+  int n;
+
+  if (window->frame_callback)
+    return;
+
+  move_marker(window);
+  if (damage_is_empty(&window->damage))
+    return;
+
+  for (n = 0; n < window->swapchain->count; n++)
+    damage_union(&window->buffer_damage[n], &window->damage);
+
+  buffer = shm_swapchain_acquire(window->swapchain, window->display->display, SHM_ACQUIRE_GROW);
+  if (buffer == NULL) {
+    fprintf(stderr, "Can't acquire a buffer\n");
+    exit(1);
+  }
+
+  /* Never painted, e.g. just added by the swapchain growing. */
+  buffer_damage = &window->buffer_damage[buffer - window->swapchain->buffers];
+  if (buffer->last_used == 0) {
+    damage_clear(buffer_damage);
+    damage_add(buffer_damage, 0, 0, WIDTH, HEIGHT, WIDTH, HEIGHT);
+  }
+
+  paint_pixels(buffer->data, window, buffer_damage);
+  damage_clear(buffer_damage);
+
+  /* Narrow the damage to the tiles that really changed; with none, the
+   * painted buffer stays free and nothing is committed. */
+  if (window->tiles) {
+    struct damage changed;
+
+    tile_hash_update(window->tiles, buffer->data, window->swapchain->stride,
+                     &window->damage, &changed);
+    window->damage = changed;
+    if (damage_is_empty(&window->damage)) {
+      window->skipped++;
+      return;
+    }
+  }
 
-  wl_surface_attach(window->main_surface, buffer, 0, 0);
-  wl_surface_damage(window->main_surface, 0, 0, WIDTH, HEIGHT);
+  shm_swapchain_attach(window->swapchain, buffer, window->main_surface);
+  for (n = 0; n < window->damage.n_rects; n++) {
+    struct damage_rect *r = &window->damage.rects[n];
+
+    if (compositor_version >= 4)
+      wl_surface_damage_buffer(window->main_surface, r->x, r->y, r->width, r->height);
+    else
+      wl_surface_damage(window->main_surface, r->x, r->y, r->width, r->height);
+  }
+  window->frame_callback = wl_surface_frame(window->main_surface);
+  wl_callback_add_listener(window->frame_callback, &frame_listener, window);
   wl_surface_commit(window->main_surface);
+  damage_clear(&window->damage);
+  window->frames++;
 }
 
 void create_main_surface(struct window *window) {
@@ -213,6 +313,30 @@ void create_main_surface(struct window *window) {
 
   create_shell_surface(window);
 
+  window->format = shm_format_choose(shm_formats, window->opaque, window->buffer_size);
+  window->pixel_format = shm_format_to_pixel_format(window->format);
+  window->swapchain = shm_swapchain_create(shm_pool, WIDTH, HEIGHT, window->format,
+                                           SHM_SWAPCHAIN_MIN_BUFFERS);
+  if (window->swapchain == NULL) {
+    fprintf(stderr, "Can't create swapchain\n");
+    exit(1);
+  }
+
+  if (window->format != WL_SHM_FORMAT_ARGB8888) {
+    struct wl_region *region = wl_compositor_create_region(compositor);
+
+    wl_region_add(region, 0, 0, WIDTH, HEIGHT);
+    wl_surface_set_opaque_region(window->main_surface, region);
+    wl_region_destroy(region);
+  }
+  window->frame_callback = NULL;
+  window->frames = 0;
+
+  damage_clear(&window->damage);
+  damage_add(&window->damage, 0, 0, WIDTH, HEIGHT, WIDTH, HEIGHT);
+  window->marker_x = 0;
+  window->marker_dx = MARKER_STEP;
+  window->marker_time = now_ms();
 }
 
 void create_sub_surface(struct window *window) {
@@ -247,6 +371,12 @@ void impl_subsurface(struct window *window) {
   /*set subsurface position.*/
   wl_subsurface_set_position(window->subsurface, 160, 160);
 
+  /*
+   * The main surface only commits when its content changes, so let the
+   * EGL subsurface update on its own instead of waiting for the parent.
+   */
+  wl_subsurface_set_desync(window->subsurface);
+
   /*set subsurface place.*/
 //  wl_subsurface_place_below(window->subsurface, window->main_surface);
   wl_subsurface_place_above(window->subsurface, window->main_surface);
@@ -314,10 +444,146 @@ static void signal_int(int signum)
   running = 0;
 }
 
+/*
+ * Soak test support: resident set size and open descriptors of this
+ * process, which must stay flat however many frames are drawn.
+ */
+static long resident_kb(void) {
+  long pages = -1, resident = -1;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+      resident = -1;
+    fclose(f);
+  }
+
+  return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int open_fds(void) {
+  DIR *dir = opendir("/proc/self/fd");
+  struct dirent *entry;
+  int count = 0;
+
+  if (!dir)
+    return -1;
+  while ((entry = readdir(dir)))
+    if (entry->d_name[0] != '.')
+      count++;
+  closedir(dir);
+
+  return count - 1; /* the descriptor of |dir| itself */
+}
+
+/* The baseline is taken a tenth of the way in, at most this far. */
+#define SOAK_WARMUP_FRAMES 1000
+#define SOAK_MIN_FRAMES 100
+#define SOAK_RSS_SLACK_KB 1024
+
+struct soak {
+  unsigned long frames, warmup;
+  int baseline; /* rss_kb and fds hold the warmed up values */
+  long rss_kb, max_rss_kb;
+  int fds, max_fds;
+};
+
+static void soak_sample(struct soak *soak, struct window *window) {
+  long rss = resident_kb();
+  int fds = open_fds();
+
+  if (window->frames == soak->warmup) {
+    soak->rss_kb = soak->max_rss_kb = rss;
+    soak->fds = soak->max_fds = fds;
+    soak->baseline = 1;
+  } else if (window->frames > soak->warmup) {
+    if (rss > soak->max_rss_kb)
+      soak->max_rss_kb = rss;
+    if (fds > soak->max_fds)
+      soak->max_fds = fds;
+  }
+
+  if (window->frames % 10000 == 0)
+    printf("soak: %lu frames, rss %ld kB, %d fds\n", window->frames, rss, fds);
+}
+
+static int soak_report(struct soak *soak, struct window *window) {
+  int ok = soak->baseline && window->frames >= soak->frames &&
+           soak->max_rss_kb - soak->rss_kb <= SOAK_RSS_SLACK_KB &&
+           soak->max_fds == soak->fds;
+
+  printf("soak %s: %lu frames, rss %ld -> %ld kB, fds %d -> %d\n",
+         ok ? "passed" : "FAILED", window->frames,
+         soak->rss_kb, soak->max_rss_kb, soak->fds, soak->max_fds);
+
+  return ok;
+}
+
+static void usage(int error_code) {
+  fprintf(stderr, "Usage: egl-test [OPTIONS]\n\n"
+          "  --threads N\tPaint the main surface with N threads (0: one per CPU, default 1)\n"
+          "  -o\t\tCreate an opaque main surface (XRGB8888)\n"
+          "  -s\t\tUse 16 bpp main surface buffers (RGB565, dithered)\n"
+          "  --hash\tDamage only main surface tiles whose content hash changed\n"
+          "  --continuous\tRedraw the EGL subsurface every frame, for benchmarks,\n"
+          "\t\tinstead of only when it changes\n"
+          "  --soak [N]\tRedraw the main surface every frame for N frames (default 100000)\n"
+          "\t\tand fail if memory or descriptor use grows after the first\n"
+          "\t\ttenth (at most 1000 frames); N must be at least 100\n"
+          "  -h\t\tThis help text\n\n");
+
+  exit(error_code);
+}
+
 int main(int argc, char **argv) {
   struct sigaction sigint;
   struct display display;
-  struct window window;
+  struct window window = { 0 };
+  struct soak soak = { 0 };
+  unsigned long sampled = 0;
+  int threads = 1;
+  int continuous = 0, sub_drawn = 0, hash = 0;
+  int status = 0;
+  int n;
+
+  window.marker_interval = MARKER_INTERVAL_MS;
+  window.buffer_size = 32;
+
+  for (n = 1; n < argc; n++) {
+    if (strcmp("--threads", argv[n]) == 0 && n + 1 < argc)
+      threads = atoi(argv[++n]);
+    else if (strcmp("--soak", argv[n]) == 0) {
+      soak.frames = 100000;
+      if (n + 1 < argc && argv[n + 1][0] != '-')
+        soak.frames = strtoul(argv[++n], NULL, 10);
+      if (soak.frames < SOAK_MIN_FRAMES) {
+        fprintf(stderr, "--soak needs at least %d frames\n", SOAK_MIN_FRAMES);
+        usage(EXIT_FAILURE);
+      }
+      soak.warmup = soak.frames / 10;
+      if (soak.warmup > SOAK_WARMUP_FRAMES)
+        soak.warmup = SOAK_WARMUP_FRAMES;
+      /* Move the marker every frame so every frame callback draws. */
+      window.marker_interval = 0;
+    } else if (strcmp("--continuous", argv[n]) == 0)
+      continuous = 1;
+    else if (strcmp("-o", argv[n]) == 0)
+      window.opaque = 1;
+    else if (strcmp("-s", argv[n]) == 0)
+      window.buffer_size = 16;
+    else if (strcmp("--hash", argv[n]) == 0)
+      hash = 1;
+    else if (strcmp("-h", argv[n]) == 0)
+      usage(EXIT_SUCCESS);
+    else
+      usage(EXIT_FAILURE);
+  }
+
+  paint_pool = thread_pool_create(threads);
+  if (paint_pool == NULL) {
+    fprintf(stderr, "Can't create paint threads\n");
+    exit(1);
+  }
 
   sigint.sa_handler = signal_int;
   sigemptyset(&sigint.sa_mask);
@@ -344,26 +610,69 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  shm_pool = shm_pool_create(shm, (size_t) WIDTH * HEIGHT * 4 * SHM_SWAPCHAIN_MIN_BUFFERS,
+                             SHM_POOL_MAX_SIZE, shm_alloc_flags_from_env());
+  if (shm_pool == NULL) {
+    fprintf(stderr, "Can't create shm pool\n");
+    exit(1);
+  }
+
   window.display = &display;
 
   create_main_surface(&window);
+  if (hash) {
+    window.tiles = tile_hash_create(WIDTH, HEIGHT, pixel_format_bpp(window.pixel_format));
+    if (window.tiles == NULL) {
+      fprintf(stderr, "Can't create tile hashes\n");
+      exit(1);
+    }
+  }
   create_sub_surface(&window);
 
   impl_subsurface(&window);
 
   create_texture();
 
+  /*
+   * The EGL subsurface is static and drawn once; the main surface draws
+   * when the marker moves.  In between the loop sleeps in display_wait().
+   */
   while(running) {
-    wl_display_dispatch_pending(display.display);
+    if (continuous)
+      wl_display_dispatch_pending(display.display);
+    else if (sub_drawn && display_wait(display.display, main_surface_timeout(&window)) < 0)
+      break;
     draw_main_surface(&window);
-    draw_sub_surface(&window);
+    if (continuous || !sub_drawn) {
+      draw_sub_surface(&window);
+      sub_drawn = 1;
+    }
+
+    if (soak.frames && window.frames != sampled) {
+      sampled = window.frames;
+      soak_sample(&soak, &window);
+      if (window.frames >= soak.frames)
+        running = 0;
+    }
   }
 
+  if (soak.frames && !soak_report(&soak, &window))
+    status = 1;
+
+  if (window.tiles) {
+    printf("%lu main surface frames unchanged, not committed\n", window.skipped);
+    tile_hash_destroy(window.tiles);
+  }
+  if (window.frame_callback)
+    wl_callback_destroy(window.frame_callback);
+  shm_swapchain_destroy(window.swapchain);
+  shm_pool_destroy(shm_pool);
   wl_surface_destroy(window.main_surface);
   wl_surface_destroy(window.sub_surface);
   wl_subsurface_destroy(window.subsurface);
   wl_display_disconnect(display.display);
+  thread_pool_destroy(paint_pool);
   printf("disconnected from display\n");
 
-  exit(0);
+  exit(status);
 }
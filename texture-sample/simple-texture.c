@@ -4,6 +4,8 @@
 #include <signal.h>
 #include <assert.h>
 #include <math.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <wayland-client.h>
 #include <wayland-egl.h>
@@ -11,7 +13,13 @@
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
-#include <SOIL/SOIL.h>
+
+#include "atlas.h"
+#include "display-wait.h"
+#include "program-cache.h"
+#include "stream-texture.h"
+#include "texture-cache.h"
+#include "texture-uploader.h"
 
 #define WIDTH 720
 #define HEIGHT 480
@@ -43,6 +51,8 @@ static struct wl_compositor *compositor = NULL;
 static struct wl_shell *shell = NULL;
 static EGLDisplay egl_display;
 static char running = 1;
+/* Something on screen is out of date; only then is a frame drawn. */
+static int needs_redraw = 1;
 
 struct window {
   EGLContext egl_context;
@@ -83,6 +93,7 @@ static void shell_surface_configure(void *data, struct wl_shell_surface *shell_s
                                    uint32_t edges, int32_t width, int32_t height) {
   struct window *window = data;
   wl_egl_window_resize(window->egl_window, width, height, 0, 0);
+  needs_redraw = 1;
 }
 
 static void shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface) {
@@ -113,77 +124,69 @@ static void delete_window (struct window *window) {
   eglDestroyContext (egl_display, window->egl_context);
 }
 
-static GLuint create_shader(const char *source, GLenum shader_type)
-{
-	GLuint shader;
-	GLint status;
-
-	shader = glCreateShader(shader_type);
-	assert(shader != 0);
-
-	glShaderSource(shader, 1, (const char **) &source, NULL);
-	glCompileShader(shader);
-
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetShaderInfoLog(shader, 1000, &len, log);
-		fprintf(stderr, "Error: compiling %s: %*s\n",
-			shader_type == GL_VERTEX_SHADER ? "vertex" : "fragment",
-			len, log);
-		exit(1);
-	}
-
-	return shader;
-}
-
 static void init_gl()
 {
-	GLuint frag, vert;
-	GLint status;
-
-	frag = create_shader(frag_shader_text, GL_FRAGMENT_SHADER);
-	vert = create_shader(vert_shader_text, GL_VERTEX_SHADER);
-
-	program = glCreateProgram();
-	glAttachShader(program, frag);
-	glAttachShader(program, vert);
-	glLinkProgram(program);
-
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if (!status) {
-		char log[1000];
-		GLsizei len;
-		glGetProgramInfoLog(program, 1000, &len, log);
-		fprintf(stderr, "Error: linking:\n%*s\n", len, log);
+	static const struct program_attrib attribs[] = {
+		{ "pos", 0 },
+		{ "color", 1 },
+	};
+
+	program = program_cache_link(vert_shader_text, frag_shader_text, attribs, 2);
+	if (!program)
 		exit(1);
-	}
 
 	glUseProgram(program);
 
-	glBindAttribLocation(program, 0, "pos");
-	glBindAttribLocation(program, 1, "color");
-	glLinkProgram(program);
-
 	samplerLoc = glGetUniformLocation(program, "s_texture");
 }
 
-void create_texture() {
-  int width, height;
-
-  unsigned char* image = SOIL_load_image("./image.png", &width, &height, 0, SOIL_LOAD_RGB);
-
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1 );
-  glGenTextures(1, &textureId);
-  glBindTexture(GL_TEXTURE_2D, textureId);
-
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+/* Images from the command line, drawn as a grid out of an atlas. */
+static struct atlas *atlas;
+static const char *const *atlas_names;
+static int atlas_count;
+static GLfloat (*atlas_verts)[2], (*atlas_coords)[2];
+
+/* One bind and one draw per atlas page, however many images there are. */
+static void draw_atlas(void) {
+  int cols = ceil(sqrt(atlas_count)), rows = (atlas_count + cols - 1) / cols;
+  float cell_w = 1.6 / cols, cell_h = 1.6 / rows;
+  int page, i;
+
+  for (page = 0; page < atlas->n_pages; page++) {
+    int n = 0;
+
+    for (i = 0; i < atlas_count; i++) {
+      const struct atlas_rect *r = atlas_lookup(atlas, atlas_names[i]);
+      float x0 = -0.8 + (i % cols) * cell_w, x1 = x0 + cell_w * 0.9;
+      float y0 = 0.8 - (i / cols) * cell_h, y1 = y0 - cell_h * 0.9;
+      int k;
+
+      if (!r || r->page != page)
+        continue;
+
+      /* Two triangles, the first image row at the top. */
+      const GLfloat quad[6][4] = {
+        { x0, y0, r->u0, r->v0 },
+        { x1, y0, r->u1, r->v0 },
+        { x1, y1, r->u1, r->v1 },
+        { x0, y0, r->u0, r->v0 },
+        { x1, y1, r->u1, r->v1 },
+        { x0, y1, r->u0, r->v1 },
+      };
+
+      for (k = 0; k < 6; k++, n++) {
+        atlas_verts[n][0] = quad[k][0];
+        atlas_verts[n][1] = quad[k][1];
+        atlas_coords[n][0] = quad[k][2];
+        atlas_coords[n][1] = quad[k][3];
+      }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, atlas->pages[page]);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, atlas_verts);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, atlas_coords);
+    glDrawArrays(GL_TRIANGLES, 0, n);
+  }
 }
 
 static void draw_window(struct window *window) {
@@ -207,18 +210,20 @@ static void draw_window(struct window *window) {
   glClearColor(0.0, 0.0, 0.0, 0.5);
   glClear(GL_COLOR_BUFFER_BIT);
 
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, colors);
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, textureId);
   glUniform1i(samplerLoc, 0);
 
-  glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-
-  glDeleteTextures(1, &textureId);
+  if (atlas) {
+    draw_atlas();
+  } else {
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, colors);
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+  }
 
   glDisableVertexAttribArray(0);
   glDisableVertexAttribArray(1);
@@ -226,6 +231,71 @@ static void draw_window(struct window *window) {
   eglSwapBuffers(egl_display, window->egl_surface);
 }
 
+static void create_atlas(int count, const char *const *paths) {
+  struct thread_pool *pool;
+  GLint max_size;
+
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+  pool = thread_pool_create(0);
+  assert(pool);
+  atlas = atlas_build(pool, paths, count, max_size < 2048 ? max_size : 2048, 1);
+  thread_pool_destroy(pool);
+  assert(atlas);
+
+  atlas_names = paths;
+  atlas_count = count;
+  atlas_verts = calloc(count * 6, sizeof *atlas_verts);
+  atlas_coords = calloc(count * 6, sizeof *atlas_coords);
+  assert(atlas_verts && atlas_coords);
+}
+
+/* --stream: a bar chart redrawn one bar per tick, like a live dashboard;
+ * with --continuous, one bar per frame. */
+#define STREAM_WIDTH 512
+#define STREAM_HEIGHT 256
+#define STREAM_BARS 32
+#define STREAM_TICK_MS 100
+
+/* How often a loading or reloadable image is checked for a new version. */
+#define TEXTURE_CHECK_MS 250
+#define TEXTURE_LOADING_MS 16
+
+static struct stream_texture *stream;
+static uint32_t *stream_pixels;
+static unsigned int stream_frame;
+
+static void create_stream(void) {
+  stream = stream_texture_create(STREAM_WIDTH, STREAM_HEIGHT, 3);
+  stream_pixels = calloc(STREAM_WIDTH * STREAM_HEIGHT, sizeof *stream_pixels);
+  assert(stream && stream_pixels);
+}
+
+/* Only the bar that changed is uploaded. */
+static GLuint update_stream(void) {
+  int bar_width = STREAM_WIDTH / STREAM_BARS, bar = stream_frame % STREAM_BARS;
+  int level = (stream_frame * 2654435761u >> 8) % STREAM_HEIGHT;
+  struct damage dirty;
+  int x, y;
+
+  /* RGBA bytes; the first row is at the bottom of the quad. */
+  for (y = 0; y < STREAM_HEIGHT; y++)
+    for (x = bar * bar_width; x < (bar + 1) * bar_width - 2; x++)
+      stream_pixels[y * STREAM_WIDTH + x] = y < level ? 0xff30a0f0 : 0xff202020;
+  stream_frame++;
+
+  damage_clear(&dirty);
+  damage_add(&dirty, bar * bar_width, 0, bar_width, STREAM_HEIGHT, STREAM_WIDTH, STREAM_HEIGHT);
+  return stream_texture_update(stream, stream_pixels, STREAM_WIDTH * 4, &dirty);
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
 static void signal_int(int signum)
 {
   running = 0;
@@ -285,9 +355,28 @@ static void init_wayland() {
   wl_display_roundtrip (display);
 }
 
-int main() {
+int main(int argc, char **argv) {
   struct sigaction sigint;
   struct window window;
+  struct texture_uploader *uploader;
+  struct texture_cache *textures = NULL;
+  const char *image;
+  uint64_t stream_tick = 0, now;
+  int continuous = 0, streaming = 0, first, timeout;
+  GLuint texture;
+
+  for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+    if (strcmp(argv[first], "--stream") == 0)
+      streaming = 1;
+    else if (strcmp(argv[first], "--continuous") == 0)
+      continuous = 1;
+    else {
+      fprintf(stderr, "usage: %s [--continuous] [--stream | IMAGE...]\n"
+              "  --continuous\tRedraw every frame, for benchmarks, instead of on change\n",
+              argv[0]);
+      return 1;
+    }
+  }
 
   init_wayland();
 
@@ -296,17 +385,74 @@ int main() {
 
   init_gl();
 
+  /* Decode and upload on a shared context, so loads never stall a frame. */
+  uploader = texture_uploader_create(egl_display, window.conf, window.egl_context);
+  if (!uploader) {
+    textures = texture_cache_create();
+    assert(textures);
+  }
+  /* The preprocessed copy skips the PNG decode; see tools/rawtex-convert. */
+  image = access("./image.rawtex", R_OK) == 0 ? "./image.rawtex" : "./image.png";
+  if (streaming)
+    create_stream();
+  else if (first < argc)
+    create_atlas(argc - first, (const char *const *) argv + first);
+
   sigint.sa_handler = signal_int;
   sigemptyset(&sigint.sa_mask);
   sigint.sa_flags = SA_RESETHAND;
   sigaction(SIGINT, &sigint, NULL);
 
+  /* Frames are drawn when the window is configured, the image changes or
+   * the stream ticks; in between the loop sleeps in display_wait(). */
   while (running) {
-    wl_display_dispatch_pending(display);
-    create_texture();
-    draw_window(&window);
+    if (continuous) {
+      wl_display_dispatch_pending(display);
+      needs_redraw = 1;
+    } else if (!needs_redraw) {
+      now = now_ms();
+      if (stream)
+        timeout = stream_tick > now ? stream_tick - now : 0;
+      else if (atlas)
+        timeout = -1;
+      else
+        timeout = textureId ? TEXTURE_CHECK_MS : TEXTURE_LOADING_MS;
+      if (display_wait(display, timeout) < 0)
+        break;
+    }
+
+    if (stream && (continuous || now_ms() >= stream_tick)) {
+      textureId = update_stream();
+      stream_tick = now_ms() + STREAM_TICK_MS;
+      needs_redraw = 1;
+    } else if (!stream && !atlas) {
+      texture = uploader ? texture_uploader_get(uploader, image)
+                         : texture_cache_get(textures, image);
+      if (texture != textureId) {
+        textureId = texture;
+        needs_redraw = 1;
+      }
+    }
+
+    if (needs_redraw) {
+      draw_window(&window);
+      needs_redraw = 0;
+    }
   }
 
+  if (atlas) {
+    atlas_destroy(atlas);
+    free(atlas_verts);
+    free(atlas_coords);
+  }
+  if (stream) {
+    stream_texture_destroy(stream);
+    free(stream_pixels);
+  }
+  if (uploader)
+    texture_uploader_destroy(uploader);
+  else
+    texture_cache_destroy(textures);
   delete_window(&window);
   eglTerminate(egl_display);
   wl_display_disconnect(display);
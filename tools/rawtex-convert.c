@@ -0,0 +1,116 @@
+/*
+ * Convert an image to a .rawtex file for the texture samples
+ *
+ * Decoding happens here, once, instead of at every sample start up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SOIL/SOIL.h>
+
+#include "mipmap.h"
+#include "pixel-convert.h"
+#include "raw-texture.h"
+
+static void usage(int error_code)
+{
+  fprintf(stderr, "Usage: rawtex-convert [OPTIONS] INPUT OUTPUT.rawtex\n\n"
+          "  -a\tKeep the alpha channel (default: opaque, like the PNG path)\n"
+          "  -m\tStore a mip chain (power of two sizes only on GLES2)\n"
+          "  -f box|kaiser\tMip filter (default: kaiser)\n"
+          "  -l\tColors are linear, not sRGB: filter them as they are\n"
+          "  -h\tThis help text\n\n");
+
+  exit(error_code);
+}
+
+static enum mip_filter parse_filter(const char *name)
+{
+  if (strcmp("box", name) == 0)
+    return MIP_FILTER_BOX;
+  if (strcmp("kaiser", name) != 0)
+    usage(EXIT_FAILURE);
+  return MIP_FILTER_KAISER;
+}
+
+int main(int argc, char **argv)
+{
+  const char *input = NULL, *output = NULL;
+  enum mip_filter filter = MIP_FILTER_KAISER;
+  int alpha = 0, mipmaps = 0, flags = MIP_SRGB, width, height, i;
+  struct mip_chain chain;
+  unsigned char *image;
+  void *rgba;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp("-a", argv[i]) == 0)
+      alpha = 1;
+    else if (strcmp("-m", argv[i]) == 0)
+      mipmaps = 1;
+    else if (strcmp("-f", argv[i]) == 0 && i + 1 < argc)
+      filter = parse_filter(argv[++i]);
+    else if (strcmp("-l", argv[i]) == 0)
+      flags &= ~MIP_SRGB;
+    else if (strcmp("-h", argv[i]) == 0)
+      usage(EXIT_SUCCESS);
+    else if (argv[i][0] != '-' && !input)
+      input = argv[i];
+    else if (argv[i][0] != '-' && !output)
+      output = argv[i];
+    else
+      usage(EXIT_FAILURE);
+  }
+  if (!input || !output)
+    usage(EXIT_FAILURE);
+
+  image = SOIL_load_image(input, &width, &height, 0, alpha ? SOIL_LOAD_RGBA : SOIL_LOAD_RGB);
+  if (!image) {
+    fprintf(stderr, "Can't load %s: %s\n", input, SOIL_last_result());
+    return 1;
+  }
+
+  if (mipmaps && ((width & (width - 1)) || (height & (height - 1))))
+    fprintf(stderr, "Warning: GLES2 can't mipmap %dx%d, only power of two sizes\n",
+            width, height);
+
+  if (alpha) {
+    rgba = image;
+  } else {
+    rgba = malloc((size_t) width * height * 4);
+    if (!rgba) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    pixel_convert_rgb_to_rgba(rgba, image, (size_t) width * height);
+  }
+
+  if (mipmaps) {
+    struct thread_pool *pool = thread_pool_create(0);
+
+    if (mip_chain_build(&chain, rgba, width, height, filter, flags, pool) < 0) {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    if (pool)
+      thread_pool_destroy(pool);
+  } else {
+    chain = (struct mip_chain) {
+      .levels = 1,
+      .level[0] = { rgba, width, height, (size_t) width * 4 },
+    };
+  }
+
+  if (raw_texture_write(output, &chain, mipmaps) < 0) {
+    fprintf(stderr, "Can't write %s: %m\n", output);
+    return 1;
+  }
+
+  mip_chain_release(&chain);
+
+  if (rgba != image)
+    free(rgba);
+  SOIL_free_image_data(image);
+
+  return 0;
+}